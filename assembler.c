@@ -1,17 +1,59 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <unistd.h>
 
 #include "src/utils.h"
 #include "src/tables.h"
+#include "src/symmap.h"
 #include "src/translate_utils.h"
 #include "src/translate.h"
+#include "src/program.h"
+#include "src/vm.h"
+#include "src/trace.h"
+#include "src/data.h"
+#include "src/batch.h"
+#include "src/link.h"
+#include "src/archive.h"
+#include "src/expr.h"
+#include "src/macro.h"
+#include "src/stages.h"
 #include "assembler.h"
 
 const int MAX_ARGS = 3;
 const int BUF_SIZE = 1024;
 const char* IGNORE_CHARS = " \f\n\r\t\v,()";
 
+static AssemblerOptions options = {
+    .trace_config = { { 4096, 2, 32 }, { 4096, 2, 32 }, 256 },
+    .sample_every = 1000,
+    .budget = 100000000
+};
+
+/* The source line of each instruction written to the intermediate file, kept
+   in step with the code by the stages in stages.c.
+ */
+static LineTable source_lines = { NULL, 0, 0 };
+
+/* Labels named by .globl directives in pass one. Jumps to them keep their
+   relocations under -base, so that the linker can still bind them.
+ */
+static SymbolTable* exported = NULL;
+
+/* The .data section built by pass one, written by pass two after the text.
+   Empty when pass one did not run in this process.
+ */
+static DataImage data = { NULL, 0, 0 };
+
+/* The constants defined by .equ and .set, which only live during pass one:
+   every expression is evaluated there.
+ */
+static SymbolMap* constants = NULL;
+
+/* The macros defined by .macro, which also only live during pass one. */
+static MacroTable* macros = NULL;
+
 /*******************************
  * Helper Functions
  *******************************/
@@ -46,6 +88,13 @@ static void raise_inst_error(uint32_t input_line, const char* name, char** args,
     log_inst(name, args, num_args);
 }
 
+/* Call this function if an argument or the value of a .equ cannot be
+   evaluated. EXPR is the expression as written.
+ */
+static void raise_expr_error(uint32_t input_line, const char* expr) {
+    write_to_log("Error - invalid expression at line %d: %s\n", input_line, expr);
+}
+
 /* Truncates the string at the first occurrence of the '#' character. */
 static void skip_comment(char* str) {
     char* comment_start = strchr(str, '#');
@@ -76,6 +125,11 @@ static int add_if_label(uint32_t input_line, char* str, uint32_t byte_offset,
     size_t len = strlen(str);
     if (str[len - 1] == ':') {
         str[len - 1] = '\0';
+        int64_t value;
+        if (find_constant(constants, str, &value) == 0) {
+            name_already_exists(str);
+            return -1;
+        }
         if (is_valid_label(str)) {
             if (add_to_table(symtbl, str, byte_offset) == 0) {
                 return 1;
@@ -91,6 +145,180 @@ static int add_if_label(uint32_t input_line, char* str, uint32_t byte_offset,
     }
 }
 
+/* Handles a .globl directive on line INPUT_LINE by adding each of the
+   NUM_ARGS labels in ARGS to the exported labels. Returns 0 on success and
+   -1 if there are none or one is not a valid label.
+ */
+static int declare_globals(uint32_t input_line, char** args, int num_args) {
+    if (num_args == 0) {
+        raise_inst_error(input_line, ".globl", args, num_args);
+        return -1;
+    }
+    if (!exported) {
+        exported = create_table(SYMTBL_NON_UNIQUE);
+    }
+    for (int i = 0; i < num_args; i++) {
+        if (!is_valid_label(args[i])) {
+            raise_label_error(input_line, args[i]);
+            return -1;
+        }
+        add_to_table(exported, args[i], 0);
+    }
+    return 0;
+}
+
+/* Enters the data label NAME into SYMTBL at ADDR, which may be any byte of
+   the data. Returns 0 on success and -1 if the name is already taken.
+ */
+static int add_data_label(SymbolTable* symtbl, const char* name, uint32_t addr) {
+    int64_t value;
+    if (find_constant(constants, name, &value) == 0) {
+        name_already_exists(name);
+        return -1;
+    }
+    return add_data_to_table(symtbl, name, addr);
+}
+
+/* Pads the data to a word boundary for a .word. The labels in SYMTBL at the
+   end of the data, defined since the last directive on this line or a line
+   of their own, are moved past the padding, so that they name the word as
+   they do with MIPS gas.
+ */
+static void align_data_for_word(SymbolTable* symtbl) {
+    uint32_t end = DATA_BASE + data.len;
+    align_data(&data, 4);
+    if (DATA_BASE + data.len == end) {
+        return;
+    }
+    /* Data labels are entered in address order, after any text labels
+       that came before them. */
+    for (uint32_t i = symtbl->len; i-- > 0;) {
+        uint32_t addr = symtbl->tbl[i].addr;
+        if (addr == end) {
+            symtbl->tbl[i].addr = DATA_BASE + data.len;
+        } else if (addr >= DATA_BASE) {
+            break;
+        }
+    }
+}
+
+/* Handles a line of NUM_TOKENS TOKENS on line INPUT_LINE of pass one while
+   in the .data section. REST is the text of the line after the directive as
+   read, for string literals. A label is entered into SYMTBL at its address
+   in the data, and moved past the padding of a .word as by
+   align_data_for_word(). Returns 0 on success and -1 on any error.
+ */
+static int assemble_data_line(uint32_t input_line, char** tokens, int num_tokens,
+    const char* rest, SymbolTable* symtbl) {
+    char* label = NULL;
+    char* token = tokens[0];
+    size_t len = strlen(token);
+    if (token[len - 1] == ':') {
+        token[len - 1] = '\0';
+        if (!is_valid_label(token)) {
+            raise_label_error(input_line, token);
+            return -1;
+        }
+        label = token;
+        tokens++;
+        num_tokens--;
+        token = num_tokens ? tokens[0] : NULL;
+    }
+    if (label && add_data_label(symtbl, label, DATA_BASE + data.len) != 0) {
+        return -1;
+    }
+    if (token && strcmp(token, ".word") == 0) {
+        align_data_for_word(symtbl);
+    }
+    if (!token) {
+        return 0;
+    }
+
+    char** args = tokens + 1;
+    int num_args = 0;
+    int err;
+    if (strcmp(token, ".ascii") == 0 || strcmp(token, ".asciiz") == 0) {
+        err = emit_string(&data, token, rest);
+    } else {
+        int64_t values[BUF_SIZE / 2];
+        for (; num_args < num_tokens - 1; num_args++) {
+            if (evaluate_expr(args[num_args], constants, symtbl, &values[num_args]) != 0) {
+                raise_expr_error(input_line, args[num_args]);
+                return -1;
+            }
+        }
+        err = !is_data_directive(token) || emit_data(&data, token, values, num_args) != 0;
+    }
+    if (err) {
+        raise_inst_error(input_line, token, args, num_args);
+        return -1;
+    }
+    return 0;
+}
+
+/* Handles a .equ or .set line of NUM_TOKENS TOKENS on line INPUT_LINE, which
+   defines the constant named by its second token. The expression is the
+   rest of REST, the text of the line after the directive as read, past the
+   name and a comma, so unlike an argument it may hold spaces and
+   parentheses. Returns 0 on success and -1 on any error.
+ */
+static int define_constant_line(uint32_t input_line, char** tokens, int num_tokens,
+    char* rest, SymbolTable* symtbl) {
+    if (num_tokens < 2) {
+        raise_inst_error(input_line, tokens[0], NULL, 0);
+        return -1;
+    }
+    char* name = tokens[1];
+    if (!is_valid_label(name)) {
+        raise_label_error(input_line, name);
+        return -1;
+    }
+    if (get_addr_for_symbol(symtbl, name) != -1) {
+        name_already_exists(name);
+        return -1;
+    }
+
+    char* expr = rest + strspn(rest, IGNORE_CHARS) + strlen(name);
+    expr += strspn(expr, " \f\r\t\v");
+    if (*expr == ',') {
+        expr += 1 + strspn(expr + 1, " \f\r\t\v");
+    }
+    skip_comment(expr);
+    expr[strcspn(expr, "\n")] = '\0';
+    int64_t value;
+    if (evaluate_expr(expr, constants, symtbl, &value) != 0
+        || define_constant(&constants, name, value) != 0) {
+        raise_expr_error(input_line, expr);
+        return -1;
+    }
+    return 0;
+}
+
+/* Replaces each of the NUM_ARGS arguments in ARGS that is an expression or
+   names a constant by its value, written in decimal to NUMBERS. Registers,
+   numbers, labels and the LABEL@hi and LABEL@lo halves are left for pass
+   two. Returns 0 on success and -1 if an expression cannot be evaluated.
+ */
+static int substitute_expressions(uint32_t input_line, char** args, int num_args,
+    char numbers[][24], SymbolTable* symtbl) {
+    for (int i = 0; i < num_args; i++) {
+        long int number;
+        int64_t value;
+        if (args[i][0] == '$' || strchr(args[i], '@')
+            || translate_num(&number, args[i], LONG_MIN, LONG_MAX) == 0
+            || (is_valid_label(args[i]) && find_constant(constants, args[i], &value) != 0)) {
+            continue;
+        }
+        if (evaluate_expr(args[i], constants, symtbl, &value) != 0) {
+            raise_expr_error(input_line, args[i]);
+            return -1;
+        }
+        sprintf(numbers[i], "%lld", (long long) value);
+        args[i] = numbers[i];
+    }
+    return 0;
+}
+
 /*******************************
  * Implement the Following
  *******************************/
@@ -112,6 +340,184 @@ static int parse_args(uint32_t input_line, char** args, int* num_args) {
     return 0;
 }
 
+/* Like parse_args(), for the NUM_TOKENS TOKENS after an instruction name that
+   pass one has already split.
+ */
+static int parse_arg_tokens(uint32_t input_line, char** tokens, int num_tokens, char** args,
+    int* num_args) {
+    for (int i = 0; i < num_tokens; i++) {
+        if (*num_args < MAX_ARGS) {
+            args[*num_args] = tokens[i];
+            (*num_args)++;
+        } else {
+            raise_extra_arg_error(input_line, tokens[i]);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Where pass one is in the program. Carried from one line to the next,
+   including the lines a macro expands to.
+ */
+typedef struct {
+    FILE* output;
+    SymbolTable* symtbl;
+    uint32_t byte_offset;
+    int in_data;
+} PassOne;
+
+static int assemble_line(PassOne* pass, uint32_t input_line, char** tokens, int num_tokens,
+    char* rest);
+
+/* Returns 1 if the directive NAME reads the raw text of its line rather than
+   its tokens.
+ */
+static int reads_raw_line(const char* name) {
+    return strcmp(name, ".ascii") == 0 || strcmp(name, ".asciiz") == 0
+        || strcmp(name, ".equ") == 0 || strcmp(name, ".set") == 0;
+}
+
+/* Handles the .macro line of NUM_TOKENS TOKENS on line INPUT_LINE, which
+   names the macro and its parameters. Returns the macro for the lines of its
+   body, or NULL on any error.
+ */
+static Macro* begin_macro(uint32_t input_line, char** tokens, int num_tokens) {
+    if (num_tokens < 2) {
+        raise_inst_error(input_line, tokens[0], NULL, 0);
+        return NULL;
+    }
+    for (int i = 1; i < num_tokens; i++) {
+        if (!is_valid_label(tokens[i])) {
+            raise_label_error(input_line, tokens[i]);
+            return NULL;
+        }
+    }
+    if (!macros) {
+        macros = create_macro_table();
+    }
+    Macro* macro = define_macro(macros, tokens[1], tokens + 2, num_tokens - 2);
+    if (!macro) {
+        raise_inst_error(input_line, tokens[0], tokens + 1, num_tokens - 1);
+    }
+    return macro;
+}
+
+/* Enters the label TOKEN, ending in ':', at the current address of the
+   section pass one is in. Returns 0 on success and -1 on any error.
+ */
+static int add_label_here(PassOne* pass, uint32_t input_line, char* token) {
+    if (!pass->in_data) {
+        return add_if_label(input_line, token, pass->byte_offset, pass->symtbl) == -1 ? -1 : 0;
+    }
+    token[strlen(token) - 1] = '\0';
+    if (!is_valid_label(token)) {
+        raise_label_error(input_line, token);
+        return -1;
+    }
+    return add_data_label(pass->symtbl, token, DATA_BASE + data.len);
+}
+
+/* Expands MACRO, invoked on line INPUT_LINE with the NUM_ARGS arguments in
+   ARGS, and assembles each line of the expansion as if it had been read
+   there, so that the instructions it writes advance the byte offset and
+   are attributed to INPUT_LINE. Returns 0 on success and -1 on any error.
+ */
+static int expand_macro(PassOne* pass, uint32_t input_line, Macro* macro, char** args,
+    int num_args) {
+    if ((uint32_t) num_args != macro->num_params) {
+        raise_inst_error(input_line, macro->name, args, num_args);
+        return -1;
+    }
+    if (macro->expanding) {
+        write_to_log("Error - recursive macro at line %d: %s\n", input_line, macro->name);
+        return -1;
+    }
+    macro->expanding = 1;
+    uint32_t unique = macros->expansions++;
+    int ret_code = 0;
+    for (uint32_t i = 0; i < macro->num_lines; i++) {
+        char buf[BUF_SIZE];
+        char* tokens[BUF_SIZE / 2];
+        char* rest;
+        int num_tokens = expand_macro_line(macro, i, args, unique, buf, BUF_SIZE, tokens, &rest);
+        if (num_tokens == -1) {
+            raise_inst_error(input_line, macro->name, args, num_args);
+            ret_code = -1;
+        } else if (assemble_line(pass, input_line, tokens, num_tokens, rest) != 0) {
+            ret_code = -1;
+        }
+    }
+    macro->expanding = 0;
+    return ret_code;
+}
+
+/* Assembles a line of NUM_TOKENS TOKENS, read from line INPUT_LINE of the
+   input or expanded from a macro invoked there. REST is the text of the
+   line after the instruction or directive name as read, or NULL if the
+   directive does not need it. Returns 0 on success and -1 on any error.
+ */
+static int assemble_line(PassOne* pass, uint32_t input_line, char** tokens, int num_tokens,
+    char* rest) {
+    SymbolTable* symtbl = pass->symtbl;
+    char* token = tokens[0];
+    // Switch sections; each keeps its own location counter
+    if (strcmp(token, ".text") == 0 || strcmp(token, ".data") == 0) {
+        pass->in_data = token[1] == 'd';
+        if (num_tokens > 1) {
+            raise_extra_arg_error(input_line, tokens[1]);
+            return -1;
+        }
+        return 0;
+    }
+    if (strcmp(token, ".equ") == 0 || strcmp(token, ".set") == 0) {
+        return define_constant_line(input_line, tokens, num_tokens, rest, symtbl);
+    }
+    int has_label = token[strlen(token) - 1] == ':';
+    Macro* macro = has_label < num_tokens ? find_macro(macros, tokens[has_label]) : NULL;
+    if (macro) {
+        if (has_label && add_label_here(pass, input_line, token) != 0) {
+            return -1;
+        }
+        return expand_macro(pass, input_line, macro, tokens + has_label + 1,
+            num_tokens - has_label - 1);
+    }
+    if (pass->in_data) {
+        return assemble_data_line(input_line, tokens, num_tokens, rest, symtbl);
+    }
+    int is_label = add_if_label(input_line, token, pass->byte_offset, symtbl);
+    if (is_label == -1) {
+        return -1;
+    }
+    if (is_label == num_tokens) {
+        return 0;
+    }
+    token = tokens[is_label];
+    // Scan for arguments
+    char* args[MAX_ARGS];
+    int num_args = 0;
+    if (parse_arg_tokens(input_line, tokens + is_label + 1, num_tokens - is_label - 1, args,
+        &num_args) != 0) {
+        return -1;
+    }
+    if (strcmp(token, ".globl") == 0) {
+        return declare_globals(input_line, args, num_args);
+    }
+    char numbers[MAX_ARGS][24];
+    if (substitute_expressions(input_line, args, num_args, numbers, symtbl) != 0) {
+        return -1;
+    }
+    // Checks to see if there were any errors when writing instructions
+    unsigned int lines_written = write_pass_one(pass->output, token, args, num_args);
+    if (lines_written == 0) {
+        raise_inst_error(input_line, token, args, num_args);
+        return -1;
+    }
+    pass->byte_offset += lines_written * 4;
+    record_lines(&source_lines, input_line, lines_written);
+    return 0;
+}
+
 /* First pass of the assembler. You should implement pass_two() first.
 
    This function should read each line, strip all comments, scan for labels,
@@ -131,6 +537,9 @@ static int parse_args(uint32_t input_line, char** args, int* num_args) {
     5. A line containing only a label is valid. The address of the label should
         be the byte offset of the next instruction, regardless of whether there
         is a next instruction or not.
+    6. The lines between .macro NAME PARAM, ... and .endm are kept as the body
+        of NAME. A line naming NAME is assembled as the lines of its body,
+        with each \PARAM replaced by the matching argument.
 
    Just like in pass_two(), if the function encounters an error it should NOT
    exit, but process the entire file and return -1. If no errors were encountered, 
@@ -139,49 +548,77 @@ static int parse_args(uint32_t input_line, char** args, int* num_args) {
 int pass_one(FILE* input, FILE* output, SymbolTable* symtbl) {
     /* YOUR CODE HERE */
     char buf[BUF_SIZE];
-    uint32_t input_line = 0, byte_offset = 0;
+    char line[BUF_SIZE];
+    uint32_t input_line = 0;
     int ret_code = 0;
+    PassOne pass = { output, symtbl, 0, 0 };
+    uint32_t macro_line = 0;    // where the .macro being defined started, or 0
+    Macro* defining = NULL;     // NULL if its .macro line was in error
 
 
      // Read lines and add to instructions
     while(fgets(buf, BUF_SIZE, input)) {
         input_line++;
+        strcpy(line, buf);
 
         // Ignore comments
         skip_comment(buf);
 
-        // Scan for the instruction name
-    	char* token = strtok(buf, IGNORE_CHARS);
-        if (!token) {
-            continue;
+        // Split the line into tokens, once
+        char* tokens[BUF_SIZE / 2];
+        int num_tokens = 0;
+        for (char* token = strtok(buf, IGNORE_CHARS); token; token = strtok(NULL, IGNORE_CHARS)) {
+            tokens[num_tokens++] = token;
         }
-        int is_label = add_if_label(input_line, token, byte_offset, symtbl);
-        if (is_label == -1) {
-            ret_code = -1;
+        if (num_tokens == 0) {
             continue;
         }
-        if (is_label != 0) {
-            token = strtok(NULL, IGNORE_CHARS);
-        }
-        if (!token) {
+        int name = tokens[0][strlen(tokens[0]) - 1] == ':';
+        char* rest = name < num_tokens ? line + (tokens[name] - buf) + strlen(tokens[name]) : NULL;
+
+        // Keep the body of a macro for its invocations
+        if (macro_line) {
+            if (strcmp(tokens[0], ".endm") == 0) {
+                macro_line = 0;
+                if (num_tokens > 1) {
+                    raise_extra_arg_error(input_line, tokens[1]);
+                    ret_code = -1;
+                }
+            } else if (strcmp(tokens[0], ".macro") == 0) {
+                write_to_log("Error - nested .macro at line %d: %s\n", input_line,
+                    num_tokens > 1 ? tokens[1] : "");
+                ret_code = -1;
+            } else if (defining) {
+                add_macro_line(defining, tokens, num_tokens,
+                    rest && reads_raw_line(tokens[name]) ? rest : NULL);
+            }
             continue;
         }
-        // Scan for arguments
-        char* args[MAX_ARGS];
-        int num_args = 0;
-        int p_args = parse_args(input_line, args, &num_args);
-        if (p_args == -1) {
+        if (strcmp(tokens[0], ".endm") == 0) {
+            raise_inst_error(input_line, tokens[0], tokens + 1, num_tokens - 1);
             ret_code = -1;
             continue;
         }
-    	// Checks to see if there were any errors when writing instructions
-        unsigned int lines_written = write_pass_one(output, token, args, num_args);
-        if (lines_written == 0) {
-            raise_inst_error(input_line, token, args, num_args);
+        if (strcmp(tokens[0], ".macro") == 0) {
+            macro_line = input_line;
+            defining = begin_macro(input_line, tokens, num_tokens);
+            if (!defining) {
+                ret_code = -1;
+            }
+            continue;
+        }
+        if (assemble_line(&pass, input_line, tokens, num_tokens, rest) != 0) {
             ret_code = -1;
-        } 
-        byte_offset += lines_written * 4;
+        }
     }       
+    if (macro_line) {
+        write_to_log("Error - .macro at line %d has no .endm\n", macro_line);
+        ret_code = -1;
+    }
+    free_constants(constants);
+    constants = NULL;
+    free_macro_table(macros);
+    macros = NULL;
     return ret_code;
 }
 
@@ -244,6 +681,54 @@ int pass_two(FILE *input, FILE* output, SymbolTable* symtbl, SymbolTable* reltbl
     return ret_code;
 }
 
+/* Runs both passes over INPUT in memory, for run_batch(): the intermediate
+   file is a buffer and the object file is discarded, so only the encoded
+   text in TEXT, the .data section in OUT_DATA and the tables SYMTBL and
+   RELTBL are kept. The stages run by optimize_intermediate() are skipped.
+   Returns 0 on success and -1 if either pass failed.
+ */
+static int assemble_in_memory(FILE* input, WordBuffer* text, DataImage* out_data,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
+    char* inter = NULL;
+    size_t inter_len = 0;
+    FILE* tmp = open_memstream(&inter, &inter_len);
+    if (!tmp) {
+        allocation_failed();
+    }
+    source_lines.len = 0;
+    data.len = 0;
+    int err = pass_one(input, tmp, symtbl);
+    fclose(tmp);
+
+    if (!err && inter_len > 0) {
+        char* obj = NULL;
+        size_t obj_len = 0;
+        FILE* src = fmemopen(inter, inter_len, "r");
+        FILE* dst = open_memstream(&obj, &obj_len);
+        if (!src || !dst) {
+            allocation_failed();
+        }
+        capture_inst_hex(text);
+        err = pass_two(src, dst, symtbl, reltbl);
+        capture_inst_hex(NULL);
+        fclose(src);
+        fclose(dst);
+        free(obj);
+    }
+    if (!err && data.len > 0) {
+        uint8_t* bytes = (uint8_t*) realloc(out_data->bytes, out_data->len + data.len);
+        if (!bytes) {
+            allocation_failed();
+        }
+        memcpy(bytes + out_data->len, data.bytes, data.len);
+        out_data->bytes = bytes;
+        out_data->len += data.len;
+        out_data->cap = out_data->len;
+    }
+    free(inter);
+    return err ? -1 : 0;
+}
+
 /*******************************
  * Do Not Modify Code Below
  *******************************/
@@ -278,6 +763,11 @@ int assemble(const char* in_name, const char* tmp_name, const char* out_name) {
     int err = 0;
     SymbolTable* symtbl = create_table(SYMTBL_UNIQUE_NAME);
     SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
+    WordBuffer text = { NULL, 0, 0 };
+    source_lines.len = 0;
+    data.len = 0;
+    free_table(exported);
+    exported = NULL;
 
     if (in_name) {
         printf("Running pass one: %s -> %s\n", in_name, tmp_name);
@@ -291,6 +781,12 @@ int assemble(const char* in_name, const char* tmp_name, const char* out_name) {
             err = 1;
         }
         close_files(src, dst);
+
+        if (!err && rewrites_intermediate(&options)) {
+            if (optimize_intermediate(tmp_name, symtbl, &options, &source_lines) != 0) {
+                err = 1;
+            }
+        }
     }
 
     if (out_name) {
@@ -302,19 +798,66 @@ int assemble(const char* in_name, const char* tmp_name, const char* out_name) {
         }
 
         fprintf(dst, ".text\n");
+        if (executes_program(&options) || options.lines || options.binary || options.verify) {
+            capture_inst_hex(&text);
+        }
+        if (options.has_base) {
+            resolve_local_jumps(1, options.base, exported);
+        }
         if (pass_two(src, dst, symtbl, reltbl) != 0) {
             err = 1;
         }
+        resolve_local_jumps(0, 0, NULL);
+        capture_inst_hex(NULL);
         
+        if (data.len > 0) {
+            fprintf(dst, "\n.data\n");
+            write_data_section(dst, &data);
+        }
+
         fprintf(dst, "\n.symbol\n");
         write_table(symtbl, dst);
 
         fprintf(dst, "\n.relocation\n");
         write_table(reltbl, dst);
 
+        if (options.has_base) {
+            fprintf(dst, "\n.base\n%08x\n", options.base);
+        }
+
+        if (options.lines) {
+            fprintf(dst, "\n.line\n");
+            write_line_table(dst, &source_lines, text.len);
+        }
+
         close_files(src, dst);
+
+        if (!err && options.binary) {
+            if (write_binary_file(options.binary, &text, symtbl, reltbl, &data, &options) != 0) {
+                err = 1;
+            }
+        }
+        if (!err && options.verify) {
+            if (verify_text(&text, symtbl, reltbl, exported, &options) != 0) {
+                err = 1;
+            }
+        }
+        if (!err && options.analyze_hazards) {
+            if (report_hazards(out_name, symtbl) != 0) {
+                err = 1;
+            }
+        }
+        if (!err && executes_program(&options)) {
+            if (run_program(text.words, text.len, symtbl, reltbl, &data,
+                &source_lines, &options) != 0) {
+                err = 1;
+            }
+        }
     }
+    free(text.words);
     
+    free_table(exported);
+    exported = NULL;
     free_table(symtbl);
     free_table(reltbl);
     return err;
@@ -325,12 +868,57 @@ static void print_usage_and_exit() {
     printf("  Runs both passes: assembler <input file> <intermediate file> <output file>\n");
     printf("  Run pass #1:      assembler -p1 <input file> <intermediate file>\n");
     printf("  Run pass #2:      assembler -p2 <intermediate file> <output file>\n");
+    printf("  Run a test batch: assembler -batch <manifest> [-jobs N] [-budget N]\n");
+    printf("  Link objects:     assembler -link <output file> <objects or archives...>\n");
+    printf("                    [-threads N] [-time]\n");
+    printf("  Manage archives:  assembler -ar c <archive> <object files...>   create\n");
+    printf("                    assembler -ar t <archive>                     list members\n");
+    printf("                    assembler -ar x <archive> [members...]        extract\n");
+    printf("                    assembler -ar s <archive> <symbols...>        look up\n");
     printf("Append -log <file name> after any option to save log files to a text file.\n");
+    printf("Options (after pass #1 has run):\n");
+    printf("  -O                      Run the peephole optimizer and jump threading\n");
+    printf("  -icf                    Fold functions with identical bodies into one\n");
+    printf("  -reorder-functions      Place functions that call each other together\n");
+    printf("  -call-profile <file>    Weight -reorder-functions by \"caller callee count\"\n");
+    printf("                          lines in <file> instead of static call sites\n");
+    printf("  -schedule               Reorder instructions within basic blocks to\n");
+    printf("                          hide load and mult/div latency\n");
+    printf("  -fill-delay-slots       Fill the delay slot after each branch and jump\n");
+    printf("                          with the instruction before it, or with a nop\n");
+    printf("                          (not with -run, -jit, -trace, -profile or -batch)\n");
+    printf("  -align-loops=N          Pad with nops so loop heads start on N-byte\n");
+    printf("                          boundaries (N a power of two, at least 4)\n");
+    printf("Options (for pass #2):\n");
+    printf("  -base ADDR              Encode j and jal to labels in this file for text\n");
+    printf("                          loaded at ADDR, leaving relocations only for\n");
+    printf("                          undefined labels and those named by .globl;\n");
+    printf("                          the object records ADDR, where -link places it\n");
+    printf("  -binary <file>          Also write the object to <file> in a binary form\n");
+    printf("                          that can be mapped and searched in place\n");
+    printf("Options (after pass #2 has run):\n");
+    printf("  -analyze-hazards        Print estimated pipeline stall cycles per label\n");
+    printf("  -verify                 Disassemble every word and check that it assembles\n");
+    printf("                          back to the same word\n");
+    printf("  -run                    Execute the program, starting at the first\n");
+    printf("                          instruction, until it returns, and report MIPS\n");
+    printf("  -jit                    Like -run, but translate the program to x86-64\n");
+    printf("  -trace                  Like -run, but report cache miss rates and branch\n");
+    printf("                          mispredictions per label\n");
+    printf("  -icache SIZE:WAYS:LINE  Instruction cache for -trace (default 4096:2:32)\n");
+    printf("  -dcache SIZE:WAYS:LINE  Data cache for -trace (default 4096:2:32)\n");
+    printf("  -predictor N            Number of 2-bit counters for -trace (default 256)\n");
+    printf("  -profile <file>         Like -run, but write sampled call stacks to <file>\n");
+    printf("                          in the folded format read by flamegraph tools\n");
+    printf("  -sample-every=N         Instructions between -profile samples (default 1000)\n");
+    printf("  -budget N               Stop -run, -jit, -trace and -profile with an error\n");
+    printf("                          after N instructions (default 100000000)\n");
+    printf("  -lines                  Add a .line section mapping offsets to source lines\n");
     exit(0);
 }
 
 int main(int argc, char **argv) {
-    if (argc != 4 && argc != 6) {
+    if (argc < 3) {
         print_usage_and_exit();
     }
 
@@ -339,29 +927,175 @@ int main(int argc, char **argv) {
         mode = 1;
     } else if (strcmp(argv[1], "-p2") == 0) {
         mode = 2;
+    } else if (strcmp(argv[1], "-batch") == 0) {
+        mode = 3;
+    } else if (strcmp(argv[1], "-link") == 0) {
+        mode = 4;
+    } else if (strcmp(argv[1], "-ar") == 0) {
+        mode = 5;
+    }
+
+    char* files[argc];
+    int num_files = 0;
+    char* log_name = NULL;
+    for (int i = mode ? 2 : 1; i < argc; i++) {
+        if (strcmp(argv[i], "-log") == 0 && i + 1 < argc) {
+            log_name = argv[++i];
+        } else if (strcmp(argv[i], "-O") == 0) {
+            options.optimize = 1;
+        } else if (strcmp(argv[i], "-icf") == 0) {
+            options.fold_functions = 1;
+        } else if (strcmp(argv[i], "-reorder-functions") == 0) {
+            options.reorder_functions = 1;
+        } else if (strcmp(argv[i], "-call-profile") == 0 && i + 1 < argc) {
+            options.call_profile = argv[++i];
+        } else if (strcmp(argv[i], "-schedule") == 0) {
+            options.schedule = 1;
+        } else if (strcmp(argv[i], "-fill-delay-slots") == 0) {
+            options.fill_delay_slots = 1;
+        } else if (strcmp(argv[i], "-run") == 0) {
+            options.run = 1;
+        } else if (strcmp(argv[i], "-jit") == 0) {
+            options.jit = 1;
+        } else if (strcmp(argv[i], "-trace") == 0) {
+            options.trace = 1;
+        } else if (strcmp(argv[i], "-icache") == 0 && i + 1 < argc) {
+            if (parse_cache_config(argv[++i], &options.trace_config.icache) != 0) {
+                print_usage_and_exit();
+            }
+        } else if (strcmp(argv[i], "-dcache") == 0 && i + 1 < argc) {
+            if (parse_cache_config(argv[++i], &options.trace_config.dcache) != 0) {
+                print_usage_and_exit();
+            }
+        } else if (strcmp(argv[i], "-predictor") == 0 && i + 1 < argc) {
+            long int entries;
+            if (translate_num(&entries, argv[++i], 1, 1 << 24) == -1) {
+                print_usage_and_exit();
+            }
+            options.trace_config.predictor_entries = entries;
+        } else if (strcmp(argv[i], "-lines") == 0) {
+            options.lines = 1;
+        } else if (strcmp(argv[i], "-profile") == 0 && i + 1 < argc) {
+            options.profile = argv[++i];
+        } else if (strncmp(argv[i], "-sample-every=", 14) == 0) {
+            long int every;
+            if (translate_num(&every, argv[i] + 14, 1, UINT32_MAX) == -1) {
+                print_usage_and_exit();
+            }
+            options.sample_every = every;
+        } else if (strcmp(argv[i], "-jobs") == 0 && mode == 3 && i + 1 < argc) {
+            long int jobs;
+            if (translate_num(&jobs, argv[++i], 1, 1024) == -1) {
+                print_usage_and_exit();
+            }
+            options.jobs = jobs;
+        } else if (strcmp(argv[i], "-threads") == 0 && mode == 4 && i + 1 < argc) {
+            long int threads;
+            if (translate_num(&threads, argv[++i], 1, 1024) == -1) {
+                print_usage_and_exit();
+            }
+            options.threads = threads;
+        } else if (strcmp(argv[i], "-time") == 0 && mode == 4) {
+            options.time_link = 1;
+        } else if (strcmp(argv[i], "-budget") == 0 && mode <= 3 && i + 1 < argc) {
+            long int budget;
+            if (translate_num(&budget, argv[++i], 1, INT64_MAX) == -1) {
+                print_usage_and_exit();
+            }
+            options.budget = budget;
+        } else if (strcmp(argv[i], "-binary") == 0 && i + 1 < argc) {
+            options.binary = argv[++i];
+        } else if (strcmp(argv[i], "-base") == 0 && i + 1 < argc) {
+            long int base;
+            if (translate_num(&base, argv[++i], 0, UINT32_MAX) == -1 || base % 4 != 0) {
+                print_usage_and_exit();
+            }
+            options.has_base = 1;
+            options.base = base;
+        } else if (strcmp(argv[i], "-analyze-hazards") == 0) {
+            options.analyze_hazards = 1;
+        } else if (strcmp(argv[i], "-verify") == 0) {
+            options.verify = 1;
+        } else if (strncmp(argv[i], "-align-loops=", 13) == 0) {
+            long int alignment;
+            if (translate_num(&alignment, argv[i] + 13, 4, 1 << 16) == -1
+                || (alignment & (alignment - 1)) != 0) {
+                print_usage_and_exit();
+            }
+            options.align_loops = alignment;
+        } else if (argv[i][0] == '-' || (mode < 4 && num_files == 3)) {
+            print_usage_and_exit();
+        } else {
+            files[num_files++] = argv[i];
+        }
+    }
+
+    /* The VM, like MARS, runs a branch's target right after it, so the
+       instruction moved into a delay slot would be skipped or run twice. */
+    if (options.fill_delay_slots && (executes_program(&options) || mode == 3)) {
+        write_to_log("Error: -fill-delay-slots cannot be used with -run, -jit, -trace, "
+            "-profile or -batch, which execute code without delay slots\n");
+        return 1;
+    }
+
+    if (mode == 3) {
+        if (num_files != 1) {
+            print_usage_and_exit();
+        }
+        if (log_name) {
+            set_log_file(log_name);
+        }
+        unsigned jobs = options.jobs ? options.jobs : (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+        int failed = run_batch(files[0], jobs, options.budget, assemble_in_memory, stdout);
+        return failed != 0;
+    }
+
+    if (mode == 4) {
+        if (num_files < 2) {
+            print_usage_and_exit();
+        }
+        if (log_name) {
+            set_log_file(log_name);
+        }
+        printf("Linking %d files -> %s\n", num_files - 1, files[0]);
+        unsigned threads = options.threads ? options.threads
+            : (unsigned) sysconf(_SC_NPROCESSORS_ONLN);
+        int err = link_objects(files + 1, num_files - 1, files[0], threads, options.time_link);
+        if (err) {
+            write_to_log("One or more errors encountered during link operation.\n");
+        }
+        return err != 0;
+    }
+
+    if (mode == 5) {
+        if (num_files < 2 || strlen(files[0]) != 1 || !strchr("ctxs", files[0][0])) {
+            print_usage_and_exit();
+        }
+        if (log_name) {
+            set_log_file(log_name);
+        }
+        return run_archive_command(files[0][0], files[1], files + 2, num_files - 2, stdout) != 0;
     }
 
     char *input, *inter, *output;
-    if (mode == 1) {
-        input = argv[2];
-        inter = argv[3];
+    if (mode == 1 && num_files == 2) {
+        input = files[0];
+        inter = files[1];
         output = NULL;
-    } else if (mode == 2) {
+    } else if (mode == 2 && num_files == 2) {
         input = NULL;
-        inter = argv[2];
-        output = argv[3];
+        inter = files[0];
+        output = files[1];
+    } else if (mode == 0 && num_files == 3) {
+        input = files[0];
+        inter = files[1];
+        output = files[2];
     } else {
-        input = argv[1];
-        inter = argv[2];
-        output = argv[3];
+        print_usage_and_exit();
     }
 
-    if (argc == 6) {
-        if (strcmp(argv[4], "-log") == 0) {
-            set_log_file(argv[5]);
-        } else {
-            print_usage_and_exit();
-        }
+    if (log_name) {
+        set_log_file(log_name);
     }
 
     int err = assemble(input, inter, output);
@@ -373,7 +1107,7 @@ int main(int argc, char **argv) {
     }
 
     if (is_log_file_set()) {
-        printf("Results saved to %s\n", argv[5]);
+        printf("Results saved to %s\n", log_name);
     }
 
     return err;
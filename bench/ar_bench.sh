@@ -0,0 +1,16 @@
+#!/bin/sh
+# Times symbol lookups through the index of archives of 16 to 4096 members.
+# Each member is a synthetic object from gen_objects.sh defining 4 labels,
+# and 200 random labels are looked up in each archive.
+
+for n in 16 256 4096; do
+    bench/gen_objects.sh bench/objects $n 64
+    ./assembler -ar c bench/lib$n.a bench/objects/*.out > /dev/null || exit 1
+    syms=$(awk -v n=$n 'BEGIN {
+        srand(7);
+        for (i = 0; i < 200; i++) {
+            printf("o%d_%d ", int(rand() * n), int(rand() * 4));
+        }
+    }')
+    ./assembler -ar s bench/lib$n.a $syms | tail -n 1
+done
@@ -0,0 +1,32 @@
+#!/bin/sh
+# Writes COUNT synthetic object files of WORDS words each into DIR, for
+# timing -link. Every word is a jal with a relocation to a label in some
+# random object, and each object defines a label every 16 words.
+#
+#   bench/gen_objects.sh DIR COUNT WORDS
+
+dir=$1
+count=$2
+words=$3
+rm -rf "$dir"
+mkdir -p "$dir"
+awk -v dir="$dir" -v count="$count" -v words="$words" 'BEGIN {
+    srand(61);
+    labels = int(words / 16);
+    for (o = 0; o < count; o++) {
+        file = sprintf("%s/obj%04d.out", dir, o);
+        print ".text" > file;
+        for (i = 0; i < words; i++) {
+            print "0c000000" > file;
+        }
+        print "\n.symbol" > file;
+        for (j = 0; j < labels; j++) {
+            printf("%d\to%d_%d\n", j * 64, o, j) > file;
+        }
+        print "\n.relocation" > file;
+        for (i = 0; i < words; i++) {
+            printf("%d\to%d_%d\n", i * 4, int(rand() * count), int(rand() * labels)) > file;
+        }
+        close(file);
+    }
+}'
@@ -0,0 +1,56 @@
+#!/bin/sh
+# Writes a program of about WORDS instructions to FILE that uses every
+# instruction pass two encodes, with a label every 16 instructions for the
+# branches and jumps to refer to, for timing -verify.
+#
+#   bench/gen_program.sh FILE WORDS
+
+file=$1
+words=$2
+awk -v words="$words" 'BEGIN {
+    srand(47);
+    split("$zero $at $v0 $v1 $a0 $a1 $a2 $a3 $t0 $t1 $t2 $t3 $t4 $t5 $t6 $t7 " \
+        "$s0 $s1 $s2 $s3 $s4 $s5 $s6 $s7 $t8 $t9 $k0 $k1 $gp $sp $fp $ra", reg, " ");
+    split("addu sub subu and or xor nor slt sltu", rtype, " ");
+    split("sll srl sra", shift, " ");
+    split("addiu slti sltiu", signed, " ");
+    split("andi ori", unsigned, " ");
+    split("lb lbu lw sb sw", mem, " ");
+    labels = int((words + 15) / 16);
+    for (i = 0; i < words; i++) {
+        if (i % 16 == 0) {
+            printf("L%d:\n", i / 16);
+        }
+        r1 = reg[int(rand() * 32) + 1];
+        r2 = reg[int(rand() * 32) + 1];
+        r3 = reg[int(rand() * 32) + 1];
+        target = "L" int(rand() * labels);
+        near = "L" int(i / 16);
+        k = int(rand() * 14);
+        if (k < 3) {
+            printf("\t%s %s %s %s\n", rtype[int(rand() * 9) + 1], r1, r2, r3);
+        } else if (k == 3) {
+            printf("\t%s %s %s %d\n", shift[int(rand() * 3) + 1], r1, r2, int(rand() * 32));
+        } else if (k < 6) {
+            printf("\t%s %s %s %d\n", signed[int(rand() * 3) + 1], r1, r2,
+                int(rand() * 65536) - 32768);
+        } else if (k == 6) {
+            printf("\t%s %s %s %d\n", unsigned[int(rand() * 2) + 1], r1, r2,
+                int(rand() * 65536));
+        } else if (k == 7) {
+            printf("\tlui %s %d\n", r1, int(rand() * 65536));
+        } else if (k < 10) {
+            printf("\t%s %s %d(%s)\n", mem[int(rand() * 5) + 1], r1,
+                int(rand() * 65536) - 32768, r2);
+        } else if (k == 10) {
+            printf("\t%s %s %s %s\n", rand() < 0.5 ? "beq" : "bne", r1, r2, near);
+        } else if (k == 11) {
+            printf("\t%s %s\n", rand() < 0.5 ? "j" : "jal", target);
+        } else if (k == 12) {
+            printf("\t%s %s %s\n", rand() < 0.5 ? "mult" : "div", r1, r2);
+        } else {
+            printf("\t%s %s\n", rand() < 0.5 ? "mfhi" : "mflo", r1);
+        }
+    }
+    printf("\tjr $ra\n");
+}' > "$file"
@@ -0,0 +1,31 @@
+# Benchmark for -run: sums, stores and reloads a 1024-word array 2000 times,
+# with a call per pass and a mult in the inner loop. About 18 million
+# instructions; the checksum ends up in $v0.
+main:	addiu $sp, $sp, -4
+		sw $ra, 0($sp)
+		lui $s0, 0x1000				# array at the start of data memory
+		addiu $s1, $0, 2000			# passes
+		addu $v0, $0, $0
+pass:	addu $a0, $s0, $0
+		addiu $a1, $0, 1024
+		jal fill
+		addu $v0, $v0, $s2
+		addiu $s1, $s1, -1
+		bne $s1, $0, pass
+		lw $ra, 0($sp)
+		addiu $sp, $sp, 4
+		jr $ra
+
+# Writes i * i + v0 into a0[i] for i < a1 and returns the sum in s2.
+fill:	addu $s2, $0, $0
+		addu $t0, $0, $0
+loop:	mult $t0, $t0
+		mflo $t1
+		addu $t1, $t1, $v0
+		sw $t1, 0($a0)
+		lw $t2, 0($a0)
+		addu $s2, $s2, $t2
+		addiu $a0, $a0, 4
+		addiu $t0, $t0, 1
+		bne $t0, $a1, loop
+		jr $ra
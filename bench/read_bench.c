@@ -0,0 +1,164 @@
+/* Times loading an object file written by pass two with load_text_object()
+   against a loader built on fgets() and sscanf(), and against memcpy() of
+   the same number of bytes, which bounds what any loader can reach. Each is
+   run REPEAT times and the best time is reported.
+
+       bench/read_bench FILE [REPEAT]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/utils.h"
+#include "../src/tables.h"
+#include "../src/reader.h"
+
+typedef struct {
+    uint32_t num_words;
+    uint32_t num_symbols;
+    uint32_t num_relocs;
+    uint32_t checksum;      // of the words and entry offsets
+} LoadResult;
+
+static double now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+/* Loads NAME the way an ad-hoc loader would: a line at a time, with sscanf()
+   for every word and entry and a copy of every name.
+ */
+static int load_with_sscanf(const char* name, LoadResult* result) {
+    FILE* f = fopen(name, "r");
+    if (!f) {
+        return -1;
+    }
+    memset(result, 0, sizeof(LoadResult));
+    uint32_t cap = 64, len = 0;
+    uint32_t* words = (uint32_t*) malloc(cap * sizeof(uint32_t));
+    char** names = NULL;
+    uint32_t num_names = 0, names_cap = 0;
+    char buf[1024], label[1024];
+    int section = 0;        // 0 before .text, 1 in .text, 2 in entries
+    while (fgets(buf, sizeof(buf), f)) {
+        unsigned word, addr;
+        if (section == 0) {
+            section = strncmp(buf, ".text", 5) == 0;
+        } else if (section == 1 && sscanf(buf, "%x", &word) == 1) {
+            if (len == cap) {
+                cap *= 2;
+                words = (uint32_t*) realloc(words, cap * sizeof(uint32_t));
+            }
+            words[len++] = word;
+            result->checksum += word;
+        } else if (buf[0] == '.') {
+            section = 2;
+            if (strncmp(buf, ".symbol", 7) == 0) {
+                section = 3;
+            }
+        } else if (sscanf(buf, "%u\t%1023s", &addr, label) == 2) {
+            if (num_names == names_cap) {
+                names_cap = names_cap ? names_cap * 2 : 64;
+                names = (char**) realloc(names, names_cap * sizeof(char*));
+            }
+            names[num_names++] = strdup(label);
+            result->checksum += addr;
+            if (section == 3) {
+                result->num_symbols++;
+            } else {
+                result->num_relocs++;
+            }
+        }
+    }
+    fclose(f);
+    result->num_words = len;
+    for (uint32_t i = 0; i < num_names; i++) {
+        free(names[i]);
+    }
+    free(names);
+    free(words);
+    return 0;
+}
+
+static int load_with_reader(const char* name, LoadResult* result) {
+    TextObject obj;
+    int err = load_text_object(name, &obj);
+    memset(result, 0, sizeof(LoadResult));
+    result->num_words = obj.num_words;
+    result->num_symbols = obj.num_symbols;
+    result->num_relocs = obj.num_relocs;
+    for (uint32_t i = 0; i < obj.num_words; i++) {
+        result->checksum += obj.words[i];
+    }
+    for (uint32_t i = 0; i < obj.num_symbols; i++) {
+        result->checksum += obj.symbols[i].addr;
+    }
+    for (uint32_t i = 0; i < obj.num_relocs; i++) {
+        result->checksum += obj.relocs[i].addr;
+    }
+    free_text_object(&obj);
+    return err;
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s FILE [REPEAT]\n", argv[0]);
+        return 1;
+    }
+    const char* name = argv[1];
+    int repeat = argc > 2 ? atoi(argv[2]) : 3;
+    FILE* f = fopen(name, "rb");
+    if (!f || fseek(f, 0, SEEK_END) != 0) {
+        fprintf(stderr, "Unable to open %s\n", name);
+        return 1;
+    }
+    size_t size = ftell(f);
+    fclose(f);
+    double mb = size / 1e6;
+
+    char* src = (char*) malloc(size + 1);
+    char* dst = (char*) malloc(size + 1);
+    if (!src || !dst) {
+        allocation_failed();
+    }
+    memset(src, 1, size);
+    memset(dst, 0, size);
+
+    LoadResult naive, fast;
+    double best_naive = 1e9, best_fast = 1e9, best_copy = 1e9;
+    for (int r = 0; r < repeat; r++) {
+        double start = now();
+        memcpy(dst, src, size);
+        double copied = now();
+        if (load_with_sscanf(name, &naive) != 0) {
+            fprintf(stderr, "Unable to load %s\n", name);
+            return 1;
+        }
+        double naive_done = now();
+        if (load_with_reader(name, &fast) != 0) {
+            fprintf(stderr, "Unable to load %s\n", name);
+            return 1;
+        }
+        double fast_done = now();
+        best_copy = copied - start < best_copy ? copied - start : best_copy;
+        best_naive = naive_done - copied < best_naive ? naive_done - copied : best_naive;
+        best_fast = fast_done - naive_done < best_fast ? fast_done - naive_done : best_fast;
+    }
+    if (memcmp(&naive, &fast, sizeof(LoadResult)) != 0) {
+        fprintf(stderr, "The loaders disagree on %s\n", name);
+        return 1;
+    }
+
+    printf("%s: %.1f MB, %u words, %u symbols, %u relocations\n", name, mb,
+        fast.num_words, fast.num_symbols, fast.num_relocs);
+    printf("  memcpy            %8.3f s %8.0f MB/s\n", best_copy, mb / best_copy);
+    printf("  fgets + sscanf    %8.3f s %8.0f MB/s\n", best_naive, mb / best_naive);
+    printf("  load_text_object  %8.3f s %8.0f MB/s (%.1fx)\n", best_fast, mb / best_fast,
+        best_naive / best_fast);
+    free(src);
+    free(dst);
+    return 0;
+}
@@ -0,0 +1,9 @@
+# Run with -align-loops=16
+main:	addiu $t0, $0, 10
+outer:	addiu $t1, $0, 3			# loop head, padded to 16 bytes
+inner:	addiu $t1, $t1, -1			# loop head, padded again
+		bne $t1, $0, inner
+		addiu $t0, $t0, -1
+		bne $t0, $0, outer
+		beq $0, $0, exit			# forward branch, not a loop
+exit:	jr $ra
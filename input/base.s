@@ -0,0 +1,11 @@
+# Assembled with -base 0x400000: jumps to local labels are encoded in place,
+# while exported and undefined labels keep their relocations
+		.globl main, helper
+main:	jal helper					# exported, relocated
+		jal local					# encoded as 0x400018 >> 2
+		jal printf					# undefined, relocated
+		j done						# encoded
+helper:	jr $ra
+done:	jr $ra
+local:	addiu $v0, $0, 1
+		j helper					# exported, relocated
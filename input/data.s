@@ -0,0 +1,39 @@
+# Sums a table of words and counts the characters of a string, reading
+# both from the data section instead of building them at startup.
+        .data
+table:  .word 3, -1, 0x10, 100
+count:  .word 4
+flags:  .byte 1, 2, 255
+msg:    .asciiz "hi, #1\n"
+buf:    .space 6
+after:  .word 7
+last:   .byte 9
+word:                                   # names the .word, not the padding
+        .word 5
+
+        .text
+main:   la $t0 table
+        la $t1 count
+        lw $t2 0($t1)
+        addiu $v0 $0 0
+loop:   beq $t2 $0 strings
+        lw $t3 0($t0)
+        addu $v0 $v0 $t3
+        addiu $t0 $t0 4
+        addiu $t2 $t2 -1
+        j loop
+strings:
+        la $t0 msg
+        addiu $v1 $0 0
+next:   lbu $t1 0($t0)
+        beq $t1 $0 done
+        addiu $v1 $v1 1
+        addiu $t0 $t0 1
+        j next
+done:   la $t0 after
+        lw $a0 0($t0)
+        la $t0 flags
+        lbu $a1 2($t0)
+        la $t0 word
+        lw $a2 0($t0)
+        jr $ra
@@ -0,0 +1,18 @@
+# Run with -fill-delay-slots
+main:	addiu $sp, $sp, -4
+		sw $ra, 0($sp)
+		addiu $a0, $0, 5			# independent of jal, moved into its slot
+		jal square
+		lw $ra, 0($sp)
+		addiu $sp, $sp, 4			# independent of jr, moved into its slot
+		jr $ra
+square:	mult $a0, $a0
+		mflo $v0
+		addiu $t0, $0, 0
+loop:	addiu $t0, $t0, 1			# label head, kept in place
+		bne $t0, $a0, loop			# depends on $t0, nop inserted
+		addu $v0, $v0, $t0
+		beq $v0, $0, done			# depends on $v0, nop inserted
+		addiu $t1, $0, 1
+		j done						# addiu before it moved into the slot
+done:	jr $ra						# label head, nop inserted
@@ -0,0 +1,29 @@
+# Sizes and offsets computed at assembly time from constants and labels.
+        .equ WORDS, 4
+        .set FRAME_SIZE, (WORDS + 2) * 4    # two saved registers
+        .equ FLAGS, 1 << 4 | 1 << 1
+
+        .data
+table:  .word WORDS*3, -WORDS, FLAGS, 0x10000>>8
+table_end:
+msg:    .asciiz "hello"
+msg_end:
+        .equ MSG_LEN, msg_end - msg - 1
+        .equ TABLE_BYTES, table_end - table
+buf:    .space WORDS*2
+last:   .word MSG_LEN|TABLE_BYTES<<8
+
+        .text
+main:   addiu $sp $sp -FRAME_SIZE
+        sw $ra FRAME_SIZE-4($sp)
+        li $v0 TABLE_BYTES/4
+        li $v1 MSG_LEN
+        la $t0 table+8
+        lw $a0 0($t0)
+        la $t1 last
+        lw $a1 0($t1)
+        li $a2 WORDS*0x10000+FLAGS
+        andi $a3 $a2 FLAGS&0xff
+        lw $ra FRAME_SIZE-4($sp)
+        addiu $sp $sp FRAME_SIZE
+        jr $ra
@@ -0,0 +1,16 @@
+# Run with -analyze-hazards
+main:	lw $t0, 0($a0)
+		addu $t1, $t0, $t0			# load-use: 1 cycle
+		mult $t1, $a1
+		mflo $v0					# waits for mult: 11 cycles
+		jal sum
+		jr $ra						# jump: 1 cycle each
+sum:	addiu $v0, $0, 0
+loop:	lw $t0, 0($a0)
+		addiu $a0, $a0, 4
+		addu $v0, $v0, $t0			# load hidden by the addiu
+		addiu $a1, $a1, -1
+		bne $a1, $0, loop			# operand and taken backward branch: 2 cycles
+		lw $t2, 0($a0)
+		beq $t2, $0, done			# load into branch: 2 cycles, not taken
+done:	jr $ra
@@ -0,0 +1,27 @@
+# Run with -icf
+main:	jal add3
+		jal plus3
+		jal twice_a
+		jal twice_b
+		jal other
+		jal fall
+		jal add3_again
+		jal ret99
+		jr $ra
+add3:	addiu $v0, $a0, 3
+		jr $ra
+plus3:	addiu $v0, $a0, 0x3			# same encoding as add3
+		jr $ra
+twice_a:	beq $a0, $zero, out_a	# local branch compared relatively
+		jal add3
+out_a:	jr $ra
+twice_b:	beq $a0, $0, out_b
+		jal plus3					# same once plus3 is folded into add3
+out_b:	jr $ra
+other:	addiu $v0, $a0, 4			# differs from add3
+		jr $ra
+fall:	addiu $t0, $t0, 1			# no return: runs into add3_again
+add3_again:	addiu $v0, $a0, 3	# same as add3, but fall needs it here
+		jr $ra
+ret99:	addiu $v0, $0, 99
+		jr $ra
@@ -8,4 +8,7 @@ lb $s0, 0($a2)
 lbu $s0, 128($a2)
 lw $s1 156($a3)
 sb $s2, -35($t2)
-sw $s3 -999($t3)
\ No newline at end of file
+sw $s3 -999($t3)
+andi $t0, $t1, 0xFF00
+slti $t2, $s0, -1
+sltiu $a1, $a2, 32767
\ No newline at end of file
@@ -0,0 +1,12 @@
+# li picks the shortest sequence for each constant
+		li $t0, 0					# addiu
+		li $t1, -32768				# addiu, smallest signed 16-bit
+		li $t2, 32767				# addiu, largest signed 16-bit
+		li $t3, 32768				# ori, too large for addiu
+		li $s0, 0xFFFF				# ori
+		li $s1, 0x10000				# lui only
+		li $s2, 0xFFFF0000			# lui only
+		li $s3, -65536				# lui only
+		li $a0, 0x12345678			# lui-ori pair
+		li $a1, -32769				# lui-ori pair
+		li $a2, 0xFFFFFFFF			# addiu, same bits as -1
@@ -0,0 +1,11 @@
+# .line maps each word to the source line it came from; with -O the
+# mapping follows instructions the peephole optimizer keeps
+
+main:	li $a0, 0x12345678			# lui-ori pair, one entry
+		addu $t0, $t0, $0			# removed by -O
+
+		jal work
+		j done
+work:	addiu $v0, $a0, 1
+		jr $ra
+done:	addiu $t1, $0, 0
@@ -0,0 +1,9 @@
+# Linked with link_lib.s: calls cube, which is defined there
+main:	addiu $sp, $sp, -4
+		sw $ra, 0($sp)
+		addiu $a0, $0, 3
+		jal cube
+		lw $ra, 0($sp)
+		addiu $sp, $sp, 4
+		j done
+done:	jr $ra
@@ -0,0 +1,49 @@
+# Saves and restores registers and clamps values through macros instead of
+# an external preprocessor.
+        .equ WORD, 4
+
+        .macro push2 first, second
+        addiu $sp $sp -2*WORD
+        sw \first WORD($sp)
+        sw \second 0($sp)
+        .endm
+
+        .macro pop2 first, second
+        lw \second 0($sp)
+        lw \first WORD($sp)
+        addiu $sp $sp 2*WORD
+        .endm
+
+# Sets DST to the smaller of DST and LIMIT; \@ keeps the label unique.
+        .macro clamp dst, limit
+        slt $at \limit \dst
+        beq $at $0 keep\@
+        addu \dst \limit $0
+keep\@:
+        .endm
+
+        .macro greet name
+        .data
+\name:  .asciiz "hi \name\n"
+        .text
+        .endm
+
+        .macro load_first_byte dst, label
+        la $t9 \label
+        lbu \dst 0($t9)
+        .endm
+
+main:   push2 $s0, $s1
+        li $s0 50
+        li $s1 7
+        clamp $s0, $s1
+        clamp $s1, $s0
+        li $a0 3
+        clamp $a0, $s1
+        addu $v0 $s0 $a0
+        greet bob
+        load_first_byte $v1, bob
+        pop2 $s0, $s1
+        j done
+after:  addiu $v0 $v0 100
+done:   jr $ra
@@ -5,5 +5,6 @@ label:	jal								# no label
 # Things to ignore
 		bne $t0, $t1, not_found			# nonexistant label
 		addiu $t3 $t5 0x80808080		# number too large
+		la $t0, label					# a text label, not data
 
 # Can you think of any others?
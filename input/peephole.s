@@ -0,0 +1,17 @@
+# Run with -O
+main:	push $s0
+		push $ra
+		pop $ra
+		pop $s0					# both pairs cancel
+		addiu $t0, $t0, 0		# self moves
+		or $t1, $t1, $0
+		beq $t0, $t1, next		# branch to the next instruction
+next:	jal helper
+		jr $ra					# becomes a tail call
+helper:	push $t0
+keep:	pop $t0					# labelled pop is a jump target, so kept
+		bne $t0, $0, skip		# skips only removed code
+		addu $t2, $t2, $0
+skip:	addu $v0, $a0, $a1
+		beq $0, $0, keep
+		jr $ra
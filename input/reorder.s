@@ -0,0 +1,16 @@
+# Run with -reorder-functions
+main:	jal hot
+		jal cold
+		jal hot
+		jr $ra
+cold:	addiu $v0, $0, 1
+		jr $ra
+unused:	addiu $v0, $0, 2
+		jr $ra
+hot:	jal leaf
+		jal leaf
+		addiu $v0, $v0, 1
+		jr $ra
+leaf:	beq $a0, $0, done
+		addiu $a0, $a0, -1
+done:	jr $ra
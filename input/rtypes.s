@@ -5,3 +5,9 @@ sltu $t3 $s0 $0
 addu $s2 $s3 $sp
 or $ra $zero $0
 jr $ra
+subu $t0 $t1 $t2
+sub $v0 $a0 $a1
+and $s0 $s1 $s2
+nor $t3 $t3 $0
+srl $a2 $a3 4
+sra $t1 $t2 31
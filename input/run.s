@@ -0,0 +1,21 @@
+# Run with -run: computes 10! recursively, leaving 3628800 in $v0
+main:	addiu $sp, $sp, -4
+		sw $ra, 0($sp)
+		addiu $a0, $0, 10
+		jal fact
+		lw $ra, 0($sp)
+		addiu $sp, $sp, 4
+		jr $ra
+fact:	addiu $v0, $0, 1
+		beq $a0, $0, base
+		addiu $sp, $sp, -8
+		sw $ra, 0($sp)
+		sw $a0, 4($sp)
+		addiu $a0, $a0, -1
+		jal fact
+		lw $a0, 4($sp)
+		lw $ra, 0($sp)
+		addiu $sp, $sp, 8
+		mult $v0, $a0
+		mflo $v0
+base:	jr $ra
@@ -0,0 +1,14 @@
+# Run with -schedule
+main:	lw $t0, 0($a0)
+		addu $t1, $t0, $t0			# load-use, the second lw moves up
+		lw $t2, 4($a0)
+		sw $t1, 8($a0)				# stores stay ordered against loads
+		addu $t3, $t2, $t2
+		mult $a1, $a2
+		mflo $v0					# independent instructions fill the latency
+		addiu $a0, $a0, 12			# stays after every use of $a0
+		addiu $a1, $a1, -1
+		lui $at, 1					# $at pair from a pseudo expansion
+		ori $at, $at, 5
+		bne $a1, $at, main			# stays last
+		jr $ra
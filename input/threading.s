@@ -0,0 +1,17 @@
+# Run with -O
+main:	beq $a0, $0, hop1		# threads through hop1 and hop2
+		j hop1					# threads to done
+		addiu $t0, $t0, 1		# unreachable
+		addiu $t0, $t0, 2		# unreachable
+hop1:	j hop2
+		addiu $t1, $t1, 1		# unreachable
+hop2:	j done
+loop:	jal leaf
+		bne $t0, $t1, loop
+		j tail					# becomes jr $ra
+done:	addu $v0, $a0, $a1
+		j exit					# target is the next instruction
+		j done					# unreachable
+exit:	jr $ra
+leaf:	addiu $v0, $v0, 1
+tail:	jr $ra
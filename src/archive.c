@@ -0,0 +1,523 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "symmap.h"
+#include "link.h"
+#include "archive.h"
+
+/* Archives of object files, with an index from each symbol to the member
+   that defines it. The index is an open-addressing hash table stored with
+   fixed-width records, so that a lookup seeks straight to the slot for the
+   symbol's hash without reading the rest of the archive:
+
+       !<mips-archive>
+       index SSSSSSSS MMMMMMMM NNNNNNNN      slots, members, bytes of names
+       HHHHHHHH MMMMMMMM OOOOOOOO            S slots: hash, member, name
+       OOOOOOOOOOOOOOOO SSSSSSSS NNNNNNNN    M members: data offset, size, name
+       name                                  names, one per line
+       ...                                   member data, back to back
+
+   All numbers are hexadecimal. An empty slot has member ffffffff, hashes
+   are the low 32 bits of hash_name(), and name offsets are relative to the
+   start of the names. When two members define the same symbol the index
+   points at the first, as a linker searching the members in order would.
+ */
+
+#define INDEX_LINE 33
+#define SLOT_LINE 27
+#define MEMBER_LINE 35
+#define NO_MEMBER 0xffffffff
+
+typedef struct {
+    uint32_t hash;
+    uint32_t member;
+    uint32_t name;
+} Slot;
+
+/* A growable buffer holding the names section. */
+typedef struct {
+    char* buf;
+    uint32_t len;
+    uint32_t cap;
+} NamePool;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Appends NAME and a newline to POOL and returns its offset. */
+static uint32_t add_name(NamePool* pool, const char* name) {
+    uint32_t len = strlen(name) + 1;
+    while (pool->len + len > pool->cap) {
+        pool->cap = pool->cap ? pool->cap * 2 : 256;
+        pool->buf = (char*) realloc(pool->buf, pool->cap);
+        if (!pool->buf) {
+            allocation_failed();
+        }
+    }
+    uint32_t offset = pool->len;
+    memcpy(pool->buf + offset, name, len - 1);
+    pool->buf[offset + len - 1] = '\n';
+    pool->len += len;
+    return offset;
+}
+
+/* Reads the whole of the file NAME. Stores its size in SIZE and returns its
+   contents, or returns NULL if it cannot be read.
+ */
+static char* read_file(const char* name, size_t* size) {
+    FILE* f = fopen(name, "rb");
+    if (!f) {
+        return NULL;
+    }
+    size_t cap = 4096;
+    char* data = (char*) malloc(cap);
+    if (!data) {
+        allocation_failed();
+    }
+    *size = 0;
+    size_t n;
+    while ((n = fread(data + *size, 1, cap - *size, f)) > 0) {
+        *size += n;
+        if (*size == cap) {
+            cap *= 2;
+            data = (char*) realloc(data, cap);
+            if (!data) {
+                allocation_failed();
+            }
+        }
+    }
+    fclose(f);
+    return data;
+}
+
+static const char* base_name(const char* path) {
+    const char* slash = strrchr(path, '/');
+    return slash ? slash + 1 : path;
+}
+
+/* Reads LEN bytes at OFFSET in ARCHIVE into BUF and NUL-terminates them.
+   Returns 0 on success and -1 on a short read.
+ */
+static int read_record(Archive* archive, long offset, char* buf, size_t len) {
+    if (fseek(archive->file, offset, SEEK_SET) != 0
+        || fread(buf, 1, len, archive->file) != len) {
+        return -1;
+    }
+    buf[len] = '\0';
+    return 0;
+}
+
+/* Reads the name at offset OFFSET in the names of ARCHIVE into BUF, of size
+   SIZE. Returns 0 on success and -1 otherwise.
+ */
+static int read_name(Archive* archive, uint32_t offset, char* buf, size_t size) {
+    if (offset >= archive->names_len
+        || fseek(archive->file, archive->names_start + offset, SEEK_SET) != 0
+        || !fgets(buf, size, archive->file)) {
+        return -1;
+    }
+    buf[strcspn(buf, "\n")] = '\0';
+    return 0;
+}
+
+/* Reads the record of member M of ARCHIVE. Returns 0 on success and -1
+   otherwise.
+ */
+static int read_member_record(Archive* archive, uint32_t m, long* offset, size_t* size,
+    uint32_t* name) {
+    char buf[MEMBER_LINE + 1];
+    if (m >= archive->num_members
+        || read_record(archive, archive->members_start + (long) m * MEMBER_LINE,
+            buf, MEMBER_LINE) != 0) {
+        return -1;
+    }
+    char* end;
+    *offset = strtol(buf, &end, 16);
+    *size = strtoul(end, &end, 16);
+    *name = strtoul(end, NULL, 16);
+    return 0;
+}
+
+/*******************************
+ * Writing
+ *******************************/
+
+/* Builds the archive ARCHIVE_NAME from the NUM_MEMBERS object files named in
+   MEMBER_NAMES, which are stored under their base names. Returns 0 on
+   success and -1, after logging an error, if a member cannot be read or is
+   not a valid object file.
+ */
+int write_archive(const char* archive_name, char** member_names, uint32_t num_members) {
+    char** data = (char**) calloc(num_members + 1, sizeof(char*));
+    size_t* sizes = (size_t*) calloc(num_members + 1, sizeof(size_t));
+    ObjectFile* objs = (ObjectFile*) calloc(num_members + 1, sizeof(ObjectFile));
+    uint32_t* name_offsets = (uint32_t*) calloc(num_members + 1, sizeof(uint32_t));
+    if (!data || !sizes || !objs || !name_offsets) {
+        allocation_failed();
+    }
+
+    int err = 0;
+    uint32_t num_symbols = 0;
+    uint32_t parsed = 0;
+    for (uint32_t m = 0; m < num_members && !err; m++) {
+        data[m] = read_file(member_names[m], &sizes[m]);
+        if (!data[m]) {
+            write_to_log("Error: unable to read %s\n", member_names[m]);
+            err = 1;
+            break;
+        }
+        /* The parse works in place, and the member is stored as read. */
+        char* copy = (char*) malloc(sizes[m] + 1);
+        if (!copy) {
+            allocation_failed();
+        }
+        memcpy(copy, data[m], sizes[m]);
+        err = parse_object(copy, sizes[m], member_names[m], &objs[m]) != 0;
+        free(copy);
+        parsed++;
+        num_symbols += objs[m].symtbl->len;
+    }
+
+    if (!err) {
+        NamePool pool = { NULL, 0, 0 };
+        for (uint32_t m = 0; m < num_members; m++) {
+            name_offsets[m] = add_name(&pool, base_name(member_names[m]));
+        }
+
+        uint32_t num_slots = 16;
+        while (num_slots < num_symbols * 2) {
+            num_slots *= 2;
+        }
+        Slot* slots = (Slot*) malloc(num_slots * sizeof(Slot));
+        if (!slots) {
+            allocation_failed();
+        }
+        for (uint32_t i = 0; i < num_slots; i++) {
+            slots[i].member = NO_MEMBER;
+        }
+        SymbolMap* seen = create_symbol_map(num_symbols);
+        for (uint32_t m = 0; m < num_members; m++) {
+            SymbolTable* symtbl = objs[m].symtbl;
+            for (uint32_t i = 0; i < symtbl->len; i++) {
+                int inserted;
+                MapEntry* entry = insert_symbol(seen, symtbl->tbl[i].name, 0, m, &inserted);
+                if (!inserted) {
+                    write_to_log("Warning: %s is defined in both %s and %s; indexing %s\n",
+                        entry->name, member_names[entry->owner], member_names[m],
+                        member_names[entry->owner]);
+                    continue;
+                }
+                uint32_t hash = (uint32_t) hash_name(entry->name);
+                uint32_t s = hash & (num_slots - 1);
+                while (slots[s].member != NO_MEMBER) {
+                    s = (s + 1) & (num_slots - 1);
+                }
+                slots[s].hash = hash;
+                slots[s].member = m;
+                slots[s].name = add_name(&pool, entry->name);
+            }
+        }
+        uint32_t indexed = seen->len;
+        free_symbol_map(seen);
+
+        FILE* output = fopen(archive_name, "wb");
+        if (!output) {
+            write_to_log("Error: unable to open archive: %s\n", archive_name);
+            err = 1;
+        } else {
+            uint64_t offset = strlen(ARCHIVE_MAGIC) + INDEX_LINE
+                + (uint64_t) num_slots * SLOT_LINE + (uint64_t) num_members * MEMBER_LINE
+                + pool.len;
+            fputs(ARCHIVE_MAGIC, output);
+            fprintf(output, "index %08x %08x %08x\n", num_slots, num_members, pool.len);
+            for (uint32_t i = 0; i < num_slots; i++) {
+                fprintf(output, "%08x %08x %08x\n", slots[i].member == NO_MEMBER ? 0 : slots[i].hash,
+                    slots[i].member, slots[i].member == NO_MEMBER ? 0 : slots[i].name);
+            }
+            for (uint32_t m = 0; m < num_members; m++) {
+                fprintf(output, "%016lx %08x %08x\n", (unsigned long) offset,
+                    (uint32_t) sizes[m], name_offsets[m]);
+                offset += sizes[m];
+            }
+            fwrite(pool.buf, 1, pool.len, output);
+            for (uint32_t m = 0; m < num_members; m++) {
+                fwrite(data[m], 1, sizes[m], output);
+            }
+            fclose(output);
+            printf("Archived %u members with %u symbols in %u index slots\n",
+                num_members, indexed, num_slots);
+        }
+        free(slots);
+        free(pool.buf);
+    }
+
+    for (uint32_t m = 0; m < parsed; m++) {
+        free_object(&objs[m]);
+    }
+    for (uint32_t m = 0; m < num_members; m++) {
+        free(data[m]);
+    }
+    free(name_offsets);
+    free(objs);
+    free(sizes);
+    free(data);
+    return err ? -1 : 0;
+}
+
+/*******************************
+ * Reading
+ *******************************/
+
+/* Opens the archive ARCHIVE_NAME and reads its header. Returns NULL, without
+   logging anything, if the file cannot be opened or is not an archive.
+ */
+Archive* open_archive(const char* archive_name) {
+    FILE* f = fopen(archive_name, "rb");
+    if (!f) {
+        return NULL;
+    }
+    char magic[sizeof(ARCHIVE_MAGIC)];
+    char index[INDEX_LINE + 1];
+    size_t magic_len = strlen(ARCHIVE_MAGIC);
+    if (fread(magic, 1, magic_len, f) != magic_len
+        || memcmp(magic, ARCHIVE_MAGIC, magic_len) != 0
+        || fread(index, 1, INDEX_LINE, f) != INDEX_LINE
+        || strncmp(index, "index ", 6) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    index[INDEX_LINE] = '\0';
+
+    Archive* archive = (Archive*) malloc(sizeof(Archive));
+    if (!archive) {
+        allocation_failed();
+    }
+    char* end;
+    archive->file = f;
+    archive->name = archive_name;
+    archive->num_slots = strtoul(index + 6, &end, 16);
+    archive->num_members = strtoul(end, &end, 16);
+    archive->names_len = strtoul(end, NULL, 16);
+    archive->slots_start = magic_len + INDEX_LINE;
+    archive->members_start = archive->slots_start + (long) archive->num_slots * SLOT_LINE;
+    archive->names_start = archive->members_start + (long) archive->num_members * MEMBER_LINE;
+    if (archive->num_slots == 0 || (archive->num_slots & (archive->num_slots - 1)) != 0) {
+        close_archive(archive);
+        return NULL;
+    }
+    return archive;
+}
+
+void close_archive(Archive* archive) {
+    if (!archive) {
+        return;
+    }
+    fclose(archive->file);
+    free(archive);
+}
+
+/* Returns the index of the member of ARCHIVE that defines SYMBOL, or -1 if
+   none does. Reads only the index slots probed and the names they point to.
+ */
+int64_t find_member(Archive* archive, const char* symbol) {
+    uint32_t hash = (uint32_t) hash_name(symbol);
+    uint32_t mask = archive->num_slots - 1;
+    char buf[SLOT_LINE + 1];
+    char name[1024];
+    for (uint32_t i = hash & mask, probes = 0; probes < archive->num_slots;
+        i = (i + 1) & mask, probes++) {
+        if (read_record(archive, archive->slots_start + (long) i * SLOT_LINE,
+            buf, SLOT_LINE) != 0) {
+            return -1;
+        }
+        char* end;
+        uint32_t slot_hash = strtoul(buf, &end, 16);
+        uint32_t member = strtoul(end, &end, 16);
+        uint32_t offset = strtoul(end, NULL, 16);
+        if (member == NO_MEMBER) {
+            return -1;
+        }
+        if (slot_hash == hash && read_name(archive, offset, name, sizeof(name)) == 0
+            && strcmp(name, symbol) == 0) {
+            return member;
+        }
+    }
+    return -1;
+}
+
+/* Reads member MEMBER of ARCHIVE. Stores its size in SIZE and a copy of its
+   name in MEMBER_NAME, which the caller must free, and returns its contents,
+   or returns NULL if it cannot be read.
+ */
+char* read_member(Archive* archive, uint32_t member, size_t* size, char** member_name) {
+    long offset;
+    uint32_t name_offset;
+    char name[1024];
+    if (read_member_record(archive, member, &offset, size, &name_offset) != 0
+        || read_name(archive, name_offset, name, sizeof(name)) != 0) {
+        return NULL;
+    }
+    char* data = (char*) malloc(*size + 1);
+    *member_name = (char*) malloc(strlen(name) + 1);
+    if (!data || !*member_name) {
+        allocation_failed();
+    }
+    strcpy(*member_name, name);
+    if (fseek(archive->file, offset, SEEK_SET) != 0
+        || fread(data, 1, *size, archive->file) != *size) {
+        free(data);
+        free(*member_name);
+        return NULL;
+    }
+    return data;
+}
+
+/*******************************
+ * Tool Commands
+ *******************************/
+
+/* Writes the name and size of each member of ARCHIVE_NAME to OUTPUT.
+   Returns 0 on success and -1 if it is not a readable archive.
+ */
+int list_archive(const char* archive_name, FILE* output) {
+    Archive* archive = open_archive(archive_name);
+    if (!archive) {
+        write_to_log("Error: %s is not a readable archive\n", archive_name);
+        return -1;
+    }
+    int err = 0;
+    char name[1024];
+    for (uint32_t m = 0; m < archive->num_members && !err; m++) {
+        long offset;
+        size_t size;
+        uint32_t name_offset;
+        if (read_member_record(archive, m, &offset, &size, &name_offset) != 0
+            || read_name(archive, name_offset, name, sizeof(name)) != 0) {
+            err = 1;
+        } else {
+            fprintf(output, "%s\t%lu\n", name, (unsigned long) size);
+        }
+    }
+    close_archive(archive);
+    return err ? -1 : 0;
+}
+
+/* Writes the members of ARCHIVE_NAME named in MEMBER_NAMES, or all of them
+   if NUM_NAMES is 0, to files of the same names in the current directory.
+   Returns 0 on success and -1 if any could not be extracted.
+ */
+int extract_archive(const char* archive_name, char** member_names, uint32_t num_names) {
+    Archive* archive = open_archive(archive_name);
+    if (!archive) {
+        write_to_log("Error: %s is not a readable archive\n", archive_name);
+        return -1;
+    }
+    int err = 0;
+    uint32_t* found = (uint32_t*) calloc(num_names + 1, sizeof(uint32_t));
+    if (!found) {
+        allocation_failed();
+    }
+    for (uint32_t m = 0; m < archive->num_members; m++) {
+        size_t size;
+        char* name;
+        char* data = read_member(archive, m, &size, &name);
+        if (!data) {
+            write_to_log("Error: unable to read member %u of %s\n", m, archive_name);
+            err = 1;
+            break;
+        }
+        int wanted = num_names == 0;
+        for (uint32_t i = 0; i < num_names; i++) {
+            if (strcmp(member_names[i], name) == 0) {
+                found[i] = 1;
+                wanted = 1;
+            }
+        }
+        if (wanted && strchr(name, '/')) {
+            write_to_log("Error: refusing to extract %s outside the current directory\n", name);
+            err = 1;
+        } else if (wanted) {
+            FILE* output = fopen(name, "wb");
+            if (!output || fwrite(data, 1, size, output) != size) {
+                write_to_log("Error: unable to write %s\n", name);
+                err = 1;
+            }
+            if (output) {
+                fclose(output);
+            }
+        }
+        free(name);
+        free(data);
+    }
+    for (uint32_t i = 0; i < num_names && !err; i++) {
+        if (!found[i]) {
+            write_to_log("Error: no member %s in %s\n", member_names[i], archive_name);
+            err = 1;
+        }
+    }
+    free(found);
+    close_archive(archive);
+    return err ? -1 : 0;
+}
+
+/* Runs the -ar command COMMAND, one of c, t, x and s, on ARCHIVE_NAME with
+   the NUM_ARGS arguments in ARGS, writing what it reports to OUTPUT. The s
+   command looks up each symbol in ARGS through the archive's index and
+   reports the member defining it and the average time taken. Returns 0 on
+   success and -1 otherwise.
+ */
+int run_archive_command(char command, const char* archive_name, char** args, int num_args,
+    FILE* output) {
+    if (command == 'c') {
+        return write_archive(archive_name, args, num_args);
+    } else if (command == 't') {
+        return list_archive(archive_name, output);
+    } else if (command == 'x') {
+        return extract_archive(archive_name, args, num_args);
+    } else if (command != 's') {
+        write_to_log("Error: unknown archive command: %c\n", command);
+        return -1;
+    }
+
+    Archive* archive = open_archive(archive_name);
+    if (!archive) {
+        write_to_log("Error: %s is not a readable archive\n", archive_name);
+        return -1;
+    }
+    int64_t* members = (int64_t*) malloc((num_args + 1) * sizeof(int64_t));
+    if (!members) {
+        allocation_failed();
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_args; i++) {
+        members[i] = find_member(archive, args[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    int err = 0;
+    for (int i = 0; i < num_args; i++) {
+        size_t size;
+        char* name;
+        char* data = members[i] == -1 ? NULL : read_member(archive, members[i], &size, &name);
+        if (data) {
+            fprintf(output, "%s\t%s\n", args[i], name);
+            free(name);
+            free(data);
+        } else {
+            write_to_log("Error: %s is not defined in %s\n", args[i], archive_name);
+            err = 1;
+        }
+    }
+    fprintf(output, "Looked up %d symbols among %u members in %.1f us each\n", num_args,
+        archive->num_members, num_args ? seconds * 1e6 / num_args : 0.0);
+    free(members);
+    close_archive(archive);
+    return err ? -1 : 0;
+}
@@ -0,0 +1,39 @@
+#ifndef ARCHIVE_H
+#define ARCHIVE_H
+
+#include <stdint.h>
+
+#define ARCHIVE_MAGIC "!<mips-archive>\n"
+
+/* An archive opened for lookups. Only the fixed-size header has been read;
+   the index, member table and names are read on demand.
+ */
+typedef struct {
+    FILE* file;
+    const char* name;
+    uint32_t num_slots;     // a power of two
+    uint32_t num_members;
+    uint32_t names_len;
+    long slots_start;
+    long members_start;
+    long names_start;
+} Archive;
+
+int write_archive(const char* archive_name, char** member_names, uint32_t num_members);
+
+Archive* open_archive(const char* archive_name);
+
+void close_archive(Archive* archive);
+
+int64_t find_member(Archive* archive, const char* symbol);
+
+char* read_member(Archive* archive, uint32_t member, size_t* size, char** member_name);
+
+int list_archive(const char* archive_name, FILE* output);
+
+int extract_archive(const char* archive_name, char** member_names, uint32_t num_names);
+
+int run_archive_command(char command, const char* archive_name, char** args, int num_args,
+    FILE* output);
+
+#endif
@@ -0,0 +1,428 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate_utils.h"
+#include "translate.h"
+#include "decode.h"
+#include "vm.h"
+#include "data.h"
+#include "batch.h"
+
+/* A harness for running many small programs at once. Each line of the
+   manifest names a source file followed by what it must leave behind:
+
+       # comments and blank lines are ignored
+       input/run.s     $v0=3628800 $sp=0x11000000
+       tests/store.s   [0x10000000]=7 budget=1000
+       tests/bad.s     status=fault
+
+   $REG=VALUE checks a register, [ADDR]=VALUE the word at a data address,
+   status= the way the program must end (halted, the default, fault or
+   budget) and budget= overrides the instruction budget for that program.
+
+   Programs are assembled in memory and run in the VM by worker processes,
+   which claim entries one at a time from a counter in shared memory and
+   write their results next to it. A worker that crashes fails only the
+   entry it was on; another is started in its place for the rest.
+ */
+
+#define MAX_MESSAGE 128
+#define NO_ENTRY UINT32_MAX
+
+typedef enum {
+    CHECK_REG,
+    CHECK_MEM
+} CheckKind;
+
+typedef struct {
+    CheckKind kind;
+    uint32_t where;         // register number or data address
+    uint32_t value;
+} Check;
+
+typedef struct {
+    char* path;
+    VmStatus status;        // how the program must end
+    uint64_t budget;        // 0 to use the batch budget
+    Check* checks;
+    uint32_t num_checks;
+} BatchEntry;
+
+typedef struct {
+    int done;
+    int passed;
+    uint64_t executed;
+    char message[MAX_MESSAGE];
+} BatchResult;
+
+/* Lives in memory shared with the workers. */
+typedef struct {
+    uint32_t next;          // first entry not yet claimed
+    uint32_t* current;      // entry each worker is running, NO_ENTRY if none
+    BatchResult* results;
+} BatchState;
+
+/*******************************
+ * Manifest
+ *******************************/
+
+static char* create_copy_of_str(const char* str) {
+    size_t len = strlen(str) + 1;
+    char* buf = (char*) malloc(len);
+    if (!buf) {
+        allocation_failed();
+    }
+    memcpy(buf, str, len);
+    return buf;
+}
+
+static const char* status_name(VmStatus status) {
+    switch (status) {
+        case VM_HALTED:         return "halted";
+        case VM_FAULT:          return "fault";
+        default:                return "budget";
+    }
+}
+
+/* Parses one NAME=VALUE token of a manifest line into ENTRY. Returns 0 on
+   success and -1 if the token is invalid.
+ */
+static int parse_token(char* token, BatchEntry* entry) {
+    char* value = strchr(token, '=');
+    if (!value) {
+        return -1;
+    }
+    *value++ = '\0';
+
+    if (strcmp(token, "status") == 0) {
+        for (VmStatus s = VM_HALTED; s <= VM_OUT_OF_BUDGET; s++) {
+            if (strcmp(value, status_name(s)) == 0) {
+                entry->status = s;
+                return 0;
+            }
+        }
+        return -1;
+    }
+    long int num;
+    if (strcmp(token, "budget") == 0) {
+        if (translate_num(&num, value, 1, INT64_MAX) == -1) {
+            return -1;
+        }
+        entry->budget = num;
+        return 0;
+    }
+
+    Check check;
+    if (token[0] == '$') {
+        int reg = translate_reg(token);
+        if (reg == -1) {
+            return -1;
+        }
+        check.kind = CHECK_REG;
+        check.where = reg;
+    } else if (token[0] == '[' && token[strlen(token) - 1] == ']') {
+        token[strlen(token) - 1] = '\0';
+        if (translate_num(&num, token + 1, VM_MEM_BASE, VM_MEM_BASE + VM_MEM_SIZE - 4) == -1
+            || num % 4 != 0) {
+            return -1;
+        }
+        check.kind = CHECK_MEM;
+        check.where = num;
+    } else {
+        return -1;
+    }
+    if (translate_num(&num, value, INT32_MIN, UINT32_MAX) == -1) {
+        return -1;
+    }
+    check.value = (uint32_t) num;
+
+    entry->checks = (Check*) realloc(entry->checks, (entry->num_checks + 1) * sizeof(Check));
+    if (!entry->checks) {
+        allocation_failed();
+    }
+    entry->checks[entry->num_checks++] = check;
+    return 0;
+}
+
+/* Reads the manifest in MANIFEST_NAME. Stores the number of entries in
+   NUM_ENTRIES and returns them, or returns NULL if the file could not be
+   opened or has an invalid line.
+ */
+static BatchEntry* read_manifest(const char* manifest_name, uint32_t* num_entries) {
+    FILE* f = fopen(manifest_name, "r");
+    if (!f) {
+        write_to_log("Error: unable to open manifest: %s\n", manifest_name);
+        return NULL;
+    }
+
+    BatchEntry* entries = NULL;
+    uint32_t len = 0, cap = 0;
+    char buf[1024];
+    uint32_t line = 0;
+    int err = 0;
+    while (fgets(buf, sizeof(buf), f)) {
+        line++;
+        char* comment = strchr(buf, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char* token = strtok(buf, " \t\r\n");
+        if (!token) {
+            continue;
+        }
+        if (len == cap) {
+            cap = cap ? cap * 2 : 64;
+            entries = (BatchEntry*) realloc(entries, cap * sizeof(BatchEntry));
+            if (!entries) {
+                allocation_failed();
+            }
+        }
+        BatchEntry* entry = &entries[len++];
+        entry->path = create_copy_of_str(token);
+        entry->status = VM_HALTED;
+        entry->budget = 0;
+        entry->checks = NULL;
+        entry->num_checks = 0;
+        while ((token = strtok(NULL, " \t\r\n"))) {
+            if (parse_token(token, entry) != 0) {
+                write_to_log("Error - invalid manifest entry at line %u: %s\n", line, token);
+                err = 1;
+            }
+        }
+    }
+    fclose(f);
+
+    *num_entries = len;
+    if (err) {
+        for (uint32_t i = 0; i < len; i++) {
+            free(entries[i].path);
+            free(entries[i].checks);
+        }
+        free(entries);
+        return NULL;
+    }
+    return entries ? entries : (BatchEntry*) malloc(sizeof(BatchEntry));
+}
+
+/*******************************
+ * Workers
+ *******************************/
+
+/* Assembles and runs ENTRY with the instruction budget BUDGET, then checks
+   what it left behind. Records the outcome in RESULT.
+ */
+static void run_entry(const BatchEntry* entry, uint64_t budget, AssembleFn assemble,
+    BatchResult* result) {
+    result->passed = 0;
+    FILE* input = fopen(entry->path, "r");
+    if (!input) {
+        snprintf(result->message, MAX_MESSAGE, "unable to open file");
+        return;
+    }
+    WordBuffer text = { NULL, 0, 0 };
+    DataImage data = { NULL, 0, 0 };
+    SymbolTable* symtbl = create_table(SYMTBL_UNIQUE_NAME);
+    SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
+    int err = assemble(input, &text, &data, symtbl, reltbl);
+    fclose(input);
+
+    Vm* vm = err ? NULL : create_vm(text.words, text.len, symtbl, reltbl, 0);
+    if (vm && data.len > 0 && load_vm_data(vm, data.bytes, data.len) != 0) {
+        free_vm(vm);
+        vm = NULL;
+    }
+    if (!vm) {
+        snprintf(result->message, MAX_MESSAGE, "did not assemble");
+    } else {
+        VmStatus status = run_vm(vm, entry->budget ? entry->budget : budget);
+        result->executed = vm->executed;
+        if (status != entry->status) {
+            snprintf(result->message, MAX_MESSAGE, "ended with status=%s%s%s, expected %s",
+                status_name(status), status == VM_FAULT ? ": " : "",
+                status == VM_FAULT ? vm->fault : "", status_name(entry->status));
+        } else {
+            result->passed = 1;
+            for (uint32_t i = 0; i < entry->num_checks && result->passed; i++) {
+                const Check* check = &entry->checks[i];
+                uint32_t actual;
+                if (check->kind == CHECK_REG) {
+                    actual = vm->regs[check->where];
+                } else {
+                    memcpy(&actual, vm->mem + (check->where - VM_MEM_BASE), 4);
+                }
+                if (actual != check->value) {
+                    result->passed = 0;
+                    if (check->kind == CHECK_REG) {
+                        snprintf(result->message, MAX_MESSAGE, "%s is 0x%08x, expected 0x%08x",
+                            reg_name(check->where), actual, check->value);
+                    } else {
+                        snprintf(result->message, MAX_MESSAGE,
+                            "[0x%08x] is 0x%08x, expected 0x%08x",
+                            check->where, actual, check->value);
+                    }
+                }
+            }
+        }
+        free_vm(vm);
+    }
+    free(text.words);
+    free(data.bytes);
+    free_table(symtbl);
+    free_table(reltbl);
+}
+
+/* Body of worker W: claims and runs entries until none are left. */
+static void run_worker(BatchState* state, uint32_t w, const BatchEntry* entries,
+    uint32_t num_entries, uint64_t budget, AssembleFn assemble) {
+    for (;;) {
+        uint32_t i = __atomic_fetch_add(&state->next, 1, __ATOMIC_RELAXED);
+        if (i >= num_entries) {
+            break;
+        }
+        __atomic_store_n(&state->current[w], i, __ATOMIC_RELEASE);
+        run_entry(&entries[i], budget, assemble, &state->results[i]);
+        __atomic_store_n(&state->results[i].done, 1, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&state->current[w], NO_ENTRY, __ATOMIC_RELEASE);
+}
+
+/* Runs NUM_ENTRIES entries on up to JOBS worker processes. Returns 0 on
+   success and -1 if no worker could be started.
+ */
+static int run_workers(BatchState* state, unsigned jobs, const BatchEntry* entries,
+    uint32_t num_entries, uint64_t budget, AssembleFn assemble) {
+    pid_t* pids = (pid_t*) calloc(jobs, sizeof(pid_t));
+    if (!pids) {
+        allocation_failed();
+    }
+    unsigned running = 0;
+    int err = 0;
+    for (;;) {
+        for (uint32_t w = 0; w < jobs && !err
+            && __atomic_load_n(&state->next, __ATOMIC_ACQUIRE) < num_entries; w++) {
+            if (pids[w] != 0) {
+                continue;
+            }
+            state->current[w] = NO_ENTRY;
+            fflush(NULL);
+            pid_t pid = fork();
+            if (pid == 0) {
+                run_worker(state, w, entries, num_entries, budget, assemble);
+                fflush(NULL);
+                _exit(0);
+            } else if (pid < 0) {
+                write_to_log("Error: unable to start a worker process\n");
+                err = running == 0;
+                break;
+            }
+            pids[w] = pid;
+            running++;
+        }
+        if (running == 0) {
+            break;
+        }
+
+        int wstatus;
+        pid_t pid = wait(&wstatus);
+        if (pid < 0) {
+            break;
+        }
+        for (uint32_t w = 0; w < jobs; w++) {
+            if (pids[w] != pid) {
+                continue;
+            }
+            pids[w] = 0;
+            running--;
+            uint32_t i = __atomic_load_n(&state->current[w], __ATOMIC_ACQUIRE);
+            if (i != NO_ENTRY && !state->results[i].done) {
+                BatchResult* result = &state->results[i];
+                result->done = 1;
+                result->passed = 0;
+                if (WIFSIGNALED(wstatus)) {
+                    snprintf(result->message, MAX_MESSAGE, "worker killed by signal %d",
+                        WTERMSIG(wstatus));
+                } else {
+                    snprintf(result->message, MAX_MESSAGE, "worker exited with status %d",
+                        WEXITSTATUS(wstatus));
+                }
+            }
+            break;
+        }
+    }
+    free(pids);
+    return err ? -1 : 0;
+}
+
+/*******************************
+ * Batch
+ *******************************/
+
+/* Assembles and runs every program listed in the manifest MANIFEST_NAME with
+   ASSEMBLE and the VM, on JOBS processes at once, stopping each after BUDGET
+   instructions unless its entry says otherwise. Writes a line to OUTPUT for
+   each program that fails its checks, then a summary.
+
+   Returns the number of programs that failed, or -1 if the manifest could
+   not be read.
+ */
+int run_batch(const char* manifest_name, unsigned jobs, uint64_t budget,
+    AssembleFn assemble, FILE* output) {
+    uint32_t n;
+    BatchEntry* entries = read_manifest(manifest_name, &n);
+    if (!entries) {
+        return -1;
+    }
+    if (jobs == 0) {
+        jobs = 1;
+    }
+    if (jobs > n && n > 0) {
+        jobs = n;
+    }
+
+    size_t size = sizeof(BatchState) + jobs * sizeof(uint32_t) + n * sizeof(BatchResult);
+    BatchState* state = (BatchState*) mmap(NULL, size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (state == MAP_FAILED) {
+        allocation_failed();
+    }
+    state->results = (BatchResult*) (state + 1);
+    state->current = (uint32_t*) (state->results + n);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int err = run_workers(state, jobs, entries, n, budget, assemble);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    uint32_t failed = 0;
+    uint64_t executed = 0;
+    for (uint32_t i = 0; i < n; i++) {
+        BatchResult* result = &state->results[i];
+        executed += result->executed;
+        if (!result->done) {
+            snprintf(result->message, MAX_MESSAGE, "not run");
+        }
+        if (!result->done || !result->passed) {
+            fprintf(output, "FAIL %s: %s\n", entries[i].path, result->message);
+            failed++;
+        }
+    }
+    fprintf(output, "Ran %u programs on %u workers in %.3f s (%.0f programs/s, %lu instructions)\n",
+        n, jobs, seconds, seconds > 0 ? n / seconds : 0.0, (unsigned long) executed);
+    fprintf(output, "%u passed, %u failed\n", n - failed, failed);
+
+    munmap(state, size);
+    for (uint32_t i = 0; i < n; i++) {
+        free(entries[i].path);
+        free(entries[i].checks);
+    }
+    free(entries);
+    return err ? -1 : (int) failed;
+}
@@ -0,0 +1,16 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include <stdint.h>
+
+/* Assembles the program read from INPUT, appending its encoded text to TEXT
+   and its .data section to DATA and filling in SYMTBL and RELTBL. Returns 0
+   on success and -1 otherwise.
+ */
+typedef int (*AssembleFn)(FILE* input, WordBuffer* text, DataImage* data,
+    SymbolTable* symtbl, SymbolTable* reltbl);
+
+int run_batch(const char* manifest_name, unsigned jobs, uint64_t budget,
+    AssembleFn assemble, FILE* output);
+
+#endif
@@ -0,0 +1,233 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "symmap.h"
+#include "binary.h"
+
+/* Binary object files. They hold the same text, symbols and relocations as
+   the object files written by pass two, but as fixed-width records laid out
+   by BinaryHeader, with names kept in one pool of NUL-terminated strings:
+
+       header | text words | symbols, by name | relocations | strings
+
+   A reader maps the file and uses the records where they lie: looking up a
+   symbol is a binary search over the sorted records, and nothing is parsed.
+ */
+
+/*******************************
+ * Writing
+ *******************************/
+
+/* A growable pool of NUL-terminated names, each stored once. */
+typedef struct {
+    char* buf;
+    uint32_t len;
+    uint32_t cap;
+    SymbolMap* offsets;     // name -> offset, in the addr field
+} StringPool;
+
+static uint32_t add_string(StringPool* pool, const char* name) {
+    const MapEntry* entry = find_symbol(pool->offsets, name);
+    if (entry) {
+        return entry->addr;
+    }
+    uint32_t len = strlen(name) + 1;
+    while (pool->len + len > pool->cap) {
+        pool->cap = pool->cap ? pool->cap * 2 : 256;
+        pool->buf = (char*) realloc(pool->buf, pool->cap);
+        if (!pool->buf) {
+            allocation_failed();
+        }
+    }
+    uint32_t offset = pool->len;
+    memcpy(pool->buf + offset, name, len);
+    pool->len += len;
+    int inserted;
+    insert_symbol(pool->offsets, name, offset, 0, &inserted);
+    return offset;
+}
+
+static int compare_symbols_by_name(const void* a, const void* b) {
+    return strcmp((*(const Symbol* const*) a)->name, (*(const Symbol* const*) b)->name);
+}
+
+static uint32_t align4(uint32_t n) {
+    return (n + 3) & ~3u;
+}
+
+/* Writes the LEN words in WORDS, with the symbols in SYMTBL and relocations
+   in RELTBL, to OUTPUT as a binary object file. BASE is recorded as the
+   -base address if HAS_BASE is set. Returns 0 on success and -1 if writing
+   failed.
+ */
+int write_binary_object(FILE* output, const uint32_t* words, uint32_t len,
+    SymbolTable* symtbl, SymbolTable* reltbl, int has_base, uint32_t base) {
+    const Symbol** sorted = (const Symbol**) malloc((symtbl->len + 1) * sizeof(Symbol*));
+    BinarySymbol* symbols = (BinarySymbol*) malloc((symtbl->len + 1) * sizeof(BinarySymbol));
+    BinaryReloc* relocs = (BinaryReloc*) malloc((reltbl->len + 1) * sizeof(BinaryReloc));
+    if (!sorted || !symbols || !relocs) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        sorted[i] = &symtbl->tbl[i];
+    }
+    qsort(sorted, symtbl->len, sizeof(Symbol*), compare_symbols_by_name);
+
+    StringPool pool = { NULL, 0, 0, create_symbol_map(symtbl->len + reltbl->len) };
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        symbols[i].name = add_string(&pool, sorted[i]->name);
+        symbols[i].addr = sorted[i]->addr;
+    }
+    for (uint32_t i = 0; i < reltbl->len; i++) {
+        relocs[i].addr = reltbl->tbl[i].addr;
+        relocs[i].name = add_string(&pool, reltbl->tbl[i].name);
+    }
+
+    BinaryHeader header;
+    memset(&header, 0, sizeof(header));
+    strcpy(header.magic, BINARY_MAGIC);
+    header.version = BINARY_VERSION;
+    header.num_words = len;
+    header.num_symbols = symtbl->len;
+    header.num_relocs = reltbl->len;
+    header.strings_size = pool.len;
+    header.text_offset = sizeof(BinaryHeader);
+    header.symbols_offset = header.text_offset + len * sizeof(uint32_t);
+    header.relocs_offset = header.symbols_offset + symtbl->len * sizeof(BinarySymbol);
+    header.strings_offset = header.relocs_offset + reltbl->len * sizeof(BinaryReloc);
+    header.has_base = has_base != 0;
+    header.base = base;
+
+    static const char padding[4] = { 0 };
+    int err = fwrite(&header, sizeof(header), 1, output) != 1
+        || fwrite(words, sizeof(uint32_t), len, output) != len
+        || fwrite(symbols, sizeof(BinarySymbol), symtbl->len, output) != symtbl->len
+        || fwrite(relocs, sizeof(BinaryReloc), reltbl->len, output) != reltbl->len
+        || fwrite(pool.buf, 1, pool.len, output) != pool.len
+        || fwrite(padding, 1, align4(pool.len) - pool.len, output) != align4(pool.len) - pool.len;
+
+    free_symbol_map(pool.offsets);
+    free(pool.buf);
+    free(relocs);
+    free(symbols);
+    free(sorted);
+    return err ? -1 : 0;
+}
+
+/*******************************
+ * Reading
+ *******************************/
+
+/* Returns 1 if the file NAME starts with the binary object magic. */
+int is_binary_object(const char* name) {
+    char magic[sizeof(BINARY_MAGIC)];
+    FILE* f = fopen(name, "rb");
+    if (!f) {
+        return 0;
+    }
+    int match = fread(magic, 1, sizeof(magic), f) == sizeof(magic)
+        && memcmp(magic, BINARY_MAGIC, sizeof(magic)) == 0;
+    fclose(f);
+    return match;
+}
+
+/* Returns 1 if the section of COUNT records of SIZE bytes at OFFSET lies
+   within a file of FILE_SIZE bytes.
+ */
+static int section_fits(uint32_t offset, uint32_t count, uint32_t size, size_t file_size) {
+    return offset % 4 == 0 && offset <= file_size
+        && (uint64_t) count * size <= file_size - offset;
+}
+
+/* Maps the binary object file NAME read-only. The header and the bounds of
+   every section and name offset are checked, so that the records can then
+   be used without further checks. Returns NULL, after logging an error, if
+   the file cannot be mapped or is not a valid binary object.
+ */
+BinaryObject* map_binary_object(const char* name) {
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        write_to_log("Error: unable to open binary object: %s\n", name);
+        return NULL;
+    }
+    struct stat st;
+    void* data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= (off_t) sizeof(BinaryHeader)) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED) {
+        write_to_log("Error: unable to map binary object: %s\n", name);
+        return NULL;
+    }
+
+    BinaryObject* obj = (BinaryObject*) malloc(sizeof(BinaryObject));
+    if (!obj) {
+        allocation_failed();
+    }
+    obj->data = data;
+    obj->size = st.st_size;
+    obj->header = (const BinaryHeader*) data;
+    const BinaryHeader* h = obj->header;
+    const uint8_t* base = (const uint8_t*) data;
+    int valid = memcmp(h->magic, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0
+        && h->version == BINARY_VERSION
+        && section_fits(h->text_offset, h->num_words, sizeof(uint32_t), obj->size)
+        && section_fits(h->symbols_offset, h->num_symbols, sizeof(BinarySymbol), obj->size)
+        && section_fits(h->relocs_offset, h->num_relocs, sizeof(BinaryReloc), obj->size)
+        && section_fits(h->strings_offset, h->strings_size, 1, obj->size)
+        && (h->strings_size == 0 || base[h->strings_offset + h->strings_size - 1] == '\0')
+        && h->has_base <= 1;
+    if (valid) {
+        obj->words = (const uint32_t*) (base + h->text_offset);
+        obj->symbols = (const BinarySymbol*) (base + h->symbols_offset);
+        obj->relocs = (const BinaryReloc*) (base + h->relocs_offset);
+        obj->strings = (const char*) (base + h->strings_offset);
+        for (uint32_t i = 0; i < h->num_symbols && valid; i++) {
+            valid = obj->symbols[i].name < h->strings_size;
+        }
+        for (uint32_t i = 0; i < h->num_relocs && valid; i++) {
+            valid = obj->relocs[i].name < h->strings_size;
+        }
+    }
+    if (!valid) {
+        write_to_log("Error: %s is not a valid binary object\n", name);
+        unmap_binary_object(obj);
+        return NULL;
+    }
+    return obj;
+}
+
+void unmap_binary_object(BinaryObject* obj) {
+    if (!obj) {
+        return;
+    }
+    munmap(obj->data, obj->size);
+    free(obj);
+}
+
+/* Returns the address of the symbol NAME in OBJ, found by binary search over
+   the mapped records, or -1 if it is not defined.
+ */
+int64_t find_binary_symbol(const BinaryObject* obj, const char* name) {
+    uint32_t lo = 0, hi = obj->header->num_symbols;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        int cmp = strcmp(obj->strings + obj->symbols[mid].name, name);
+        if (cmp == 0) {
+            return obj->symbols[mid].addr;
+        } else if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,62 @@
+#ifndef BINARY_H
+#define BINARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define BINARY_MAGIC "MIPSOBJ"
+#define BINARY_VERSION 2
+
+/* Layout of a binary object file. Every field is a 32-bit word in host byte
+   order and every section starts on a 4-byte boundary, so a mapping of the
+   file can be used in place.
+ */
+typedef struct {
+    char magic[8];              // BINARY_MAGIC, NUL-padded
+    uint32_t version;
+    uint32_t num_words;
+    uint32_t num_symbols;
+    uint32_t num_relocs;
+    uint32_t strings_size;      // bytes, including each name's NUL
+    uint32_t text_offset;       // from the start of the file
+    uint32_t symbols_offset;
+    uint32_t relocs_offset;
+    uint32_t strings_offset;
+    uint32_t has_base;          // 1 if assembled with -base
+    uint32_t base;              // the -base address, if any
+} BinaryHeader;
+
+/* Symbols are sorted by name, so that they can be searched in place. */
+typedef struct {
+    uint32_t name;              // offset into the strings
+    uint32_t addr;
+} BinarySymbol;
+
+/* Relocations are in the order pass two wrote them, by address. */
+typedef struct {
+    uint32_t addr;
+    uint32_t name;
+} BinaryReloc;
+
+typedef struct {
+    void* data;
+    size_t size;
+    const BinaryHeader* header;
+    const uint32_t* words;
+    const BinarySymbol* symbols;
+    const BinaryReloc* relocs;
+    const char* strings;
+} BinaryObject;
+
+int write_binary_object(FILE* output, const uint32_t* words, uint32_t len,
+    SymbolTable* symtbl, SymbolTable* reltbl, int has_base, uint32_t base);
+
+int is_binary_object(const char* name);
+
+BinaryObject* map_binary_object(const char* name);
+
+void unmap_binary_object(BinaryObject* obj);
+
+int64_t find_binary_symbol(const BinaryObject* obj, const char* name);
+
+#endif
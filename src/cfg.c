@@ -0,0 +1,272 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "translate.h"
+#include "program.h"
+#include "cfg.h"
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Returns 1 if INST is beq or bne. */
+int is_cond_branch(const Instruction* inst) {
+    return (is_inst(inst, "beq") || is_inst(inst, "bne")) && inst->num_args == 3;
+}
+
+/* Returns 1 if INST transfers control, so that it must be the last
+   instruction of its basic block.
+ */
+int ends_block(const Instruction* inst) {
+    return is_cond_branch(inst) || is_inst(inst, "j") || is_inst(inst, "jal")
+        || is_inst(inst, "jr");
+}
+
+/* Returns the label operand of a beq, bne, j or jal, or NULL for any other
+   instruction.
+ */
+static char* get_label_arg(const Instruction* inst) {
+    if (is_cond_branch(inst)) {
+        return inst->args[2];
+    } else if ((is_inst(inst, "j") || is_inst(inst, "jal")) && inst->num_args == 1) {
+        return inst->args[0];
+    }
+    return NULL;
+}
+
+static void set_label_arg(Instruction* inst, const char* label) {
+    int i = is_cond_branch(inst) ? 2 : 0;
+    free(inst->args[i]);
+    inst->args[i] = (char*) malloc(strlen(label) + 1);
+    if (!inst->args[i]) {
+        allocation_failed();
+    }
+    strcpy(inst->args[i], label);
+}
+
+/*******************************
+ * Control-Flow Graph
+ *******************************/
+
+/* Splits PROG into basic blocks. A block starts at the first instruction, at
+   every instruction a label in SYMTBL refers to and after every beq, bne, j,
+   jal and jr. Successors are the branch or jump target when it is defined in
+   SYMTBL and the next block when control can fall through; jal has both,
+   since the callee eventually returns to the next block. jr has none.
+ */
+ControlFlowGraph* build_cfg(Program* prog, SymbolTable* symtbl) {
+    ControlFlowGraph* cfg = (ControlFlowGraph*) malloc(sizeof(ControlFlowGraph));
+    if (!cfg) {
+        allocation_failed();
+    }
+    uint8_t* heads = find_label_heads(prog, symtbl);
+    cfg->blocks = (BasicBlock*) malloc((prog->len + 1) * sizeof(BasicBlock));
+    cfg->block_of = (uint32_t*) malloc((prog->len + 1) * sizeof(uint32_t));
+    if (!cfg->blocks || !cfg->block_of) {
+        allocation_failed();
+    }
+
+    cfg->len = 0;
+    for (uint32_t i = 0; i < prog->len; i++) {
+        if (i == 0 || heads[i] || ends_block(&prog->insts[i - 1])) {
+            BasicBlock* block = &cfg->blocks[cfg->len++];
+            block->start = i;
+            block->labeled = heads[i];
+            block->succ[0] = NO_BLOCK;
+            block->succ[1] = NO_BLOCK;
+        }
+        cfg->blocks[cfg->len - 1].end = i + 1;
+        cfg->block_of[i] = cfg->len - 1;
+    }
+    cfg->block_of[prog->len] = NO_BLOCK;
+
+    for (uint32_t b = 0; b < cfg->len; b++) {
+        BasicBlock* block = &cfg->blocks[b];
+        Instruction* last = &prog->insts[block->end - 1];
+        int n = 0;
+        char* label = get_label_arg(last);
+        if (label) {
+            int64_t target = get_target_index(prog, symtbl, label);
+            if (target != -1 && target < prog->len) {
+                block->succ[n++] = cfg->block_of[target];
+            }
+        }
+        if (!is_inst(last, "j") && !is_inst(last, "jr") && b + 1 < cfg->len) {
+            block->succ[n++] = b + 1;
+        }
+    }
+    free(heads);
+    return cfg;
+}
+
+void free_cfg(ControlFlowGraph* cfg) {
+    if (!cfg) {
+        return;
+    }
+    free(cfg->blocks);
+    free(cfg->block_of);
+    free(cfg);
+}
+
+/* Returns 1 if every beq and bne in PROG would still reach its target after
+   instruction i moved to index MAP[i].
+ */
+int branches_in_range(Program* prog, SymbolTable* symtbl, const uint32_t* map) {
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        if (is_cond_branch(inst)) {
+            int64_t target = get_target_index(prog, symtbl, inst->args[2]);
+            if (target != -1 && !can_branch_to(map[i] * 4, map[target] * 4)) {
+                return 0;
+            }
+        }
+    }
+    return 1;
+}
+
+/*******************************
+ * Jump Threading
+ *******************************/
+
+/* Retargets the beq, bne, j or jal at index I past any chain of j instructions
+   at its target. Branches are only retargeted if the new target is still in
+   range. Returns 1 if the instruction was changed.
+ */
+static int thread_inst(Program* prog, SymbolTable* symtbl, uint32_t i) {
+    Instruction* inst = &prog->insts[i];
+    char* label = get_label_arg(inst);
+    int64_t target = label ? get_target_index(prog, symtbl, label) : -1;
+    if (target == -1 || target >= prog->len) {
+        return 0;
+    }
+
+    const char* final = label;
+    for (uint32_t steps = 0; steps < prog->len; steps++) {
+        Instruction* next = &prog->insts[target];
+        if (!is_inst(next, "j") || next->num_args != 1) {
+            break;
+        }
+        int64_t next_target = get_target_index(prog, symtbl, next->args[0]);
+        if (next_target == -1 || next_target >= prog->len || next_target == target) {
+            break;
+        }
+        final = next->args[0];
+        target = next_target;
+    }
+
+    if (final == label || strcmp(final, label) == 0) {
+        return 0;
+    }
+    if (is_cond_branch(inst) && !can_branch_to(i * 4, target * 4)) {
+        return 0;
+    }
+    set_label_arg(inst, final);
+    return 1;
+}
+
+/* Builds the CFG of PROG, threads chains of jumps and removes blocks that can
+   not be reached. The entry block and every labelled block are treated as
+   reachable, since any label may be jumped to from another file. A j, beq or
+   bne whose target ends up being the next remaining instruction is removed as
+   well, and a j to a jr is replaced by the jr. Labels in SYMTBL are moved to
+   match; RELTBL is not filled in until pass two, which will see the
+   retargeted jumps.
+
+   Returns the number of jumps that were retargeted and stores the number of
+   words removed in REMOVED.
+ */
+uint32_t thread_jumps(Program* prog, SymbolTable* symtbl, uint32_t* removed) {
+    uint32_t threaded = 0;
+    for (uint32_t i = 0; i < prog->len; i++) {
+        threaded += thread_inst(prog, symtbl, i);
+    }
+
+    ControlFlowGraph* cfg = build_cfg(prog, symtbl);
+    uint8_t* reachable = (uint8_t*) calloc(cfg->len + 1, sizeof(uint8_t));
+    uint32_t* stack = (uint32_t*) malloc((cfg->len + 1) * sizeof(uint32_t));
+    uint8_t* keep = (uint8_t*) calloc(prog->len + 1, sizeof(uint8_t));
+    if (!reachable || !stack || !keep) {
+        allocation_failed();
+    }
+    uint32_t top = 0;
+    for (uint32_t b = 0; b < cfg->len; b++) {
+        if (b == 0 || cfg->blocks[b].labeled) {
+            reachable[b] = 1;
+            stack[top++] = b;
+        }
+    }
+    while (top > 0) {
+        BasicBlock* block = &cfg->blocks[stack[--top]];
+        for (int s = 0; s < 2; s++) {
+            uint32_t succ = block->succ[s];
+            if (succ != NO_BLOCK && !reachable[succ]) {
+                reachable[succ] = 1;
+                stack[top++] = succ;
+            }
+        }
+    }
+    for (uint32_t i = 0; i < prog->len; i++) {
+        keep[i] = reachable[cfg->block_of[i]];
+    }
+
+    /* Walk backwards so that NEXT is always the next instruction still kept. */
+    uint32_t next = prog->len;
+    for (uint32_t i = prog->len; i-- > 0;) {
+        if (!keep[i]) {
+            continue;
+        }
+        Instruction* inst = &prog->insts[i];
+        char* label = get_label_arg(inst);
+        if (label && !is_inst(inst, "jal")) {
+            int64_t target = get_target_index(prog, symtbl, label);
+            if (target > i && target <= next) {
+                keep[i] = 0;
+                continue;
+            }
+        }
+        next = i;
+    }
+
+    /* A j that lands on a jr can perform the jr itself. */
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        if (!keep[i] || !is_inst(inst, "j") || inst->num_args != 1) {
+            continue;
+        }
+        int64_t target = get_target_index(prog, symtbl, inst->args[0]);
+        if (target != -1 && target < prog->len && is_inst(&prog->insts[target], "jr")) {
+            Instruction* dest = &prog->insts[target];
+            free_inst(inst);
+            set_inst(inst, dest->name, dest->args, dest->num_args);
+            threaded++;
+        }
+    }
+
+    Program* out = create_program();
+    uint32_t* origin = (uint32_t*) malloc((prog->len + 1) * sizeof(uint32_t));
+    if (!origin) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < prog->len; i++) {
+        if (keep[i]) {
+            Instruction* inst = &prog->insts[i];
+            origin[out->len] = i;
+            append_copy(out, inst);
+        }
+    }
+    uint32_t old_len = prog->len;
+    uint32_t* map = map_from_origins(origin, out->len, old_len);
+    remap_symbols(symtbl, map, old_len);
+    replace_program(prog, out);
+    *removed = old_len - prog->len;
+
+    free(map);
+    free(origin);
+    free(keep);
+    free(stack);
+    free(reachable);
+    free_cfg(cfg);
+    return threaded;
+}
@@ -0,0 +1,36 @@
+#ifndef CFG_H
+#define CFG_H
+
+#include <stdint.h>
+
+#define NO_BLOCK UINT32_MAX
+
+/* A run of instructions that is only entered at its first instruction and
+   only left after its last one.
+ */
+typedef struct {
+    uint32_t start;         // index of the first instruction
+    uint32_t end;           // one past the index of the last instruction
+    uint32_t succ[2];       // successor blocks, NO_BLOCK if unused
+    int labeled;            // some label refers to the first instruction
+} BasicBlock;
+
+typedef struct {
+    BasicBlock* blocks;
+    uint32_t len;
+    uint32_t* block_of;     // index of the block containing each instruction
+} ControlFlowGraph;
+
+int is_cond_branch(const Instruction* inst);
+
+int ends_block(const Instruction* inst);
+
+ControlFlowGraph* build_cfg(Program* prog, SymbolTable* symtbl);
+
+void free_cfg(ControlFlowGraph* cfg);
+
+int branches_in_range(Program* prog, SymbolTable* symtbl, const uint32_t* map);
+
+uint32_t thread_jumps(Program* prog, SymbolTable* symtbl, uint32_t* removed);
+
+#endif
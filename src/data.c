@@ -0,0 +1,174 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "tables.h"
+#include "data.h"
+
+/* The data directives accepted after .data:
+
+       .word N, ...     32-bit words, aligned to 4 bytes
+       .byte N, ...     bytes, signed or unsigned
+       .space N         N zero bytes
+       .ascii "S"       the characters of S
+       .asciiz "S"      the characters of S and a NUL
+
+   Each N is an expression, which pass one evaluates (see expr.c). Each
+   directive appends to one DataImage, growing it once for everything
+   the directive emits. Pass two writes the image as a .data section of
+   little-endian words, in the layout the VM's memory has.
+ */
+
+/* Returns 1 if NAME is one of the directives emit_data() or emit_string()
+   handle.
+ */
+int is_data_directive(const char* name) {
+    return strcmp(name, ".word") == 0 || strcmp(name, ".byte") == 0
+        || strcmp(name, ".space") == 0 || strcmp(name, ".ascii") == 0
+        || strcmp(name, ".asciiz") == 0;
+}
+
+/* Makes room for COUNT more bytes at the end of DATA and returns where they
+   go, or NULL if the image would grow past DATA_MAX_SIZE.
+ */
+static uint8_t* extend_data(DataImage* data, uint64_t count) {
+    if (data->len + count > DATA_MAX_SIZE) {
+        return NULL;
+    }
+    if (data->len + count > data->cap) {
+        uint32_t cap = data->cap ? data->cap : 256;
+        while (cap < data->len + count) {
+            cap *= 2;
+        }
+        data->bytes = (uint8_t*) realloc(data->bytes, cap);
+        if (!data->bytes) {
+            allocation_failed();
+        }
+        data->cap = cap;
+    }
+    uint8_t* start = data->bytes + data->len;
+    data->len += count;
+    return start;
+}
+
+/* Pads DATA with zeros to a multiple of ALIGNMENT bytes. */
+void align_data(DataImage* data, uint32_t alignment) {
+    uint32_t padding = (alignment - data->len % alignment) % alignment;
+    uint8_t* start = extend_data(data, padding);
+    if (start) {
+        memset(start, 0, padding);
+    }
+}
+
+/* Appends what the .word, .byte or .space DIRECTIVE with the NUM_VALUES
+   evaluated arguments in VALUES emits to DATA. Returns 0 on success and -1
+   if an argument is missing or out of range or the data would be too large.
+ */
+int emit_data(DataImage* data, const char* directive, const int64_t* values, int num_values) {
+    if (num_values == 0) {
+        return -1;
+    }
+    if (strcmp(directive, ".space") == 0) {
+        uint8_t* start;
+        if (num_values != 1 || values[0] < 0 || values[0] > DATA_MAX_SIZE
+            || !(start = extend_data(data, values[0]))) {
+            return -1;
+        }
+        memset(start, 0, values[0]);
+        return 0;
+    }
+
+    int is_word = strcmp(directive, ".word") == 0;
+    int64_t lower = is_word ? INT32_MIN : INT8_MIN;
+    int64_t upper = is_word ? UINT32_MAX : UINT8_MAX;
+    for (int i = 0; i < num_values; i++) {
+        if (values[i] < lower || values[i] > upper) {
+            return -1;
+        }
+    }
+    if (is_word) {
+        align_data(data, 4);
+    }
+    uint32_t size = is_word ? 4 : 1;
+    uint8_t* out = extend_data(data, (uint64_t) num_values * size);
+    if (!out) {
+        return -1;
+    }
+    for (int i = 0; i < num_values; i++) {
+        for (uint32_t b = 0; b < size; b++) {
+            *out++ = (uint8_t) ((uint32_t) values[i] >> (8 * b));
+        }
+    }
+    return 0;
+}
+
+/* Appends the string literal at the start of STR, for the .ascii or .asciiz
+   DIRECTIVE, to DATA. STR is the rest of the source line, which may only
+   hold a comment after the literal. The escapes \n, \t, \0, \\ and \" are
+   understood. Returns 0 on success and -1 if there is no well-formed
+   literal or the data would be too large.
+ */
+int emit_string(DataImage* data, const char* directive, const char* str) {
+    while (isspace((unsigned char) *str)) {
+        str++;
+    }
+    if (*str != '"') {
+        return -1;
+    }
+    const char* close = str + 1;
+    while (*close && *close != '"') {
+        close += close[0] == '\\' && close[1] ? 2 : 1;
+    }
+    if (*close != '"') {
+        return -1;
+    }
+    for (const char* rest = close + 1; *rest && *rest != '#'; rest++) {
+        if (!isspace((unsigned char) *rest)) {
+            return -1;
+        }
+    }
+
+    int terminate = strcmp(directive, ".asciiz") == 0;
+    uint32_t start_len = data->len;
+    uint8_t* out = extend_data(data, close - str - 1 + terminate);
+    if (!out) {
+        return -1;
+    }
+    for (const char* c = str + 1; c < close; c++) {
+        if (*c != '\\') {
+            *out++ = *c;
+            continue;
+        }
+        switch (*++c) {
+            case 'n': *out++ = '\n'; break;
+            case 't': *out++ = '\t'; break;
+            case '0': *out++ = '\0'; break;
+            case '\\': *out++ = '\\'; break;
+            case '"': *out++ = '"'; break;
+            default:
+                data->len = start_len;
+                return -1;
+        }
+    }
+    if (terminate) {
+        *out++ = '\0';
+    }
+    /* Escapes take two characters for one byte. */
+    data->len = out - data->bytes;
+    return 0;
+}
+
+/* Writes DATA to OUTPUT as the lines of a .data section: one word per line
+   in hexadecimal, each the little-endian value of four bytes of the image,
+   with the last one padded with zeros.
+ */
+void write_data_section(FILE* output, const DataImage* data) {
+    for (uint32_t i = 0; i < data->len; i += 4) {
+        uint32_t word = 0;
+        for (uint32_t b = 0; b < 4 && i + b < data->len; b++) {
+            word |= (uint32_t) data->bytes[i + b] << (8 * b);
+        }
+        fprintf(output, "%08x\n", word);
+    }
+}
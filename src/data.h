@@ -0,0 +1,34 @@
+#ifndef DATA_H
+#define DATA_H
+
+#include <stdint.h>
+
+/* The address the data section is loaded at, which is where the VM's memory
+   starts (VM_MEM_BASE). Data labels are entered into the symbol table at
+   their address from here, so they can never be mistaken for text offsets.
+ */
+#define DATA_BASE 0x10000000
+
+/* The most data a program may have: half of the VM's memory, leaving the
+   rest for the stack.
+ */
+#define DATA_MAX_SIZE (8 << 20)
+
+/* The bytes of a .data section, in the order the directives emit them. */
+typedef struct {
+    uint8_t* bytes;
+    uint32_t len;
+    uint32_t cap;
+} DataImage;
+
+int is_data_directive(const char* name);
+
+void align_data(DataImage* data, uint32_t alignment);
+
+int emit_data(DataImage* data, const char* directive, const int64_t* values, int num_values);
+
+int emit_string(DataImage* data, const char* directive, const char* str);
+
+void write_data_section(FILE* output, const DataImage* data);
+
+#endif
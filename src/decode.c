@@ -0,0 +1,131 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "translate.h"
+#include "decode.h"
+
+/*******************************
+ * Decoding
+ *******************************/
+
+/* Splits WORD into its fields. */
+void decode_inst(uint32_t word, DecodedInst* inst) {
+    inst->opcode = word >> 26;
+    inst->rs = (word >> 21) & 0x1f;
+    inst->rt = (word >> 16) & 0x1f;
+    inst->rd = (word >> 11) & 0x1f;
+    inst->shamt = (word >> 6) & 0x1f;
+    inst->funct = word & 0x3f;
+    inst->imm = (int16_t) (word & 0xffff);
+    inst->target = word & 0x3ffffff;
+}
+
+static const char* REG_NAMES[32] = {
+    "$zero", "$at", "$v0", "$v1", "$a0", "$a1", "$a2", "$a3",
+    "$t0", "$t1", "$t2", "$t3", "$t4", "$t5", "$t6", "$t7",
+    "$s0", "$s1", "$s2", "$s3", "$s4", "$s5", "$s6", "$s7",
+    "$t8", "$t9", "$k0", "$k1", "$gp", "$sp", "$fp", "$ra"
+};
+
+/* Returns the conventional name of register REG, which must be below 32. */
+const char* reg_name(uint8_t reg) {
+    return REG_NAMES[reg & 0x1f];
+}
+
+static uint64_t bit(uint8_t reg) {
+    return reg ? (uint64_t) 1 << reg : 0;
+}
+
+/* The encoded counterpart of get_inst_effects(): fills EFFECTS with the
+   registers WORD reads and writes and whether it accesses memory. Returns 0
+   on success and -1 if WORD is not an encoding that translate_inst() writes.
+ */
+int get_word_effects(uint32_t word, InstEffects* effects) {
+    DecodedInst d;
+    decode_inst(word, &d);
+    effects->def = 0;
+    effects->use = 0;
+    effects->reads_mem = 0;
+    effects->writes_mem = 0;
+
+    if (d.opcode == 0) {
+        switch (d.funct) {
+            case 0x21: case 0x22: case 0x23: case 0x24: case 0x25:
+            case 0x26: case 0x27: case 0x2a: case 0x2b:
+                effects->def = bit(d.rd);
+                effects->use = bit(d.rs) | bit(d.rt);
+                return 0;
+            case 0x00: case 0x02: case 0x03:
+                effects->def = bit(d.rd);
+                effects->use = bit(d.rt);
+                return 0;
+            case 0x08:
+                effects->use = bit(d.rs);
+                return 0;
+            case 0x18: case 0x1a:
+                effects->def = ((uint64_t) 1 << REG_HI) | ((uint64_t) 1 << REG_LO);
+                effects->use = bit(d.rs) | bit(d.rt);
+                return 0;
+            case 0x10:
+                effects->def = bit(d.rd);
+                effects->use = (uint64_t) 1 << REG_HI;
+                return 0;
+            case 0x12:
+                effects->def = bit(d.rd);
+                effects->use = (uint64_t) 1 << REG_LO;
+                return 0;
+            default:
+                return -1;
+        }
+    }
+
+    switch (d.opcode) {
+        case 0x09: case 0x0a: case 0x0b: case 0x0c: case 0x0d:
+            effects->def = bit(d.rt);
+            effects->use = bit(d.rs);
+            return 0;
+        case 0x0f:
+            effects->def = bit(d.rt);
+            return 0;
+        case 0x20: case 0x23: case 0x24:
+            effects->def = bit(d.rt);
+            effects->use = bit(d.rs);
+            effects->reads_mem = 1;
+            return 0;
+        case 0x28: case 0x2b:
+            effects->use = bit(d.rt) | bit(d.rs);
+            effects->writes_mem = 1;
+            return 0;
+        case 0x04: case 0x05:
+            effects->use = bit(d.rs) | bit(d.rt);
+            return 0;
+        case 0x02:
+            return 0;
+        case 0x03:
+            effects->def = (uint64_t) 1 << 31;
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/* Returns 1 if WORD is lb, lbu or lw. */
+int is_load_word(uint32_t word) {
+    uint8_t opcode = word >> 26;
+    return opcode == 0x20 || opcode == 0x23 || opcode == 0x24;
+}
+
+/* Returns 1 if WORD is beq or bne. */
+int is_branch_word(uint32_t word) {
+    uint8_t opcode = word >> 26;
+    return opcode == 0x04 || opcode == 0x05;
+}
+
+/* Returns 1 if WORD is beq, bne, j, jal or jr. */
+int is_control_word(uint32_t word) {
+    uint8_t opcode = word >> 26;
+    return is_branch_word(word) || opcode == 0x02 || opcode == 0x03
+        || (opcode == 0 && (word & 0x3f) == 0x08);
+}
@@ -0,0 +1,32 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stdint.h>
+
+/* The fields of an encoded instruction. Which of them are meaningful depends
+   on the format, which can be told from OPCODE.
+ */
+typedef struct {
+    uint8_t opcode;
+    uint8_t rs;
+    uint8_t rt;
+    uint8_t rd;
+    uint8_t shamt;
+    uint8_t funct;
+    int32_t imm;            // sign-extended 16-bit immediate
+    uint32_t target;        // 26-bit jump target
+} DecodedInst;
+
+void decode_inst(uint32_t word, DecodedInst* inst);
+
+const char* reg_name(uint8_t reg);
+
+int get_word_effects(uint32_t word, InstEffects* effects);
+
+int is_load_word(uint32_t word);
+
+int is_branch_word(uint32_t word);
+
+int is_control_word(uint32_t word);
+
+#endif
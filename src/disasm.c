@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate_utils.h"
+#include "translate.h"
+#include "decode.h"
+#include "disasm.h"
+
+/* A disassembler for the words that translate_inst() writes. The opcode of
+   a word indexes a 64-entry table, and for opcode 0 the funct field indexes
+   a second one; the entry gives the mnemonic and which fields are printed,
+   in the order pass two reads them from the intermediate file. Branch and
+   jump targets are printed as the labels they were assembled from, so that
+   each line can be fed back to translate_inst() and must give the same word.
+ */
+
+typedef enum {
+    FORMAT_INVALID = 0,     // not written by translate_inst()
+    FORMAT_RTYPE,           // rd rs rt
+    FORMAT_SHIFT,           // rd rt shamt
+    FORMAT_JR,              // rs
+    FORMAT_MULT_DIV,        // rs rt
+    FORMAT_MFHI_MFLO,       // rd
+    FORMAT_SIGNED,          // rt rs imm
+    FORMAT_UNSIGNED,        // rt rs uimm
+    FORMAT_LUI,             // rt uimm
+    FORMAT_MEM,             // rt imm rs
+    FORMAT_BRANCH,          // rs rt label
+    FORMAT_JUMP             // label
+} Format;
+
+typedef struct {
+    const char* name;
+    Format format;
+} OpInfo;
+
+static const OpInfo OPCODE_TABLE[64] = {
+    [0x02] = { "j", FORMAT_JUMP },
+    [0x03] = { "jal", FORMAT_JUMP },
+    [0x04] = { "beq", FORMAT_BRANCH },
+    [0x05] = { "bne", FORMAT_BRANCH },
+    [0x09] = { "addiu", FORMAT_SIGNED },
+    [0x0a] = { "slti", FORMAT_SIGNED },
+    [0x0b] = { "sltiu", FORMAT_SIGNED },
+    [0x0c] = { "andi", FORMAT_UNSIGNED },
+    [0x0d] = { "ori", FORMAT_UNSIGNED },
+    [0x0f] = { "lui", FORMAT_LUI },
+    [0x20] = { "lb", FORMAT_MEM },
+    [0x23] = { "lw", FORMAT_MEM },
+    [0x24] = { "lbu", FORMAT_MEM },
+    [0x28] = { "sb", FORMAT_MEM },
+    [0x2b] = { "sw", FORMAT_MEM },
+};
+
+static const OpInfo FUNCT_TABLE[64] = {
+    [0x00] = { "sll", FORMAT_SHIFT },
+    [0x02] = { "srl", FORMAT_SHIFT },
+    [0x03] = { "sra", FORMAT_SHIFT },
+    [0x08] = { "jr", FORMAT_JR },
+    [0x10] = { "mfhi", FORMAT_MFHI_MFLO },
+    [0x12] = { "mflo", FORMAT_MFHI_MFLO },
+    [0x18] = { "mult", FORMAT_MULT_DIV },
+    [0x1a] = { "div", FORMAT_MULT_DIV },
+    [0x21] = { "addu", FORMAT_RTYPE },
+    [0x22] = { "sub", FORMAT_RTYPE },
+    [0x23] = { "subu", FORMAT_RTYPE },
+    [0x24] = { "and", FORMAT_RTYPE },
+    [0x25] = { "or", FORMAT_RTYPE },
+    [0x26] = { "xor", FORMAT_RTYPE },
+    [0x27] = { "nor", FORMAT_RTYPE },
+    [0x2a] = { "slt", FORMAT_RTYPE },
+    [0x2b] = { "sltu", FORMAT_RTYPE },
+};
+
+/*******************************
+ * Target Names
+ *******************************/
+
+/* Indexes the labels in SYMTBL and the relocations in RELTBL by word for a
+   text of LEN words loaded at BASE. Where several labels share an address,
+   the first one in SYMTBL is used.
+ */
+Disassembler* create_disassembler(uint32_t len, SymbolTable* symtbl, SymbolTable* reltbl,
+    uint32_t base) {
+    Disassembler* dis = (Disassembler*) malloc(sizeof(Disassembler));
+    if (!dis) {
+        allocation_failed();
+    }
+    dis->labels = (const char**) calloc(len + 1, sizeof(char*));
+    dis->relocs = (const char**) calloc(len + 1, sizeof(char*));
+    if (!dis->labels || !dis->relocs) {
+        allocation_failed();
+    }
+    dis->len = len;
+    dis->base = base;
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        uint32_t word = symtbl->tbl[i].addr / 4;
+        if (word <= len && !dis->labels[word]) {
+            dis->labels[word] = symtbl->tbl[i].name;
+        }
+    }
+    for (uint32_t i = 0; i < reltbl->len; i++) {
+        uint32_t word = reltbl->tbl[i].addr / 4;
+        if (word < len) {
+            dis->relocs[word] = reltbl->tbl[i].name;
+        }
+    }
+    return dis;
+}
+
+void free_disassembler(Disassembler* dis) {
+    if (!dis) {
+        return;
+    }
+    free(dis->labels);
+    free(dis->relocs);
+    free(dis);
+}
+
+/* Returns the label at byte offset TARGET, or NULL if there is none. */
+static const char* label_at(const Disassembler* dis, uint32_t target) {
+    return target % 4 == 0 && target / 4 <= dis->len ? dis->labels[target / 4] : NULL;
+}
+
+/*******************************
+ * Formatting
+ *******************************/
+
+/* Where the next character of a line goes. Once it is full, nothing more is
+   written and FULL is set.
+ */
+typedef struct {
+    char* pos;
+    char* end;              // one before the end of the buffer, kept for the NUL
+    int full;
+} LineBuffer;
+
+static void put_str(LineBuffer* line, const char* str) {
+    while (*str && line->pos < line->end) {
+        *line->pos++ = *str++;
+    }
+    line->full |= *str != '\0';
+}
+
+/* Writes a space and then STR. */
+static void put_arg(LineBuffer* line, const char* str) {
+    put_str(line, " ");
+    put_str(line, str);
+}
+
+/* Writes a space and then VALUE in decimal, as translate_num() reads it. */
+static void put_num(LineBuffer* line, int64_t value) {
+    char digits[24];
+    char* p = digits + sizeof(digits) - 1;
+    *p = '\0';
+    uint64_t magnitude = value < 0 ? -(uint64_t) value : (uint64_t) value;
+    do {
+        *--p = '0' + magnitude % 10;
+        magnitude /= 10;
+    } while (magnitude);
+    if (value < 0) {
+        *--p = '-';
+    }
+    put_arg(line, p);
+}
+
+/* Writes the line of the intermediate file that WORD, at byte offset ADDR,
+   was assembled from to BUF, which holds SIZE bytes, as write_inst_string()
+   would have written it but without the newline. Registers are given their
+   conventional names and immediates are in decimal. A branch or jump target
+   with no label is written as a number, which will not assemble again.
+
+   Returns the length of the line, or -1 if WORD is not an encoding that
+   translate_inst() writes or the line does not fit.
+ */
+int disassemble_word(const Disassembler* dis, uint32_t word, uint32_t addr, char* buf,
+    size_t size) {
+    if (size == 0) {
+        return -1;
+    }
+    DecodedInst d;
+    decode_inst(word, &d);
+    const OpInfo* op = d.opcode == 0 ? &FUNCT_TABLE[d.funct] : &OPCODE_TABLE[d.opcode];
+    if (op->format == FORMAT_INVALID) {
+        return -1;
+    }
+
+    LineBuffer line = { buf, buf + size - 1, 0 };
+    put_str(&line, op->name);
+    switch (op->format) {
+        case FORMAT_RTYPE:
+            put_arg(&line, reg_name(d.rd));
+            put_arg(&line, reg_name(d.rs));
+            put_arg(&line, reg_name(d.rt));
+            break;
+        case FORMAT_SHIFT:
+            put_arg(&line, reg_name(d.rd));
+            put_arg(&line, reg_name(d.rt));
+            put_num(&line, d.shamt);
+            break;
+        case FORMAT_JR:
+            put_arg(&line, reg_name(d.rs));
+            break;
+        case FORMAT_MULT_DIV:
+            put_arg(&line, reg_name(d.rs));
+            put_arg(&line, reg_name(d.rt));
+            break;
+        case FORMAT_MFHI_MFLO:
+            put_arg(&line, reg_name(d.rd));
+            break;
+        case FORMAT_SIGNED:
+            put_arg(&line, reg_name(d.rt));
+            put_arg(&line, reg_name(d.rs));
+            put_num(&line, d.imm);
+            break;
+        case FORMAT_UNSIGNED:
+            put_arg(&line, reg_name(d.rt));
+            put_arg(&line, reg_name(d.rs));
+            put_num(&line, (uint16_t) d.imm);
+            break;
+        case FORMAT_LUI:
+            put_arg(&line, reg_name(d.rt));
+            put_num(&line, (uint16_t) d.imm);
+            break;
+        case FORMAT_MEM:
+            put_arg(&line, reg_name(d.rt));
+            put_num(&line, d.imm);
+            put_arg(&line, reg_name(d.rs));
+            break;
+        case FORMAT_BRANCH: {
+            put_arg(&line, reg_name(d.rs));
+            put_arg(&line, reg_name(d.rt));
+            const char* label = label_at(dis, addr + 4 + d.imm * 4);
+            if (label) {
+                put_arg(&line, label);
+            } else {
+                put_num(&line, d.imm);
+            }
+            break;
+        }
+        case FORMAT_JUMP: {
+            /* A zero target is left for the linker; any other was encoded
+               by -base for text loaded at dis->base. */
+            const char* label = addr / 4 < dis->len ? dis->relocs[addr / 4] : NULL;
+            uint32_t target = (((dis->base + addr + 4) & 0xf0000000) | (d.target << 2))
+                - dis->base;
+            if (!label && d.target) {
+                label = label_at(dis, target);
+            }
+            if (label) {
+                put_arg(&line, label);
+            } else {
+                put_num(&line, d.target ? target : 0);
+            }
+            break;
+        }
+        default:
+            return -1;
+    }
+    if (line.full) {
+        return -1;
+    }
+    *line.pos = '\0';
+    return line.pos - buf;
+}
+
+/*******************************
+ * Verification
+ *******************************/
+
+/* Disassembles each of the LEN words in WORDS and assembles the line again
+   with translate_inst(), resolving labels against SYMTBL, and logs an error
+   for each word that does not come back unchanged. Jumps are encoded as
+   resolve_local_jumps() is currently set, so the caller must set it as it
+   was for pass two. Returns the number of words that did not.
+ */
+uint32_t verify_words(const Disassembler* dis, const uint32_t* words, uint32_t len,
+    SymbolTable* symtbl) {
+    FILE* sink = fopen("/dev/null", "w");
+    if (!sink) {
+        write_to_log("Error: unable to open /dev/null\n");
+        return len;
+    }
+    SymbolTable* reltbl = create_table(SYMTBL_NON_UNIQUE);
+    WordBuffer encoded = { NULL, 0, 0 };
+    capture_inst_hex(&encoded);
+
+    uint32_t mismatches = 0;
+    char line[1024];
+    for (uint32_t i = 0; i < len; i++) {
+        uint32_t addr = i * 4;
+        if (disassemble_word(dis, words[i], addr, line, sizeof(line)) < 0) {
+            write_to_log("Error: word %u (%08x) is not an instruction the assembler writes\n",
+                i, words[i]);
+            mismatches++;
+            continue;
+        }
+
+        char text[sizeof(line)];
+        strcpy(text, line);
+        char* args[3];
+        size_t num_args = 0;
+        char* save;
+        char* name = strtok_r(text, " ", &save);
+        char* arg;
+        while (num_args < 3 && (arg = strtok_r(NULL, " ", &save))) {
+            args[num_args++] = arg;
+        }
+
+        encoded.len = 0;
+        if (translate_inst(sink, name, args, num_args, addr, symtbl, reltbl) != 0
+            || encoded.len != 1 || encoded.words[0] != words[i]) {
+            write_to_log("Error: word %u (%08x) disassembles to \"%s\", which %s\n", i,
+                words[i], line, encoded.len == 1 ? "assembles to a different word"
+                : "does not assemble");
+            mismatches++;
+        }
+    }
+
+    capture_inst_hex(NULL);
+    free(encoded.words);
+    free_table(reltbl);
+    fclose(sink);
+    return mismatches;
+}
@@ -0,0 +1,28 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The names a disassembly gives to branch and jump targets, indexed by word.
+   Built once per text by create_disassembler().
+ */
+typedef struct {
+    const char** labels;    // labels[i]: a label at byte offset 4 * i, or NULL
+    const char** relocs;    // relocs[i]: the symbol the jump at 4 * i is relocated against
+    uint32_t len;           // words of text; labels has one more entry for its end
+    uint32_t base;          // load address that -base encoded jumps for
+} Disassembler;
+
+Disassembler* create_disassembler(uint32_t len, SymbolTable* symtbl, SymbolTable* reltbl,
+    uint32_t base);
+
+void free_disassembler(Disassembler* dis);
+
+int disassemble_word(const Disassembler* dis, uint32_t word, uint32_t addr, char* buf,
+    size_t size);
+
+uint32_t verify_words(const Disassembler* dis, const uint32_t* words, uint32_t len,
+    SymbolTable* symtbl);
+
+#endif
@@ -0,0 +1,252 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+
+#include "tables.h"
+#include "symmap.h"
+#include "data.h"
+#include "expr.h"
+
+/* Assemble-time constants and the integer expressions that use them.
+
+   .equ NAME, EXPR and its synonym .set NAME, EXPR enter NAME into a hashed
+   SymbolMap; a later definition replaces an earlier one. An expression is
+   made of numbers, constants and data labels, joined by these operators,
+   from the loosest binding to the tightest:
+
+       |    &    << >>    + -    * /
+
+   with unary - and + and parentheses. Evaluation uses 64-bit arithmetic
+   that wraps, and the user of the value checks its range, just as for a
+   single number. Text labels cannot be used, since the optimizations move
+   them after pass one.
+ */
+
+/*******************************
+ * Constants
+ *******************************/
+
+/* Defines NAME as VALUE in *CONSTANTS, which is created on first use,
+   replacing any earlier value. The value is kept in the entry's 32-bit
+   address with its sign in the owner, so that anything a .word can hold
+   comes back unchanged. Returns 0 on success and -1 if VALUE does not fit in
+   32 bits, signed or unsigned.
+ */
+int define_constant(SymbolMap** constants, const char* name, int64_t value) {
+    if (value < INT32_MIN || value > UINT32_MAX) {
+        return -1;
+    }
+    if (!*constants) {
+        *constants = create_symbol_map(16);
+    }
+    int inserted;
+    MapEntry* entry = insert_symbol(*constants, name, 0, 0, &inserted);
+    if (inserted) {
+        entry->name = strdup(name);
+        if (!entry->name) {
+            allocation_failed();
+        }
+    }
+    entry->addr = (uint32_t) value;
+    entry->owner = value < 0;
+    return 0;
+}
+
+/* Stores the value of the constant NAME in VALUE. Returns 0 on success and
+   -1 if NAME is not defined in CONSTANTS, which may be NULL.
+ */
+int find_constant(const SymbolMap* constants, const char* name, int64_t* value) {
+    const MapEntry* entry = constants ? find_symbol(constants, name) : NULL;
+    if (!entry) {
+        return -1;
+    }
+    *value = entry->owner ? (int64_t) (int32_t) entry->addr : (int64_t) entry->addr;
+    return 0;
+}
+
+void free_constants(SymbolMap* constants) {
+    if (!constants) {
+        return;
+    }
+    for (uint32_t i = 0; i < constants->cap; i++) {
+        free((char*) constants->slots[i].name);
+    }
+    free_symbol_map(constants);
+}
+
+/*******************************
+ * Expressions
+ *******************************/
+
+typedef struct {
+    const char* pos;
+    const SymbolMap* constants;
+    SymbolTable* symtbl;
+    int failed;
+} Parser;
+
+static int64_t parse_or(Parser* p);
+
+static void skip_space(Parser* p) {
+    while (isspace((unsigned char) *p->pos)) {
+        p->pos++;
+    }
+}
+
+/* Skips whitespace, then returns 1 and moves past OP if it comes next. */
+static int accept(Parser* p, const char* op) {
+    skip_space(p);
+    size_t len = strlen(op);
+    if (strncmp(p->pos, op, len) != 0) {
+        return 0;
+    }
+    p->pos += len;
+    return 1;
+}
+
+/* Returns the value of the constant or data label of LEN characters at
+   NAME, failing if it is neither.
+ */
+static int64_t symbol_value(Parser* p, const char* name, size_t len) {
+    char* copy = (char*) malloc(len + 1);
+    if (!copy) {
+        allocation_failed();
+    }
+    memcpy(copy, name, len);
+    copy[len] = '\0';
+    int64_t value;
+    if (find_constant(p->constants, copy, &value) != 0) {
+        value = get_addr_for_symbol(p->symtbl, copy);
+        if (value < DATA_BASE) {
+            p->failed = 1;
+        }
+    }
+    free(copy);
+    return value;
+}
+
+/* A number, a name, or a parenthesized or signed expression. */
+static int64_t parse_primary(Parser* p) {
+    if (accept(p, "(")) {
+        int64_t value = parse_or(p);
+        if (!accept(p, ")")) {
+            p->failed = 1;
+        }
+        return value;
+    }
+    if (accept(p, "-")) {
+        return (int64_t) (0 - (uint64_t) parse_primary(p));
+    }
+    if (accept(p, "+")) {
+        return parse_primary(p);
+    }
+
+    skip_space(p);
+    const char* start = p->pos;
+    if (isdigit((unsigned char) *start)) {
+        char* end;
+        errno = 0;
+        int64_t value = strtoll(start, &end, 0);
+        if (errno == ERANGE || isalnum((unsigned char) *end) || *end == '_') {
+            p->failed = 1;
+        }
+        p->pos = end;
+        return value;
+    }
+    if (isalpha((unsigned char) *start) || *start == '_') {
+        const char* end = start + 1;
+        while (isalnum((unsigned char) *end) || *end == '_') {
+            end++;
+        }
+        p->pos = end;
+        return symbol_value(p, start, end - start);
+    }
+    p->failed = 1;
+    return 0;
+}
+
+static int64_t parse_term(Parser* p) {
+    int64_t value = parse_primary(p);
+    while (!p->failed) {
+        if (accept(p, "*")) {
+            value = (int64_t) ((uint64_t) value * (uint64_t) parse_primary(p));
+        } else if (accept(p, "/")) {
+            int64_t divisor = parse_primary(p);
+            if (divisor == 0 || (divisor == -1 && value == INT64_MIN)) {
+                p->failed = 1;
+            } else {
+                value /= divisor;
+            }
+        } else {
+            break;
+        }
+    }
+    return value;
+}
+
+static int64_t parse_sum(Parser* p) {
+    int64_t value = parse_term(p);
+    while (!p->failed) {
+        if (accept(p, "+")) {
+            value = (int64_t) ((uint64_t) value + (uint64_t) parse_term(p));
+        } else if (accept(p, "-")) {
+            value = (int64_t) ((uint64_t) value - (uint64_t) parse_term(p));
+        } else {
+            break;
+        }
+    }
+    return value;
+}
+
+static int64_t parse_shift(Parser* p) {
+    int64_t value = parse_sum(p);
+    while (!p->failed) {
+        int left = accept(p, "<<");
+        if (!left && !accept(p, ">>")) {
+            break;
+        }
+        int64_t count = parse_sum(p);
+        if (count < 0 || count > 63) {
+            p->failed = 1;
+        } else {
+            value = left ? (int64_t) ((uint64_t) value << count) : value >> count;
+        }
+    }
+    return value;
+}
+
+static int64_t parse_and(Parser* p) {
+    int64_t value = parse_shift(p);
+    while (!p->failed && accept(p, "&")) {
+        value &= parse_shift(p);
+    }
+    return value;
+}
+
+static int64_t parse_or(Parser* p) {
+    int64_t value = parse_and(p);
+    while (!p->failed && accept(p, "|")) {
+        value |= parse_and(p);
+    }
+    return value;
+}
+
+/* Evaluates the expression EXPR, looking names up first in CONSTANTS, which
+   may be NULL, and then among the data labels in SYMTBL, and stores the
+   result in VALUE. Only labels already defined can be used, as pass one has
+   not seen the rest. Returns 0 on success and -1 if EXPR is malformed, uses
+   an unknown name or a text label, or divides by zero.
+ */
+int evaluate_expr(const char* expr, const SymbolMap* constants, SymbolTable* symtbl,
+    int64_t* value) {
+    Parser p = { expr, constants, symtbl, 0 };
+    int64_t result = parse_or(&p);
+    skip_space(&p);
+    if (p.failed || *p.pos != '\0') {
+        return -1;
+    }
+    *value = result;
+    return 0;
+}
@@ -0,0 +1,15 @@
+#ifndef EXPR_H
+#define EXPR_H
+
+#include <stdint.h>
+
+int define_constant(SymbolMap** constants, const char* name, int64_t value);
+
+int find_constant(const SymbolMap* constants, const char* name, int64_t* value);
+
+void free_constants(SymbolMap* constants);
+
+int evaluate_expr(const char* expr, const SymbolMap* constants, SymbolTable* symtbl,
+    int64_t* value);
+
+#endif
@@ -0,0 +1,219 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "translate.h"
+#include "decode.h"
+#include "hazards.h"
+
+/* Static stall estimates for a classic five-stage pipeline (IF ID EX MEM WB)
+   with full forwarding and branches resolved in ID:
+
+   - a load followed by an instruction that uses its result stalls 1 cycle;
+   - a beq or bne stalls 1 cycle for an operand computed by the instruction
+     just before it, and 2 cycles if that instruction is a load;
+   - mfhi and mflo wait until the last mult or div has finished;
+   - every jump, and every branch that is assumed taken, costs 1 cycle to
+     refetch from the target. Backward branches are assumed taken, as they
+     usually close loops, and forward branches are assumed not taken.
+
+   The analysis is local to each basic block, so results produced in one
+   block are assumed to be ready in the next.
+ */
+
+#define NUM_REGS 34
+
+typedef enum {
+    STALL_NONE,
+    STALL_LOAD_USE,
+    STALL_MUL_DIV,
+    STALL_BRANCH
+} StallKind;
+
+typedef struct {
+    uint64_t ready;             // cycle an ordinary consumer can issue
+    uint64_t branch_ready;      // cycle a beq or bne consumer can issue
+    StallKind kind;             // what waiting for this register is charged to
+} RegState;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+static int compare_symbols(const void* a, const void* b) {
+    const Symbol* x = a;
+    const Symbol* y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+/* Marks the first word of every basic block of WORDS in the returned array of
+   LEN + 1 flags: word 0, every word a label refers to, every word after a
+   control transfer and every beq or bne target.
+ */
+static uint8_t* find_leaders(const uint32_t* words, uint32_t len, const Symbol* syms,
+    uint32_t num_syms) {
+    uint8_t* leader = (uint8_t*) calloc(len + 1, sizeof(uint8_t));
+    if (!leader) {
+        allocation_failed();
+    }
+    leader[0] = 1;
+    for (uint32_t s = 0; s < num_syms; s++) {
+        if (syms[s].addr / 4 <= len) {
+            leader[syms[s].addr / 4] = 1;
+        }
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (is_control_word(words[i])) {
+            leader[i + 1] = 1;
+        }
+        if (is_branch_word(words[i])) {
+            int64_t target = (int64_t) i + 1 + (int16_t) (words[i] & 0xffff);
+            if (target >= 0 && target <= len) {
+                leader[target] = 1;
+            }
+        }
+    }
+    return leader;
+}
+
+/* Charges the cost of the word at index I, issued in the pipeline modelled by
+   REGS at *CYCLE, to STATS, and advances *CYCLE past it.
+ */
+static void issue_word(const uint32_t* words, uint32_t i, RegState* regs, uint64_t* cycle,
+    HazardStats* stats) {
+    uint32_t word = words[i];
+    InstEffects effects;
+    if (get_word_effects(word, &effects) != 0) {
+        (*cycle)++;
+        return;
+    }
+
+    /* Wait for the operand that is ready last. */
+    int branch = is_branch_word(word);
+    uint64_t issue = *cycle;
+    StallKind kind = STALL_NONE;
+    for (int r = 0; r < NUM_REGS; r++) {
+        if (!(effects.use & ((uint64_t) 1 << r))) {
+            continue;
+        }
+        uint64_t ready = branch ? regs[r].branch_ready : regs[r].ready;
+        if (ready > issue) {
+            issue = ready;
+            kind = branch && regs[r].kind != STALL_MUL_DIV ? STALL_BRANCH : regs[r].kind;
+        }
+    }
+    uint32_t stall = issue - *cycle;
+    if (kind == STALL_LOAD_USE) {
+        stats->load_use += stall;
+    } else if (kind == STALL_MUL_DIV) {
+        stats->mul_div += stall;
+    } else if (kind == STALL_BRANCH) {
+        stats->branch += stall;
+    }
+
+    uint8_t opcode = word >> 26;
+    uint8_t funct = word & 0x3f;
+    for (int r = 0; r < NUM_REGS; r++) {
+        if (!(effects.def & ((uint64_t) 1 << r))) {
+            continue;
+        }
+        if (r == REG_HI || r == REG_LO) {
+            regs[r].ready = issue + (funct == 0x1a ? DIV_LATENCY : MULT_LATENCY);
+            regs[r].branch_ready = regs[r].ready;
+            regs[r].kind = STALL_MUL_DIV;
+        } else if (effects.reads_mem) {
+            regs[r].ready = issue + 2;
+            regs[r].branch_ready = issue + 3;
+            regs[r].kind = STALL_LOAD_USE;
+        } else {
+            regs[r].ready = issue + 1;
+            regs[r].branch_ready = issue + 2;
+            regs[r].kind = STALL_BRANCH;
+        }
+    }
+    *cycle = issue + 1;
+
+    /* Refetch from the target of a taken branch or jump. */
+    if (opcode == 0x02 || opcode == 0x03 || (opcode == 0 && funct == 0x08)
+        || (branch && (int16_t) (word & 0xffff) < 0)) {
+        stats->branch++;
+        (*cycle)++;
+    }
+}
+
+/*******************************
+ * Analysis
+ *******************************/
+
+/* Estimates the stall cycles of the LEN encoded instructions in WORDS, which
+   start at byte offset 0, on the pipeline described at the top of this file.
+   Labels in SYMTBL split the program into regions, and one entry is returned
+   for each region with at least one instruction, in address order. Labels
+   that share an address are reported under the first of them.
+
+   Stores the number of entries in NUM_STATS. The returned array must be freed
+   by the caller; its labels point into SYMTBL.
+ */
+HazardStats* analyze_hazards(const uint32_t* words, uint32_t len, SymbolTable* symtbl,
+    uint32_t* num_stats) {
+    Symbol* syms = (Symbol*) malloc((symtbl->len + 1) * sizeof(Symbol));
+    HazardStats* stats = (HazardStats*) calloc(symtbl->len + 1, sizeof(HazardStats));
+    if (!syms || !stats) {
+        allocation_failed();
+    }
+    memcpy(syms, symtbl->tbl, symtbl->len * sizeof(Symbol));
+    qsort(syms, symtbl->len, sizeof(Symbol), compare_symbols);
+    uint8_t* leader = find_leaders(words, len, syms, symtbl->len);
+
+    RegState regs[NUM_REGS];
+    uint64_t cycle = 0;
+    uint32_t s = 0;
+    HazardStats* cur = NULL;
+    *num_stats = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        while (s < symtbl->len && syms[s].addr / 4 < i) {
+            s++;
+        }
+        if (s < symtbl->len && syms[s].addr / 4 == i) {
+            cur = &stats[(*num_stats)++];
+            cur->label = syms[s].name;
+            cur->addr = i * 4;
+            while (s < symtbl->len && syms[s].addr / 4 == i) {
+                s++;
+            }
+        } else if (!cur) {
+            cur = &stats[(*num_stats)++];
+        }
+        if (leader[i]) {
+            memset(regs, 0, sizeof(regs));
+            cycle = 0;
+        }
+        cur->words++;
+        issue_word(words, i, regs, &cycle, cur);
+    }
+
+    free(leader);
+    free(syms);
+    return stats;
+}
+
+/* Prints STATS as a table, with a total line, to OUTPUT. */
+void print_hazard_report(const HazardStats* stats, uint32_t num_stats, FILE* output) {
+    HazardStats total = { NULL, 0, 0, 0, 0, 0 };
+    fprintf(output, "Hazard analysis (estimated stall cycles):\n");
+    fprintf(output, "  %-20s %8s %8s %8s %8s %8s\n", "label", "words", "load-use",
+        "mul/div", "branch", "total");
+    for (uint32_t i = 0; i < num_stats; i++) {
+        const HazardStats* st = &stats[i];
+        fprintf(output, "  %-20s %8u %8u %8u %8u %8u\n", st->label ? st->label : "(start)",
+            st->words, st->load_use, st->mul_div, st->branch,
+            st->load_use + st->mul_div + st->branch);
+        total.words += st->words;
+        total.load_use += st->load_use;
+        total.mul_div += st->mul_div;
+        total.branch += st->branch;
+    }
+    fprintf(output, "  %-20s %8u %8u %8u %8u %8u\n", "total", total.words, total.load_use,
+        total.mul_div, total.branch, total.load_use + total.mul_div + total.branch);
+}
@@ -0,0 +1,25 @@
+#ifndef HAZARDS_H
+#define HAZARDS_H
+
+#include <stdint.h>
+
+/* Cycles until the result of a mult or div can be read by mfhi or mflo. */
+#define MULT_LATENCY 12
+#define DIV_LATENCY 35
+
+/* Estimated stall cycles for the code between one label and the next. */
+typedef struct {
+    const char* label;          // NULL for code before the first label
+    uint32_t addr;
+    uint32_t words;
+    uint32_t load_use;          // waiting for lb, lbu or lw
+    uint32_t mul_div;           // waiting for mult or div in mfhi or mflo
+    uint32_t branch;            // taken branches and jumps, and their operands
+} HazardStats;
+
+HazardStats* analyze_hazards(const uint32_t* words, uint32_t len, SymbolTable* symtbl,
+    uint32_t* num_stats);
+
+void print_hazard_report(const HazardStats* stats, uint32_t num_stats, FILE* output);
+
+#endif
@@ -0,0 +1,316 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "symmap.h"
+#include "translate_utils.h"
+#include "translate.h"
+#include "program.h"
+#include "cfg.h"
+#include "layout.h"
+#include "icf.h"
+
+/* Identical code folding. Each function (see find_functions()) is reduced to
+   a list of encoded words in which the targets of beq, bne, j and jal are kept
+   symbolic: a target inside the function is recorded relative to its start, a
+   target elsewhere in the file by its index and an undefined target by name.
+   Functions with the same hash are compared in full, and every function that
+   matches an earlier one is removed, with its labels moved onto the
+   corresponding instructions of the survivor.
+ */
+
+typedef enum {
+    TARGET_NONE,            // not a branch or jump
+    TARGET_LOCAL,           // index relative to the start of the function
+    TARGET_FILE,            // absolute index in the program
+    TARGET_EXTERNAL         // undefined in this file, compared by name
+} TargetKind;
+
+typedef struct {
+    uint32_t word;          // encoding with any branch offset or jump target zeroed
+    TargetKind kind;
+    int64_t target;
+    const char* name;
+} EncodedInst;
+
+typedef struct {
+    uint32_t func;          // index into the function array
+    uint64_t hash;
+} FunctionKey;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Encodes INST through translate_inst(). Returns 0 on success and -1 if the
+   instruction is invalid.
+ */
+static int encode_inst(Instruction* inst, uint32_t* word) {
+    char buf[32];
+    FILE* f = fmemopen(buf, sizeof(buf), "w");
+    if (!f) {
+        return -1;
+    }
+    int err = translate_inst(f, inst->name, inst->args, inst->num_args, 0, NULL, NULL);
+    fclose(f);
+    if (err != 0) {
+        return -1;
+    }
+    *word = (uint32_t) strtoul(buf, NULL, 16);
+    return 0;
+}
+
+/* Encodes the instructions of FUNC into OUT. Returns 0 on success and -1 if
+   the function contains an invalid instruction and so cannot be folded.
+ */
+static int encode_function(Program* prog, SymbolTable* symtbl, const Function* func,
+    EncodedInst* out) {
+    for (uint32_t i = func->start; i < func->end; i++) {
+        Instruction* inst = &prog->insts[i];
+        EncodedInst* enc = &out[i - func->start];
+        const char* label = NULL;
+        enc->kind = TARGET_NONE;
+        enc->target = 0;
+        enc->name = NULL;
+
+        if (is_cond_branch(inst)) {
+            int rs = translate_reg(inst->args[0]);
+            int rt = translate_reg(inst->args[1]);
+            if (rs == -1 || rt == -1) {
+                return -1;
+            }
+            enc->word = ((is_inst(inst, "beq") ? 0x04u : 0x05u) << 26) | (rs << 21) | (rt << 16);
+            label = inst->args[2];
+        } else if ((is_inst(inst, "j") || is_inst(inst, "jal")) && inst->num_args == 1) {
+            enc->word = (is_inst(inst, "j") ? 0x02u : 0x03u) << 26;
+            label = inst->args[0];
+        } else if (encode_inst(inst, &enc->word) != 0) {
+            return -1;
+        }
+
+        if (label) {
+            int64_t target = get_target_index(prog, symtbl, label);
+            if (target == -1) {
+                enc->kind = TARGET_EXTERNAL;
+                enc->name = label;
+            } else if (target >= func->start && target < func->end) {
+                enc->kind = TARGET_LOCAL;
+                enc->target = target - func->start;
+            } else {
+                enc->kind = TARGET_FILE;
+                enc->target = target;
+            }
+        }
+    }
+    return 0;
+}
+
+/* FNV-1a over the encoded words and symbolic targets. */
+static uint64_t hash_function(const EncodedInst* insts, uint32_t len) {
+    uint64_t hash = 14695981039346656037ULL;
+    #define MIX(byte) do { hash ^= (uint8_t) (byte); hash *= 1099511628211ULL; } while (0)
+    for (uint32_t i = 0; i < len; i++) {
+        const EncodedInst* enc = &insts[i];
+        for (int b = 0; b < 32; b += 8) {
+            MIX(enc->word >> b);
+        }
+        MIX(enc->kind);
+        if (enc->kind == TARGET_EXTERNAL) {
+            for (const char* c = enc->name; *c; c++) {
+                MIX(*c);
+            }
+        } else {
+            for (int b = 0; b < 64; b += 8) {
+                MIX(enc->target >> b);
+            }
+        }
+    }
+    #undef MIX
+    return hash;
+}
+
+static int same_encoding(const EncodedInst* a, const EncodedInst* b, uint32_t len) {
+    for (uint32_t i = 0; i < len; i++) {
+        if (a[i].word != b[i].word || a[i].kind != b[i].kind) {
+            return 0;
+        }
+        if (a[i].kind == TARGET_EXTERNAL ? strcmp(a[i].name, b[i].name) != 0
+            : a[i].target != b[i].target) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int compare_keys(const void* a, const void* b) {
+    const FunctionKey* x = a;
+    const FunctionKey* y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return x->func < y->func ? -1 : x->func > y->func;
+}
+
+/*******************************
+ * Folding
+ *******************************/
+
+/* Runs one round of folding. Returns the number of words removed. */
+static uint32_t fold_round(Program* prog, SymbolTable* symtbl, uint32_t* folded) {
+    uint32_t n;
+    Function* funcs = find_functions(prog, symtbl, &n);
+    EncodedInst* enc = (EncodedInst*) malloc((prog->len + 1) * sizeof(EncodedInst));
+    FunctionKey* keys = (FunctionKey*) malloc((n + 1) * sizeof(FunctionKey));
+    int64_t* survivor = (int64_t*) malloc((n + 1) * sizeof(int64_t));
+    if (!enc || !keys || !survivor) {
+        allocation_failed();
+    }
+
+    /* Only called functions that end in j or jr can be folded; anything else
+       depends on what follows it. A function that the one before it falls
+       into is kept as well (see below). */
+    uint32_t num_keys = 0;
+    for (uint32_t f = 0; f < n; f++) {
+        survivor[f] = -1;
+        Function* func = &funcs[f];
+        if (!func->called || func->falls_through) {
+            continue;
+        }
+        if (encode_function(prog, symtbl, func, &enc[func->start]) != 0) {
+            continue;
+        }
+        keys[num_keys].func = f;
+        keys[num_keys].hash = hash_function(&enc[func->start], func->end - func->start);
+        num_keys++;
+    }
+    qsort(keys, num_keys, sizeof(FunctionKey), compare_keys);
+
+    uint32_t removed = 0;
+    for (uint32_t k = 0; k < num_keys; k++) {
+        Function* func = &funcs[keys[k].func];
+        uint32_t len = func->end - func->start;
+        /* Removing it would run the function before it into whatever comes
+           next; it may still be the survivor of a later copy. */
+        if (keys[k].func > 0 && funcs[keys[k].func - 1].falls_through) {
+            continue;
+        }
+        for (uint32_t m = k; m-- > 0 && keys[m].hash == keys[k].hash;) {
+            Function* other = &funcs[keys[m].func];
+            if (survivor[keys[m].func] == -1 && other->end - other->start == len
+                && same_encoding(&enc[func->start], &enc[other->start], len)) {
+                survivor[keys[k].func] = keys[m].func;
+                removed += len;
+                (*folded)++;
+                break;
+            }
+        }
+    }
+
+    if (removed > 0) {
+        /* Point jumps to folded functions at a survivor label, so that the
+           relocation table only names code that still exists. Labels,
+           folded functions and the first label on each instruction are
+           looked up directly, so this is linear in the program. */
+        int64_t* folded_at = (int64_t*) malloc((prog->len + 1) * sizeof(int64_t));
+        const char** first_label = (const char**) calloc(prog->len + 1, sizeof(char*));
+        SymbolMap* labels = create_symbol_map(symtbl->len);
+        if (!folded_at || !first_label) {
+            allocation_failed();
+        }
+        for (uint32_t i = 0; i <= prog->len; i++) {
+            folded_at[i] = -1;
+        }
+        for (uint32_t f = 0; f < n; f++) {
+            if (survivor[f] != -1 && folded_at[funcs[f].start] == -1) {
+                folded_at[funcs[f].start] = survivor[f];
+            }
+        }
+        for (uint32_t i = 0; i < symtbl->len; i++) {
+            int inserted;
+            uint32_t addr = symtbl->tbl[i].addr;
+            insert_symbol(labels, symtbl->tbl[i].name, addr, 0, &inserted);
+            if (addr / 4 <= prog->len && !first_label[addr / 4]) {
+                first_label[addr / 4] = symtbl->tbl[i].name;
+            }
+        }
+
+        for (uint32_t i = 0; i < prog->len; i++) {
+            Instruction* inst = &prog->insts[i];
+            if ((!is_inst(inst, "j") && !is_inst(inst, "jal")) || inst->num_args != 1) {
+                continue;
+            }
+            const MapEntry* entry = find_symbol(labels, inst->args[0]);
+            if (!entry || entry->addr / 4 > prog->len || folded_at[entry->addr / 4] == -1) {
+                continue;
+            }
+            const char* name = first_label[funcs[folded_at[entry->addr / 4]].start];
+            if (name) {
+                const char* op = is_inst(inst, "j") ? "j" : "jal";
+                char* args[] = { (char*) name };
+                free_inst(inst);
+                set_inst(inst, op, args, 1);
+            }
+        }
+        free_symbol_map(labels);
+        free(first_label);
+        free(folded_at);
+
+        uint32_t old_len = prog->len;
+        Program* out = create_program();
+        uint32_t* origin = (uint32_t*) malloc((old_len + 1) * sizeof(uint32_t));
+        if (!origin) {
+            allocation_failed();
+        }
+        for (uint32_t f = 0; f < n; f++) {
+            if (survivor[f] != -1) {
+                continue;
+            }
+            for (uint32_t i = funcs[f].start; i < funcs[f].end; i++) {
+                Instruction* inst = &prog->insts[i];
+                origin[out->len] = i;
+                append_copy(out, inst);
+            }
+        }
+        uint32_t* map = map_from_origins(origin, out->len, old_len);
+        for (uint32_t f = 0; f < n; f++) {
+            if (survivor[f] != -1) {
+                uint32_t base = map[funcs[survivor[f]].start];
+                for (uint32_t i = funcs[f].start; i < funcs[f].end; i++) {
+                    map[i] = base + (i - funcs[f].start);
+                }
+            }
+        }
+        remap_symbols(symtbl, map, old_len);
+        replace_program(prog, out);
+        free(map);
+        free(origin);
+    }
+
+    free(survivor);
+    free(keys);
+    free(enc);
+    free(funcs);
+    return removed;
+}
+
+/* Folds functions of PROG whose bodies are identical into a single copy. The
+   labels of each removed copy are aliased in SYMTBL to the matching
+   instructions of the survivor, and j and jal instructions that named a
+   removed copy are pointed at the survivor so that the relocation table
+   written in pass two does too. Folding repeats until nothing changes, since
+   callers of folded functions may become identical in turn.
+
+   Stores the number of functions removed in FOLDED and returns the number of
+   bytes saved.
+ */
+uint32_t fold_identical_functions(Program* prog, SymbolTable* symtbl, uint32_t* folded) {
+    uint32_t total = 0;
+    uint32_t removed;
+    *folded = 0;
+    do {
+        removed = fold_round(prog, symtbl, folded);
+        total += removed;
+    } while (removed > 0);
+    return total * 4;
+}
@@ -0,0 +1,9 @@
+#ifndef ICF_H
+#define ICF_H
+
+#include <stdint.h>
+
+/* See documentation in icf.c */
+uint32_t fold_identical_functions(Program* prog, SymbolTable* symtbl, uint32_t* folded);
+
+#endif
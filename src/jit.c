@@ -0,0 +1,646 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate.h"
+#include "decode.h"
+#include "vm.h"
+#include "jit.h"
+
+/* A dynamic binary translator from the words written in pass two to x86-64.
+
+   Code is translated one block at a time, starting at the op index where
+   execution is about to continue and ending after the first beq, bne, j, jal
+   or jr, before the first instruction that is not translated (div, invalid
+   words and branches that leave the text), or after JIT_MAX_BLOCK
+   instructions. Translated blocks are cached by op index. Every MIPS
+   register lives in the Vm, which rbx points to; r12 holds the base of data
+   memory, r13 the remaining instruction budget and r14 where to store it on
+   the way out.
+
+   A block exits through a stub that returns the op index to continue at to
+   run_jit(). Exits to a fixed target start with a jmp to the stub itself,
+   and once the target has been translated that jmp is patched to go
+   straight to it, so hot loops run without returning to C. Each block checks
+   the budget on entry. Anything that is not translated, and any load or
+   store that would fault, is handed to the interpreter in vm.c one
+   instruction at a time, so the two always agree.
+
+   Only built for x86-64 Linux. Elsewhere create_jit() returns NULL and
+   callers should use run_vm().
+ */
+
+#if defined(__x86_64__) && defined(__linux__)
+
+#include <sys/mman.h>
+
+#define JIT_CODE_SIZE (16 << 20)
+#define JIT_MAX_BLOCK 64
+#define JIT_BLOCK_RESERVE (JIT_MAX_BLOCK * 160 + 256)
+
+/* The high half of the value returned by translated code says what the low
+   half means.
+ */
+#define EXIT_CONTINUE 0ULL                  // op index to continue at
+#define EXIT_STEP (1ULL << 32)              // op index to interpret one instruction at
+#define EXIT_BUDGET (2ULL << 32)            // op index to interpret the rest of the budget at
+#define EXIT_JR (3ULL << 32)                // address jumped to by jr
+#define EXIT_KIND(value) ((value) & 0xffffffff00000000ULL)
+
+/* Returned in rax and rdx by translated code. */
+typedef struct {
+    uint64_t value;
+    uint64_t aux;           // address of a jmp rel32 to patch, or the index of a jr
+} JitExit;
+
+typedef JitExit (*JitEntry)(Vm* vm, uint8_t* mem, uint64_t* remaining, uint8_t* code);
+
+struct Jit {
+    Vm* vm;
+    uint8_t* code;          // JIT_CODE_SIZE bytes, readable, writable and executable
+    uint32_t used;
+    uint32_t epilogue;      // offset of the code that returns to run_jit()
+    uint32_t first_block;   // offset of the first translated block
+    uint8_t** blocks;       // translated code for each op index, or NULL
+};
+
+/*******************************
+ * Code Emission
+ *******************************/
+
+typedef struct {
+    uint8_t* buf;
+    uint32_t pos;
+} Emitter;
+
+static void emit8(Emitter* e, uint8_t byte) {
+    e->buf[e->pos++] = byte;
+}
+
+static void emit32(Emitter* e, uint32_t value) {
+    memcpy(&e->buf[e->pos], &value, 4);
+    e->pos += 4;
+}
+
+static void emit64(Emitter* e, uint64_t value) {
+    memcpy(&e->buf[e->pos], &value, 8);
+    e->pos += 8;
+}
+
+static void emit_bytes(Emitter* e, const uint8_t* bytes, uint32_t len) {
+    memcpy(&e->buf[e->pos], bytes, len);
+    e->pos += len;
+}
+
+#define EMIT(e, ...) do { static const uint8_t bytes[] = { __VA_ARGS__ }; \
+    emit_bytes(e, bytes, sizeof(bytes)); } while (0)
+
+/* Displacement of register REG, or of HI or LO, from rbx. */
+static uint32_t reg_disp(int reg) {
+    if (reg == REG_HI) {
+        return offsetof(Vm, hi);
+    } else if (reg == REG_LO) {
+        return offsetof(Vm, lo);
+    }
+    return offsetof(Vm, regs) + reg * 4;
+}
+
+/* mov eax, [rbx + REG] */
+static void load_eax(Emitter* e, int reg) {
+    EMIT(e, 0x8b, 0x83);
+    emit32(e, reg_disp(reg));
+}
+
+/* mov ecx, [rbx + REG] */
+static void load_ecx(Emitter* e, int reg) {
+    EMIT(e, 0x8b, 0x8b);
+    emit32(e, reg_disp(reg));
+}
+
+/* mov [rbx + REG], eax, dropped for $0 */
+static void store_eax(Emitter* e, int reg) {
+    if (reg != 0) {
+        EMIT(e, 0x89, 0x83);
+        emit32(e, reg_disp(reg));
+    }
+}
+
+/* jmp to the epilogue at offset TARGET from the start of the emitter buffer. */
+static void jmp_to(Emitter* e, uint32_t target) {
+    emit8(e, 0xe9);
+    emit32(e, target - (e->pos + 4));
+}
+
+/* Emits a jump, patched later with patch_rel32(), and returns the offset of
+   its rel32 field. OPCODE is 0xe9 for jmp or the second byte of a 0x0f jcc.
+ */
+static uint32_t jump_forward(Emitter* e, uint8_t opcode) {
+    if (opcode != 0xe9) {
+        emit8(e, 0x0f);
+    }
+    emit8(e, opcode);
+    emit32(e, 0);
+    return e->pos - 4;
+}
+
+/* Points the rel32 field at offset AT at the current position. */
+static void patch_rel32(Emitter* e, uint32_t at) {
+    uint32_t rel = e->pos - (at + 4);
+    memcpy(&e->buf[at], &rel, 4);
+}
+
+/* Returns VALUE and 0 to run_jit(). */
+static void emit_exit(Emitter* e, Jit* jit, uint64_t value) {
+    EMIT(e, 0x48, 0xb8);            // mov rax, imm64
+    emit64(e, value);
+    EMIT(e, 0x31, 0xd2);            // xor edx, edx
+    jmp_to(e, jit->epilogue);
+}
+
+/* Continues at op index TARGET through a jmp that can be patched to go
+   straight to the translation of TARGET.
+ */
+static void emit_chained_exit(Emitter* e, Jit* jit, uint32_t target) {
+    uint32_t rel = jump_forward(e, 0xe9);
+    patch_rel32(e, rel);
+    EMIT(e, 0xb8);                  // mov eax, imm32
+    emit32(e, target);
+    EMIT(e, 0x48, 0xba);            // mov rdx, imm64
+    emit64(e, (uint64_t) (uintptr_t) (e->buf + rel));
+    jmp_to(e, jit->epilogue);
+}
+
+/* Undoes the budget charged for the instructions of the block that did not
+   run and hands op index INDEX to the interpreter.
+ */
+static void emit_step_exit(Emitter* e, Jit* jit, uint32_t index, uint32_t unrun) {
+    EMIT(e, 0x49, 0x81, 0xc5);      // add r13, imm32
+    emit32(e, unrun);
+    emit_exit(e, jit, EXIT_STEP | index);
+}
+
+/* Emits the trampoline that enters translated code and the epilogue that
+   leaves it, at the start of the buffer.
+ */
+static void emit_trampoline(Jit* jit) {
+    Emitter e = { jit->code, 0 };
+    EMIT(&e, 0x53,                  // push rbx
+        0x41, 0x54,                 // push r12
+        0x41, 0x55,                 // push r13
+        0x41, 0x56,                 // push r14
+        0x41, 0x57,                 // push r15
+        0x48, 0x89, 0xfb,           // mov rbx, rdi
+        0x49, 0x89, 0xf4,           // mov r12, rsi
+        0x49, 0x89, 0xd6,           // mov r14, rdx
+        0x4d, 0x8b, 0x2e,           // mov r13, [r14]
+        0xff, 0xe1);                // jmp rcx
+    jit->epilogue = e.pos;
+    EMIT(&e, 0x4d, 0x89, 0x2e,      // mov [r14], r13
+        0x41, 0x5f,                 // pop r15
+        0x41, 0x5e,                 // pop r14
+        0x41, 0x5d,                 // pop r13
+        0x41, 0x5c,                 // pop r12
+        0x5b,                       // pop rbx
+        0xc3);                      // ret
+    jit->first_block = (e.pos + 15) & ~15u;
+    jit->used = jit->first_block;
+}
+
+/*******************************
+ * Translation
+ *******************************/
+
+typedef enum {
+    KIND_ALU,               // translated inline, falls through
+    KIND_MEM,               // translated inline with a bounds check
+    KIND_CONTROL,           // ends the block
+    KIND_STOP               // not translated, ends the block before it
+} TransKind;
+
+/* Classifies the word at op index I. */
+static TransKind classify(Vm* vm, uint32_t i) {
+    uint32_t word = vm->words[i];
+    DecodedInst d;
+    decode_inst(word, &d);
+    InstEffects effects;
+    if (get_word_effects(word, &effects) != 0 || (d.opcode == 0 && d.funct == 0x1a)) {
+        return KIND_STOP;
+    }
+    if (effects.reads_mem || effects.writes_mem) {
+        return KIND_MEM;
+    }
+    if (is_branch_word(word) || d.opcode == 0x02 || d.opcode == 0x03) {
+        uint32_t addr = vm->base + i * 4;
+        uint32_t target = is_branch_word(word) ? addr + 4 + (d.imm << 2)
+            : ((addr + 4) & 0xf0000000) | (d.target << 2);
+        uint32_t offset = target - vm->base;
+        return offset % 4 == 0 && offset / 4 <= vm->len ? KIND_CONTROL : KIND_STOP;
+    }
+    return is_control_word(word) ? KIND_CONTROL : KIND_ALU;
+}
+
+/* Sets eax to 1 if the last comparison was less than, signed if IS_SIGNED, and
+   to 0 otherwise.
+ */
+static void emit_set(Emitter* e, int is_signed) {
+    EMIT(e, 0x0f);
+    emit8(e, is_signed ? 0x9c : 0x92);          // setl / setb al
+    EMIT(e, 0xc0, 0x0f, 0xb6, 0xc0);            // movzx eax, al
+}
+
+static void emit_alu(Emitter* e, const DecodedInst* d) {
+    if (d->opcode == 0) {
+        static const uint8_t ALU_OPS[64] = {
+            [0x21] = 0x01, [0x22] = 0x29, [0x23] = 0x29, [0x24] = 0x21,
+            [0x25] = 0x09, [0x26] = 0x31, [0x27] = 0x09
+        };
+        if (d->rd == 0 && d->funct != 0x18) {
+            return;
+        }
+        switch (d->funct) {
+            case 0x00: case 0x02: case 0x03:
+                load_eax(e, d->rt);
+                EMIT(e, 0xc1);
+                emit8(e, d->funct == 0x00 ? 0xe0 : d->funct == 0x02 ? 0xe8 : 0xf8);
+                emit8(e, d->shamt);
+                store_eax(e, d->rd);
+                return;
+            case 0x2a: case 0x2b:
+                load_eax(e, d->rs);
+                EMIT(e, 0x3b, 0x83);            // cmp eax, [rbx + rt]
+                emit32(e, reg_disp(d->rt));
+                emit_set(e, d->funct == 0x2a);
+                store_eax(e, d->rd);
+                return;
+            case 0x18:
+                load_eax(e, d->rs);
+                load_ecx(e, d->rt);
+                EMIT(e, 0xf7, 0xe9);            // imul ecx
+                store_eax(e, REG_LO);
+                EMIT(e, 0x89, 0x93);            // mov [rbx + hi], edx
+                emit32(e, reg_disp(REG_HI));
+                return;
+            case 0x10: case 0x12:
+                load_eax(e, d->funct == 0x10 ? REG_HI : REG_LO);
+                store_eax(e, d->rd);
+                return;
+            default:
+                load_eax(e, d->rs);
+                load_ecx(e, d->rt);
+                emit8(e, ALU_OPS[d->funct]);
+                emit8(e, 0xc8);                 // op eax, ecx
+                if (d->funct == 0x27) {
+                    EMIT(e, 0xf7, 0xd0);        // not eax
+                }
+                store_eax(e, d->rd);
+                return;
+        }
+    }
+
+    if (d->rt == 0) {
+        return;
+    }
+    uint32_t imm = (uint32_t) d->imm;
+    switch (d->opcode) {
+        case 0x0f:
+            EMIT(e, 0xc7, 0x83);                // mov dword [rbx + rt], imm32
+            emit32(e, reg_disp(d->rt));
+            emit32(e, imm << 16);
+            return;
+        case 0x0a: case 0x0b:
+            load_eax(e, d->rs);
+            emit8(e, 0x3d);                     // cmp eax, imm32
+            emit32(e, imm);
+            emit_set(e, d->opcode == 0x0a);
+            store_eax(e, d->rt);
+            return;
+        default:
+            load_eax(e, d->rs);
+            if (d->opcode == 0x09) {
+                emit8(e, 0x05);                 // add eax, imm32
+            } else if (d->opcode == 0x0c) {
+                emit8(e, 0x25);                 // and eax, imm32
+                imm &= 0xffff;
+            } else {
+                emit8(e, 0x0d);                 // or eax, imm32
+                imm &= 0xffff;
+            }
+            emit32(e, imm);
+            store_eax(e, d->rt);
+            return;
+    }
+}
+
+/* Emits a load or store that jumps to a stub, which hands the instruction to
+   the interpreter, if the address is out of range or misaligned. The offsets
+   of those jumps are added to FAULT_JUMPS for translate_block() to patch.
+ */
+static void emit_mem(Emitter* e, const DecodedInst* d, uint32_t* fault_jumps, int* num_jumps) {
+    int size = d->opcode == 0x23 || d->opcode == 0x2b ? 4 : 1;
+    load_eax(e, d->rs);
+    emit8(e, 0x05);                             // add eax, imm32
+    emit32(e, (uint32_t) d->imm);
+    EMIT(e, 0x89, 0xc1,                         // mov ecx, eax
+        0x81, 0xe9);                            // sub ecx, imm32
+    emit32(e, VM_MEM_BASE);
+    EMIT(e, 0x81, 0xf9);                        // cmp ecx, imm32
+    emit32(e, VM_MEM_SIZE - size);
+    fault_jumps[(*num_jumps)++] = jump_forward(e, 0x87);        // ja
+    if (size == 4) {
+        EMIT(e, 0xa8, 0x03);                    // test al, 3
+        fault_jumps[(*num_jumps)++] = jump_forward(e, 0x85);    // jnz
+    }
+
+    switch (d->opcode) {
+        case 0x20:
+            EMIT(e, 0x41, 0x0f, 0xbe, 0x04, 0x0c);  // movsx eax, byte [r12 + rcx]
+            store_eax(e, d->rt);
+            break;
+        case 0x24:
+            EMIT(e, 0x41, 0x0f, 0xb6, 0x04, 0x0c);  // movzx eax, byte [r12 + rcx]
+            store_eax(e, d->rt);
+            break;
+        case 0x23:
+            EMIT(e, 0x41, 0x8b, 0x04, 0x0c);        // mov eax, [r12 + rcx]
+            store_eax(e, d->rt);
+            break;
+        case 0x28: case 0x2b:
+            EMIT(e, 0x8b, 0x93);                    // mov edx, [rbx + rt]
+            emit32(e, reg_disp(d->rt));
+            if (size == 4) {
+                EMIT(e, 0x41, 0x89, 0x14, 0x0c);    // mov [r12 + rcx], edx
+            } else {
+                EMIT(e, 0x41, 0x88, 0x14, 0x0c);    // mov [r12 + rcx], dl
+            }
+            break;
+    }
+}
+
+/* Emits the beq, bne, j, jal or jr at op index I, which ends the block. */
+static void emit_control(Emitter* e, Jit* jit, uint32_t i) {
+    Vm* vm = jit->vm;
+    uint32_t word = vm->words[i];
+    uint32_t addr = vm->base + i * 4;
+    DecodedInst d;
+    decode_inst(word, &d);
+
+    if (d.opcode == 0) {
+        load_eax(e, d.rs);                      // jr
+        EMIT(e, 0x48, 0xb9);                    // mov rcx, imm64
+        emit64(e, EXIT_JR);
+        EMIT(e, 0x48, 0x09, 0xc8,               // or rax, rcx
+            0xba);                              // mov edx, imm32
+        emit32(e, i);
+        jmp_to(e, jit->epilogue);
+        return;
+    }
+    if (d.opcode == 0x02 || d.opcode == 0x03) {
+        if (d.opcode == 0x03) {
+            EMIT(e, 0xc7, 0x83);                // mov dword [rbx + $ra], imm32
+            emit32(e, reg_disp(31));
+            emit32(e, addr + 4);
+        }
+        uint32_t target = ((addr + 4) & 0xf0000000) | (d.target << 2);
+        emit_chained_exit(e, jit, (target - vm->base) / 4);
+        return;
+    }
+
+    load_eax(e, d.rs);
+    EMIT(e, 0x3b, 0x83);                        // cmp eax, [rbx + rt]
+    emit32(e, reg_disp(d.rt));
+    uint32_t taken = jump_forward(e, d.opcode == 0x04 ? 0x84 : 0x85);   // je / jne
+    emit_chained_exit(e, jit, i + 1);
+    patch_rel32(e, taken);
+    emit_chained_exit(e, jit, (addr + 4 + (d.imm << 2) - vm->base) / 4);
+}
+
+/* Translates the block starting at op index START into the code buffer and
+   returns its address, or NULL if the instruction at START is not
+   translated.
+ */
+static uint8_t* translate_block(Jit* jit, uint32_t start) {
+    Vm* vm = jit->vm;
+    uint32_t n = 0;
+    TransKind last = KIND_ALU;
+    while (n < JIT_MAX_BLOCK && start + n < vm->len) {
+        last = classify(vm, start + n);
+        if (last == KIND_STOP) {
+            break;
+        }
+        n++;
+        if (last == KIND_CONTROL) {
+            break;
+        }
+    }
+    if (n == 0) {
+        return NULL;
+    }
+
+    Emitter e = { jit->code, jit->used };
+    uint8_t* entry = e.buf + e.pos;
+    EMIT(&e, 0x49, 0x81, 0xfd);                 // cmp r13, imm32
+    emit32(&e, n);
+    uint32_t short_budget = jump_forward(&e, 0x82);     // jb
+    EMIT(&e, 0x49, 0x81, 0xed);                 // sub r13, imm32
+    emit32(&e, n);
+
+    /* Out-of-line stubs for loads and stores that fault, emitted after the
+       block so that the common path falls straight through. */
+    uint32_t fault_jumps[2];
+    uint32_t stub_jumps[JIT_MAX_BLOCK * 2];
+    uint32_t stub_index[JIT_MAX_BLOCK * 2];
+    int num_stubs = 0;
+
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t i = start + k;
+        DecodedInst d;
+        decode_inst(vm->words[i], &d);
+        TransKind kind = classify(vm, i);
+        if (kind == KIND_ALU) {
+            emit_alu(&e, &d);
+        } else if (kind == KIND_MEM) {
+            int num_jumps = 0;
+            emit_mem(&e, &d, fault_jumps, &num_jumps);
+            for (int j = 0; j < num_jumps; j++) {
+                stub_jumps[num_stubs] = fault_jumps[j];
+                stub_index[num_stubs++] = k;
+            }
+        } else {
+            emit_control(&e, jit, i);
+        }
+    }
+    if (last != KIND_CONTROL) {
+        emit_chained_exit(&e, jit, start + n);
+    }
+
+    patch_rel32(&e, short_budget);
+    emit_exit(&e, jit, EXIT_BUDGET | start);
+    for (int s = 0; s < num_stubs; s++) {
+        patch_rel32(&e, stub_jumps[s]);
+        emit_step_exit(&e, jit, start + stub_index[s], n - stub_index[s]);
+    }
+
+    jit->used = (e.pos + 15) & ~15u;
+    jit->blocks[start] = entry;
+    return entry;
+}
+
+/* Throws away every translation. */
+static void flush_code(Jit* jit) {
+    memset(jit->blocks, 0, (jit->vm->len + 1) * sizeof(uint8_t*));
+    jit->used = jit->first_block;
+}
+
+/*******************************
+ * Execution
+ *******************************/
+
+/* Prepares to run VM with translated code. Returns NULL if this platform is
+   not supported or executable memory cannot be had, in which case the
+   caller should use run_vm().
+ */
+Jit* create_jit(Vm* vm) {
+    Jit* jit = (Jit*) calloc(1, sizeof(Jit));
+    if (!jit) {
+        allocation_failed();
+    }
+    jit->code = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (jit->code == MAP_FAILED) {
+        free(jit);
+        return NULL;
+    }
+    jit->blocks = (uint8_t**) calloc(vm->len + 1, sizeof(uint8_t*));
+    if (!jit->blocks) {
+        allocation_failed();
+    }
+    jit->vm = vm;
+    emit_trampoline(jit);
+    return jit;
+}
+
+void free_jit(Jit* jit) {
+    if (!jit) {
+        return;
+    }
+    munmap(jit->code, JIT_CODE_SIZE);
+    free(jit->blocks);
+    free(jit);
+}
+
+/* Runs the VM that JIT was created for, with the same contract as run_vm():
+   the VM stops when it halts, faults or has executed BUDGET more
+   instructions (no limit if BUDGET is 0), and its state afterwards is what
+   run_vm() would have left.
+ */
+VmStatus run_jit(Jit* jit, uint64_t budget) {
+    Vm* vm = jit->vm;
+    JitEntry enter = (JitEntry) (void*) jit->code;
+    uint64_t remaining = budget ? budget : UINT64_MAX;
+    uint8_t* patch = NULL;
+    uint32_t offset = vm->pc - vm->base;
+    uint32_t index = offset % 4 == 0 && offset / 4 <= vm->len ? offset / 4 : vm->len + 1;
+
+    while (1) {
+        if (index == vm->len) {
+            vm->pc = vm->base + vm->len * 4;
+            return VM_HALTED;
+        }
+        if (remaining == 0) {
+            vm->pc = vm->base + index * 4;
+            return VM_OUT_OF_BUDGET;
+        }
+
+        uint8_t* code = index < vm->len ? jit->blocks[index] : NULL;
+        if (!code && index < vm->len) {
+            if (jit->used + JIT_BLOCK_RESERVE > JIT_CODE_SIZE) {
+                flush_code(jit);
+                patch = NULL;
+            }
+            code = translate_block(jit, index);
+        }
+        if (patch && code) {
+            int32_t rel = (int32_t) (code - (patch + 4));
+            memcpy(patch, &rel, 4);
+        }
+        patch = NULL;
+
+        if (!code) {
+            /* Not translated: let the interpreter run it. */
+            vm->pc = vm->base + index * 4;
+            uint64_t before = vm->executed;
+            VmStatus status = run_vm(vm, 1);
+            remaining -= vm->executed - before;
+            if (status != VM_OUT_OF_BUDGET) {
+                return status;
+            }
+            offset = vm->pc - vm->base;
+            index = offset / 4;
+            continue;
+        }
+
+        uint64_t before = remaining;
+        JitExit exit = enter(vm, vm->mem, &remaining, code);
+        vm->executed += before - remaining;
+        uint32_t low = (uint32_t) exit.value;
+
+        switch (EXIT_KIND(exit.value)) {
+            case EXIT_CONTINUE:
+                index = low;
+                patch = (uint8_t*) (uintptr_t) exit.aux;
+                break;
+            case EXIT_JR:
+                offset = low - vm->base;
+                if (low == VM_HALT_ADDR) {
+                    index = vm->len;
+                } else if (offset % 4 != 0 || offset / 4 > vm->len) {
+                    vm->pc = vm->base + (uint32_t) exit.aux * 4;
+                    vm->fault = "branch or jump outside the text";
+                    return VM_FAULT;
+                } else {
+                    index = offset / 4;
+                }
+                break;
+            case EXIT_STEP: {
+                vm->pc = vm->base + low * 4;
+                uint64_t before_step = vm->executed;
+                VmStatus status = run_vm(vm, 1);
+                remaining -= vm->executed - before_step;
+                if (status != VM_OUT_OF_BUDGET) {
+                    return status;
+                }
+                index = (vm->pc - vm->base) / 4;
+                break;
+            }
+            default: {
+                /* Fewer instructions are left than the block has. */
+                vm->pc = vm->base + low * 4;
+                if (remaining == 0) {
+                    return VM_OUT_OF_BUDGET;
+                }
+                uint64_t before_rest = vm->executed;
+                VmStatus status = run_vm(vm, remaining);
+                remaining -= vm->executed - before_rest;
+                return status;
+            }
+        }
+    }
+}
+
+#else
+
+Jit* create_jit(Vm* vm) {
+    return NULL;
+}
+
+void free_jit(Jit* jit) {
+}
+
+VmStatus run_jit(Jit* jit, uint64_t budget) {
+    return VM_FAULT;
+}
+
+#endif
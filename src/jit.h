@@ -0,0 +1,14 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stdint.h>
+
+typedef struct Jit Jit;
+
+Jit* create_jit(Vm* vm);
+
+void free_jit(Jit* jit);
+
+VmStatus run_jit(Jit* jit, uint64_t budget);
+
+#endif
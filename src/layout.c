@@ -0,0 +1,482 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "tables.h"
+#include "utils.h"
+#include "translate_utils.h"
+#include "program.h"
+#include "cfg.h"
+#include "layout.h"
+
+#define LINE_SIZE 1024
+
+static const char* IGNORE_CHARS = " \f\n\r\t\v,";
+
+/* A weighted edge of the call graph, between two functions. */
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+    uint64_t weight;
+} CallEdge;
+
+typedef struct {
+    CallEdge* edges;
+    uint32_t len;
+    uint32_t cap;
+} CallGraph;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Returns 1 if control never continues past INST to the next instruction. */
+static int is_unconditional(const Instruction* inst) {
+    return is_inst(inst, "j") || is_inst(inst, "jr");
+}
+
+static void add_edge(CallGraph* graph, uint32_t from, uint32_t to, uint64_t weight) {
+    if (from == to || weight == 0) {
+        return;
+    }
+    if (graph->len == graph->cap) {
+        graph->cap = graph->cap ? graph->cap * 2 : 16;
+        graph->edges = realloc(graph->edges, graph->cap * sizeof(CallEdge));
+        if (!graph->edges) {
+            allocation_failed();
+        }
+    }
+    CallEdge* edge = &graph->edges[graph->len++];
+    edge->from = from < to ? from : to;
+    edge->to = from < to ? to : from;
+    edge->weight = weight;
+}
+
+static int compare_endpoints(const void* a, const void* b) {
+    const CallEdge* x = a;
+    const CallEdge* y = b;
+    if (x->from != y->from) {
+        return x->from < y->from ? -1 : 1;
+    }
+    if (x->to != y->to) {
+        return x->to < y->to ? -1 : 1;
+    }
+    return 0;
+}
+
+/* Sorts heaviest first, breaking ties by position so the result is stable. */
+static int compare_weight(const void* a, const void* b) {
+    const CallEdge* x = a;
+    const CallEdge* y = b;
+    if (x->weight != y->weight) {
+        return x->weight > y->weight ? -1 : 1;
+    }
+    return compare_endpoints(a, b);
+}
+
+/* Merges parallel edges, so that the call graph is undirected with one edge
+   per pair of functions, and sorts the result heaviest first.
+ */
+static void combine_edges(CallGraph* graph) {
+    if (graph->len == 0) {
+        return;
+    }
+    qsort(graph->edges, graph->len, sizeof(CallEdge), compare_endpoints);
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < graph->len; i++) {
+        if (n > 0 && compare_endpoints(&graph->edges[n - 1], &graph->edges[i]) == 0) {
+            graph->edges[n - 1].weight += graph->edges[i].weight;
+        } else {
+            graph->edges[n++] = graph->edges[i];
+        }
+    }
+    graph->len = n;
+    qsort(graph->edges, graph->len, sizeof(CallEdge), compare_weight);
+}
+
+/* Returns the function containing the instruction LABEL refers to, or -1. */
+static int64_t function_of_label(Program* prog, SymbolTable* symtbl, const uint32_t* func_of,
+    const char* label) {
+    int64_t index = get_target_index(prog, symtbl, label);
+    if (index == -1 || index >= prog->len) {
+        return -1;
+    }
+    return func_of[index];
+}
+
+/* Reads call counts from PROFILE_NAME into GRAPH. Each line holds a caller
+   label, a callee label and the number of calls between them; '#' starts a
+   comment. Labels that are not defined in this file are ignored. Returns 0 on
+   success and -1 if the file cannot be read or a line is malformed.
+ */
+static int read_profile(const char* profile_name, Program* prog, SymbolTable* symtbl,
+    const uint32_t* func_of, CallGraph* graph) {
+    FILE* f = fopen(profile_name, "r");
+    if (!f) {
+        write_to_log("Error: unable to open call profile: %s\n", profile_name);
+        return -1;
+    }
+    char buf[LINE_SIZE];
+    uint32_t line = 0;
+    int ret_code = 0;
+    while (fgets(buf, LINE_SIZE, f)) {
+        line++;
+        char* comment = strchr(buf, '#');
+        if (comment) {
+            *comment = '\0';
+        }
+        char* caller = strtok(buf, IGNORE_CHARS);
+        if (!caller) {
+            continue;
+        }
+        char* callee = strtok(NULL, IGNORE_CHARS);
+        char* count_str = strtok(NULL, IGNORE_CHARS);
+        long int count;
+        if (!callee || !count_str || strtok(NULL, IGNORE_CHARS)
+            || translate_num(&count, count_str, 0, LONG_MAX) == -1) {
+            write_to_log("Error - invalid call profile entry at line %u\n", line);
+            ret_code = -1;
+            continue;
+        }
+        int64_t from = function_of_label(prog, symtbl, func_of, caller);
+        int64_t to = function_of_label(prog, symtbl, func_of, callee);
+        if (from != -1 && to != -1) {
+            add_edge(graph, from, to, count);
+        }
+    }
+    fclose(f);
+    return ret_code;
+}
+
+static uint64_t weighted_distance(CallGraph* graph, const uint32_t* position) {
+    uint64_t total = 0;
+    for (uint32_t i = 0; i < graph->len; i++) {
+        CallEdge* edge = &graph->edges[i];
+        uint32_t a = position[edge->from];
+        uint32_t b = position[edge->to];
+        total += edge->weight * (a > b ? a - b : b - a);
+    }
+    return total;
+}
+
+/*******************************
+ * Functions
+ *******************************/
+
+/* Splits PROG into functions, each starting at a jal target (or at the start
+   of the program) and running up to the next one. Stores the number of
+   functions in NUM_FUNCS and returns them in order; the caller must free the
+   array.
+ */
+Function* find_functions(Program* prog, SymbolTable* symtbl, uint32_t* num_funcs) {
+    uint8_t* called = (uint8_t*) calloc(prog->len + 1, sizeof(uint8_t));
+    Function* funcs = (Function*) malloc((prog->len + 1) * sizeof(Function));
+    if (!called || !funcs) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        if (is_inst(inst, "jal") && inst->num_args == 1) {
+            int64_t target = get_target_index(prog, symtbl, inst->args[0]);
+            if (target != -1 && target < prog->len) {
+                called[target] = 1;
+            }
+        }
+    }
+
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < prog->len; i++) {
+        if (i == 0 || called[i]) {
+            funcs[n].start = i;
+            funcs[n].called = called[i];
+            n++;
+        }
+        funcs[n - 1].end = i + 1;
+    }
+    for (uint32_t f = 0; f < n; f++) {
+        funcs[f].falls_through = !is_unconditional(&prog->insts[funcs[f].end - 1]);
+    }
+    free(called);
+    *num_funcs = n;
+    return funcs;
+}
+
+/*******************************
+ * Function Reordering
+ *******************************/
+
+/* Reorders the functions of PROG so that functions which call each other
+   often end up next to each other, following Pettis and Hansen: starting with
+   every function in a chain of its own, the edges of the call graph are
+   visited heaviest first and the chains at either end are concatenated in
+   whichever order brings the two functions closer together.
+
+   Call graph edges are weighted by the number of jal sites between two
+   functions, or by the call counts in PROFILE_NAME when it is not NULL.
+
+   A function that falls through into the next one is kept in front of it,
+   the chain holding the start of the program stays first and a function that
+   runs off the end of the program stays last. If the new layout would put a
+   beq or bne out of range of its target, the program is left unchanged.
+   Labels in SYMTBL are moved with their code so that pass two assigns the new
+   addresses and encodes branches against them.
+
+   Returns 0 on success (filling in STATS) and -1 if the profile could not be
+   read, in which case nothing is changed.
+ */
+int reorder_functions(Program* prog, SymbolTable* symtbl, const char* profile_name,
+    LayoutStats* stats) {
+    memset(stats, 0, sizeof(LayoutStats));
+    if (prog->len == 0) {
+        return 0;
+    }
+    uint32_t n;
+    Function* funcs = find_functions(prog, symtbl, &n);
+    uint32_t* func_of = (uint32_t*) malloc(prog->len * sizeof(uint32_t));
+    if (!func_of) {
+        allocation_failed();
+    }
+    for (uint32_t f = 0; f < n; f++) {
+        for (uint32_t i = funcs[f].start; i < funcs[f].end; i++) {
+            func_of[i] = f;
+        }
+    }
+
+    CallGraph graph = { NULL, 0, 0 };
+    int ret_code = 0;
+    if (profile_name) {
+        ret_code = read_profile(profile_name, prog, symtbl, func_of, &graph);
+    } else {
+        for (uint32_t i = 0; i < prog->len; i++) {
+            Instruction* inst = &prog->insts[i];
+            if (is_inst(inst, "jal") && inst->num_args == 1) {
+                int64_t to = function_of_label(prog, symtbl, func_of, inst->args[0]);
+                if (to != -1) {
+                    add_edge(&graph, func_of[i], to, 1);
+                }
+            }
+        }
+    }
+    if (ret_code != 0) {
+        free(graph.edges);
+        free(func_of);
+        free(funcs);
+        return -1;
+    }
+    combine_edges(&graph);
+
+    /* Chains are linked lists of functions; chain[f] names the chain by its
+       head, and only heads and tails have meaningful entries in TAIL/WORDS. */
+    uint32_t* chain = (uint32_t*) malloc(n * sizeof(uint32_t));
+    uint32_t* next = (uint32_t*) malloc(n * sizeof(uint32_t));
+    uint32_t* tail = (uint32_t*) malloc(n * sizeof(uint32_t));
+    uint32_t* words = (uint32_t*) malloc(n * sizeof(uint32_t));
+    uint64_t* heat = (uint64_t*) calloc(n, sizeof(uint64_t));
+    uint32_t* position = (uint32_t*) calloc(n, sizeof(uint32_t));
+    if (!chain || !next || !tail || !words || !heat || !position) {
+        allocation_failed();
+    }
+    for (uint32_t f = 0; f < n; f++) {
+        chain[f] = f;
+        next[f] = NO_ORIGIN;
+        tail[f] = f;
+        words[f] = funcs[f].end - funcs[f].start;
+        position[f] = funcs[f].start;
+    }
+    stats->distance_before = weighted_distance(&graph, position);
+
+    /* Concatenates chain B onto the end of chain A. */
+    #define JOIN(a, b) do {                                         \
+        next[tail[a]] = b;                                          \
+        tail[a] = tail[b];                                          \
+        words[a] += words[b];                                       \
+        heat[a] += heat[b];                                         \
+        for (uint32_t m = b; m != NO_ORIGIN; m = next[m]) {         \
+            chain[m] = a;                                           \
+        }                                                           \
+    } while (0)
+
+    for (uint32_t f = n - 1; f-- > 0;) {
+        if (funcs[f].falls_through) {
+            JOIN(chain[f], chain[f + 1]);
+        }
+    }
+    uint32_t first = chain[0];
+    uint32_t last = funcs[n - 1].falls_through ? chain[n - 1] : NO_ORIGIN;
+
+    for (uint32_t e = 0; e < graph.len; e++) {
+        CallEdge* edge = &graph.edges[e];
+        uint32_t a = chain[edge->from];
+        uint32_t b = chain[edge->to];
+        heat[a] += edge->weight;
+        if (a == b) {
+            continue;
+        }
+        heat[b] += edge->weight;
+
+        /* Distance in words from the start of each chain to each function. */
+        uint32_t offset_from = 0, offset_to = 0;
+        for (uint32_t m = a; m != edge->from; m = next[m]) {
+            offset_from += funcs[m].end - funcs[m].start;
+        }
+        for (uint32_t m = b; m != edge->to; m = next[m]) {
+            offset_to += funcs[m].end - funcs[m].start;
+        }
+        int ab_ok = b != first && a != last;
+        int ba_ok = a != first && b != last;
+        uint32_t ab = words[a] - offset_from + offset_to;
+        uint32_t ba = words[b] - offset_to + offset_from;
+        if (ab_ok && (!ba_ok || ab <= ba)) {
+            JOIN(a, b);
+            last = b == last ? a : last;
+        } else if (ba_ok) {
+            JOIN(b, a);
+            last = a == last ? b : last;
+        }
+    }
+    #undef JOIN
+
+    /* Lay out the first chain, then the rest hottest first, then the last. */
+    uint32_t* order = (uint32_t*) malloc(n * sizeof(uint32_t));
+    if (!order) {
+        allocation_failed();
+    }
+    uint32_t num_chains = 0;
+    for (uint32_t f = 0; f < n; f++) {
+        if (chain[f] == f && f != first && f != last) {
+            uint32_t c = num_chains++;
+            while (c > 0 && heat[order[c - 1]] < heat[f]) {
+                order[c] = order[c - 1];
+                c--;
+            }
+            order[c] = f;
+        }
+    }
+
+    Program* out = create_program();
+    uint32_t* map = (uint32_t*) malloc((prog->len + 1) * sizeof(uint32_t));
+    if (!map) {
+        allocation_failed();
+    }
+    for (uint32_t k = 0; k < num_chains + 2; k++) {
+        uint32_t c = k == 0 ? first : k <= num_chains ? order[k - 1] : last;
+        if (c == NO_ORIGIN || (k > 0 && c == first)) {
+            continue;
+        }
+        for (uint32_t f = c; f != NO_ORIGIN; f = next[f]) {
+            if (out->len != funcs[f].start) {
+                stats->moved++;
+            }
+            position[f] = out->len;
+            for (uint32_t i = funcs[f].start; i < funcs[f].end; i++) {
+                Instruction* inst = &prog->insts[i];
+                map[i] = out->len;
+                append_copy(out, inst);
+            }
+        }
+    }
+    map[prog->len] = out->len;
+
+    if (branches_in_range(prog, symtbl, map)) {
+        stats->distance_after = weighted_distance(&graph, position);
+        remap_symbols(symtbl, map, prog->len);
+        replace_program(prog, out);
+    } else {
+        write_to_log("Warning: function reordering would put a branch out of range; "
+            "keeping the original layout\n");
+        stats->moved = 0;
+        stats->distance_after = stats->distance_before;
+        free_program(out);
+    }
+
+    free(map);
+    free(order);
+    free(position);
+    free(heat);
+    free(words);
+    free(tail);
+    free(next);
+    free(chain);
+    free(graph.edges);
+    free(func_of);
+    free(funcs);
+    return 0;
+}
+
+/*******************************
+ * Loop Alignment
+ *******************************/
+
+/* Pads PROG with nops (sll $0 $0 0) so that every loop head starts on an
+   ALIGNMENT-byte boundary, where a loop head is an instruction that a beq or
+   bne at the same or a later index branches back to. The padding goes in
+   front of the loop head, so it is executed once on entry to the loop rather
+   than on every iteration. Labels in SYMTBL are moved past the padding.
+   ALIGNMENT must be a power of two no smaller than 4, and offsets are relative
+   to the start of the text section.
+
+   Stores the number of loop heads in LOOPS and returns the number of bytes of
+   padding inserted. If the padding would put a branch out of range, PROG is
+   left unchanged and 0 is returned.
+ */
+uint32_t align_loops(Program* prog, SymbolTable* symtbl, uint32_t alignment, uint32_t* loops) {
+    uint8_t* is_head = (uint8_t*) calloc(prog->len + 1, sizeof(uint8_t));
+    if (!is_head) {
+        allocation_failed();
+    }
+    *loops = 0;
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        if (is_cond_branch(inst)) {
+            int64_t target = get_target_index(prog, symtbl, inst->args[2]);
+            if (target != -1 && target <= i && !is_head[target]) {
+                is_head[target] = 1;
+                (*loops)++;
+            }
+        }
+    }
+
+    char* nop_args[] = { "$0", "$0", "0" };
+    uint32_t words = alignment / 4;
+    Program* out = create_program();
+    uint32_t* origin = (uint32_t*) malloc((prog->len + 1) * sizeof(uint32_t));
+    uint32_t origin_cap = prog->len + 1;
+    if (!origin) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < prog->len; i++) {
+        uint32_t pad = is_head[i] ? (words - out->len % words) % words : 0;
+        if (out->len + pad + 1 > origin_cap) {
+            origin_cap = (out->len + pad + 1) * 2;
+            origin = realloc(origin, origin_cap * sizeof(uint32_t));
+            if (!origin) {
+                allocation_failed();
+            }
+        }
+        for (uint32_t p = 0; p < pad; p++) {
+            origin[out->len] = NO_ORIGIN;
+            append_inst(out, "sll", nop_args, 3);
+        }
+        Instruction* inst = &prog->insts[i];
+        origin[out->len] = i;
+        append_copy(out, inst);
+    }
+
+    uint32_t old_len = prog->len;
+    uint32_t padding = (out->len - old_len) * 4;
+    uint32_t* map = map_from_origins(origin, out->len, old_len);
+    if (branches_in_range(prog, symtbl, map)) {
+        remap_symbols(symtbl, map, old_len);
+        replace_program(prog, out);
+    } else {
+        write_to_log("Warning: loop alignment would put a branch out of range; "
+            "leaving loops unaligned\n");
+        free_program(out);
+        padding = 0;
+    }
+    free(map);
+    free(origin);
+    free(is_head);
+    return padding;
+}
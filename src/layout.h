@@ -0,0 +1,29 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdint.h>
+
+/* A contiguous range of instructions starting at a jal target, or at the
+   start of the program, and ending where the next one begins.
+ */
+typedef struct {
+    uint32_t start;             // index of the first instruction
+    uint32_t end;               // one past the index of the last instruction
+    int called;                 // the first instruction is the target of a jal
+    int falls_through;          // control can run off the end into the next one
+} Function;
+
+typedef struct {
+    uint32_t moved;             // functions placed somewhere else
+    uint64_t distance_before;   // call-weighted distance between functions
+    uint64_t distance_after;
+} LayoutStats;
+
+Function* find_functions(Program* prog, SymbolTable* symtbl, uint32_t* num_funcs);
+
+int reorder_functions(Program* prog, SymbolTable* symtbl, const char* profile_name,
+    LayoutStats* stats);
+
+uint32_t align_loops(Program* prog, SymbolTable* symtbl, uint32_t alignment, uint32_t* loops);
+
+#endif
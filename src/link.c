@@ -0,0 +1,619 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate_utils.h"
+#include "translate.h"
+#include "decode.h"
+#include "symmap.h"
+#include "link.h"
+#include "archive.h"
+#include "binary.h"
+#include "reader.h"
+
+/* A linker for the object files written by pass two. An object assembled
+   with -base is laid out at the address it records, since its local jumps
+   were encoded for it, and the .text sections of the others are laid out
+   one after another in the order given. Every .symbol entry is
+   entered into one global SymbolMap at its linked address, and then each
+   .relocation entry is resolved and the 26-bit target of the j or jal it
+   names is filled in. A relocation is resolved against the labels of its
+   own object first and against the map only if it names none of them, so
+   that two objects may each have a label of the same name; such a name is
+   an error only when another object refers to it. The result is written in
+   the same format, with an empty .relocation section, and with a .base
+   section if its text does not start at 0.
+
+   Once the map is built it is only read, and each object's relocations only
+   touch that object's own slice of the linked text, so the patching is
+   spread over a pool of threads that claim whole objects from a shared
+   counter, without locks.
+ */
+
+/* The most bytes of linked text, from the lowest object to the end of the
+   highest, which is the region a j or jal can reach.
+ */
+#define MAX_LINKED_BYTES 0x10000000
+
+/* Work shared by the patching threads. */
+typedef struct {
+    const ObjectFile* objs;
+    uint32_t num_objects;
+    const SymbolMap* map;
+    const SymbolMap* duplicates;
+    uint32_t* text;
+    uint32_t start;         // address of the first word of TEXT
+    uint32_t next;          // first object not yet claimed
+    uint32_t* errors;       // relocations each object failed to apply
+} PatchJob;
+
+/*******************************
+ * Object Files
+ *******************************/
+
+static void init_object(ObjectFile* obj, const char* name) {
+    obj->name = name;
+    obj->words = NULL;
+    obj->len = 0;
+    obj->symtbl = create_table(SYMTBL_NON_UNIQUE);
+    obj->reltbl = create_table(SYMTBL_NON_UNIQUE);
+    obj->base = 0;
+    obj->has_base = 0;
+}
+
+/* Orders binary symbols by address. Names are pooled in name order, so
+   comparing their offsets breaks ties by name.
+ */
+static int compare_binary_symbols(const void* a, const void* b) {
+    const BinarySymbol* x = (const BinarySymbol*) a;
+    const BinarySymbol* y = (const BinarySymbol*) b;
+    if (x->addr != y->addr) {
+        return x->addr < y->addr ? -1 : 1;
+    }
+    return x->name < y->name ? -1 : x->name > y->name;
+}
+
+/* Fills OBJ from the binary object file NAME, copying the text and relocations
+   straight from the mapped records. The symbols are put back in address order,
+   as a text object lists them. Returns 0 on success and -1 otherwise.
+ */
+static int load_binary_object(const char* name, ObjectFile* obj) {
+    init_object(obj, name);
+    BinaryObject* bin = map_binary_object(name);
+    if (!bin) {
+        return -1;
+    }
+    const BinaryHeader* h = bin->header;
+    obj->len = h->num_words;
+    obj->words = (uint32_t*) malloc((obj->len + 1) * sizeof(uint32_t));
+    if (!obj->words) {
+        allocation_failed();
+    }
+    memcpy(obj->words, bin->words, obj->len * sizeof(uint32_t));
+    obj->has_base = h->has_base;
+    obj->base = h->base;
+    BinarySymbol* symbols = (BinarySymbol*) malloc((h->num_symbols + 1) * sizeof(BinarySymbol));
+    if (!symbols) {
+        allocation_failed();
+    }
+    memcpy(symbols, bin->symbols, h->num_symbols * sizeof(BinarySymbol));
+    qsort(symbols, h->num_symbols, sizeof(BinarySymbol), compare_binary_symbols);
+    int err = 0;
+    for (uint32_t i = 0; i < h->num_symbols && !err; i++) {
+        err = add_to_table(obj->symtbl, bin->strings + symbols[i].name, symbols[i].addr) != 0;
+    }
+    free(symbols);
+    for (uint32_t i = 0; i < h->num_relocs && !err; i++) {
+        err = add_to_table(obj->reltbl, bin->strings + bin->relocs[i].name,
+            bin->relocs[i].addr) != 0;
+    }
+    unmap_binary_object(bin);
+    return err ? -1 : 0;
+}
+
+/* Moves the text of TEXT, parsed from the object NAME, into OBJ and copies
+   its entries and any -base address into OBJ's tables. Returns 0 on success
+   and -1, after logging an error for each, if any name is not a valid label
+   or TEXT has data.
+ */
+static int take_text_object(TextObject* text, ObjectFile* obj) {
+    obj->words = text->words;
+    obj->len = text->num_words;
+    text->words = NULL;
+    int err = 0;
+    if (text->num_data_words > 0) {
+        /* Data labels are absolute and la leaves no relocations to move
+           them by, so data from two objects could not both be placed. */
+        write_to_log("Error: %s has a .data section, which cannot be linked\n", obj->name);
+        err = 1;
+    }
+    obj->has_base = text->has_base;
+    obj->base = text->base;
+    for (int pass = 0; pass < 2; pass++) {
+        const TextEntry* entries = pass ? text->relocs : text->symbols;
+        uint32_t num_entries = pass ? text->num_relocs : text->num_symbols;
+        SymbolTable* table = pass ? obj->reltbl : obj->symtbl;
+        for (uint32_t i = 0; i < num_entries; i++) {
+            if (!is_valid_label(entries[i].name)
+                || add_to_table(table, entries[i].name, entries[i].addr) != 0) {
+                write_to_log("Error: invalid entry in %s: %u\t%s\n", obj->name,
+                    entries[i].addr, entries[i].name);
+                err = 1;
+            }
+        }
+    }
+    return err ? -1 : 0;
+}
+
+/* Reads the object file NAME, written by pass two as text or with -binary,
+   into OBJ. Returns 0 on success and -1, after logging an error, if it
+   cannot be opened or is malformed.
+ */
+int read_object(const char* name, ObjectFile* obj) {
+    if (is_binary_object(name)) {
+        return load_binary_object(name, obj);
+    }
+    init_object(obj, name);
+    TextObject text;
+    int err = load_text_object(name, &text) != 0;
+    err |= take_text_object(&text, obj) != 0;
+    free_text_object(&text);
+    return err ? -1 : 0;
+}
+
+/* Parses the SIZE bytes at DATA, an object file, into OBJ, using NAME in
+   messages. DATA must have one writable byte past SIZE and is modified in
+   place by parse_text_object(). Returns 0 on success and -1, after logging
+   an error, if it is malformed. OBJ must be passed to free_object() either
+   way.
+ */
+int parse_object(char* data, size_t size, const char* name, ObjectFile* obj) {
+    init_object(obj, name);
+    TextObject text;
+    int err = parse_text_object(data, size, name, &text) != 0;
+    err |= take_text_object(&text, obj) != 0;
+    free_text_object(&text);
+    return err ? -1 : 0;
+}
+
+void free_object(ObjectFile* obj) {
+    free(obj->words);
+    free_table(obj->symtbl);
+    free_table(obj->reltbl);
+}
+
+/*******************************
+ * Linking
+ *******************************/
+
+/* Enters every symbol of the NUM_OBJECTS objects in OBJS into MAP at its
+   linked address. A name defined by more than one object keeps its first
+   definition in MAP, and its second is entered into DUPLICATES, so that the
+   clash can be reported if some other object refers to the name.
+ */
+static void build_symbol_map(ObjectFile* objs, uint32_t num_objects, SymbolMap* map,
+    SymbolMap* duplicates) {
+    for (uint32_t o = 0; o < num_objects; o++) {
+        SymbolTable* symtbl = objs[o].symtbl;
+        for (uint32_t i = 0; i < symtbl->len; i++) {
+            int inserted;
+            const char* name = symtbl->tbl[i].name;
+            uint32_t addr = objs[o].base + symtbl->tbl[i].addr;
+            MapEntry* entry = insert_symbol(map, name, addr, o, &inserted);
+            if (!inserted && entry->owner != o) {
+                insert_symbol(duplicates, name, addr, o, &inserted);
+            }
+        }
+    }
+}
+
+/* Applies the relocations of object O of JOB to its words in the linked
+   text, and logs an error for each one that cannot be applied if REPORT is
+   set. Returns the number that could not be.
+ */
+static uint32_t patch_object(const PatchJob* job, uint32_t o, int report) {
+    const ObjectFile* obj = &job->objs[o];
+    if (obj->reltbl->len == 0) {
+        return 0;
+    }
+    SymbolMap* local = create_symbol_map(obj->symtbl->len);
+    for (uint32_t i = 0; i < obj->symtbl->len; i++) {
+        int inserted;
+        insert_symbol(local, obj->symtbl->tbl[i].name, obj->base + obj->symtbl->tbl[i].addr,
+            o, &inserted);
+    }
+
+    uint32_t* text = job->text;
+    uint32_t errors = 0;
+    for (uint32_t i = 0; i < obj->reltbl->len; i++) {
+        const Symbol* rel = &obj->reltbl->tbl[i];
+        const char* problem = NULL;
+        const MapEntry* entry = NULL;
+        const MapEntry* clash = NULL;
+        uint32_t pc = obj->base + rel->addr;
+        /* Only an offset within the object names a word of the text. */
+        uint32_t* word = rel->addr / 4 < obj->len ? &text[(pc - job->start) / 4] : NULL;
+        if (!word) {
+            problem = "is outside the text";
+        } else if ((*word >> 26) != 0x02 && (*word >> 26) != 0x03) {
+            problem = "is not a j or jal";
+        } else if (!(entry = find_symbol(local, rel->name))
+            && !(entry = find_symbol(job->map, rel->name))) {
+            problem = "names an undefined symbol";
+        } else if (entry->owner != o && (clash = find_symbol(job->duplicates, rel->name))) {
+            problem = "names a symbol defined more than once";
+        } else if (((pc + 4) ^ entry->addr) & 0xf0000000) {
+            problem = "is out of range of its target";
+        }
+
+        if (problem) {
+            if (clash && report) {
+                write_to_log("Error: relocation for %s at %u in %s names a symbol defined "
+                    "in both %s and %s\n", rel->name, rel->addr, obj->name,
+                    job->objs[entry->owner].name, job->objs[clash->owner].name);
+            } else if (report) {
+                write_to_log("Error: relocation for %s at %u in %s %s\n",
+                    rel->name, rel->addr, obj->name, problem);
+            }
+            errors++;
+        } else {
+            *word = (*word & 0xfc000000) | ((entry->addr >> 2) & 0x3ffffff);
+        }
+    }
+    free_symbol_map(local);
+    return errors;
+}
+
+static void* patch_worker(void* arg) {
+    PatchJob* job = (PatchJob*) arg;
+    for (;;) {
+        uint32_t o = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED);
+        if (o >= job->num_objects) {
+            break;
+        }
+        job->errors[o] = patch_object(job, o, 0);
+    }
+    return NULL;
+}
+
+/* Applies the relocations of the NUM_OBJECTS objects in OBJS to TEXT, the
+   linked text from address START, on THREADS threads. The objects that had
+   errors are then patched again on this thread to report them, in order.
+   Returns the number of relocations that could not be applied.
+ */
+static uint32_t patch_objects(const ObjectFile* objs, uint32_t num_objects,
+    const SymbolMap* map, const SymbolMap* duplicates, uint32_t* text, uint32_t start,
+    unsigned threads) {
+    PatchJob job = { objs, num_objects, map, duplicates, text, start, 0, NULL };
+    job.errors = (uint32_t*) calloc(num_objects + 1, sizeof(uint32_t));
+    pthread_t* pool = (pthread_t*) malloc((threads + 1) * sizeof(pthread_t));
+    if (!job.errors || !pool) {
+        allocation_failed();
+    }
+    unsigned started = 0;
+    while (started + 1 < threads
+        && pthread_create(&pool[started], NULL, patch_worker, &job) == 0) {
+        started++;
+    }
+    patch_worker(&job);
+    for (unsigned t = 0; t < started; t++) {
+        pthread_join(pool[t], NULL);
+    }
+
+    uint32_t errors = 0;
+    for (uint32_t o = 0; o < num_objects; o++) {
+        if (job.errors[o] > 0) {
+            errors += patch_object(&job, o, 1);
+        }
+    }
+    free(pool);
+    free(job.errors);
+    return errors;
+}
+
+/* Writes the LEN words of TEXT, linked to start at START, and the symbols
+   of the NUM_OBJECTS objects in OBJS to OUTPUT as an object file. Symbols
+   are written as offsets from START, which is recorded as the base.
+ */
+static void write_linked(FILE* output, ObjectFile* objs, uint32_t num_objects,
+    const uint32_t* text, uint32_t start, uint32_t len) {
+    fprintf(output, ".text\n");
+    for (uint32_t i = 0; i < len; i++) {
+        write_inst_hex(output, text[i]);
+    }
+    fprintf(output, "\n.symbol\n");
+    for (uint32_t o = 0; o < num_objects; o++) {
+        SymbolTable* symtbl = objs[o].symtbl;
+        for (uint32_t i = 0; i < symtbl->len; i++) {
+            write_symbol(output, objs[o].base - start + symtbl->tbl[i].addr,
+                symtbl->tbl[i].name);
+        }
+    }
+    fprintf(output, "\n.relocation\n");
+    if (start != 0) {
+        fprintf(output, "\n.base\n%08x\n", start);
+    }
+}
+
+/* Orders indices into the objects being laid out by base address. */
+static const ObjectFile* layout_objs = NULL;
+
+static int compare_bases(const void* a, const void* b) {
+    const ObjectFile* x = &layout_objs[*(const uint32_t*) a];
+    const ObjectFile* y = &layout_objs[*(const uint32_t*) b];
+    if (x->base != y->base) {
+        return x->base < y->base ? -1 : 1;
+    }
+    return *(const uint32_t*) a < *(const uint32_t*) b ? -1 : 1;
+}
+
+/* Gives each of the NUM_OBJECTS objects in OBJS its linked address. One
+   assembled with -base is placed at the address it records, and any other
+   right after the object before it, or at 0 if it is the first. Stores the
+   lowest address in START and the number of words from there to the end of
+   the highest object in LEN. Returns 0 on success and -1, after logging an
+   error for each, if two objects overlap, one does not end below 4 GB, or
+   the objects span more than the MAX_LINKED_BYTES that can be held.
+ */
+static int lay_out_objects(ObjectFile* objs, uint32_t num_objects, uint32_t* start,
+    uint32_t* len) {
+    uint32_t* order = (uint32_t*) malloc((num_objects + 1) * sizeof(uint32_t));
+    if (!order) {
+        allocation_failed();
+    }
+    int err = 0;
+    uint64_t next = 0;
+    uint32_t num_placed = 0;
+    for (uint32_t o = 0; o < num_objects; o++) {
+        if (!objs[o].has_base) {
+            objs[o].base = next > UINT32_MAX ? UINT32_MAX : (uint32_t) next;
+        }
+        next = objs[o].base + (uint64_t) objs[o].len * 4;
+        if (next > (uint64_t) UINT32_MAX + 1) {
+            write_to_log("Error: %s at 0x%08x does not end below 4 GB\n", objs[o].name,
+                objs[o].base);
+            err = 1;
+        } else if (objs[o].len > 0) {
+            order[num_placed++] = o;
+        }
+    }
+
+    layout_objs = objs;
+    qsort(order, num_placed, sizeof(uint32_t), compare_bases);
+    layout_objs = NULL;
+    uint64_t end = 0;
+    uint32_t last = 0;
+    for (uint32_t i = 0; i < num_placed; i++) {
+        const ObjectFile* obj = &objs[order[i]];
+        if (i > 0 && obj->base < end) {
+            write_to_log("Error: %s at 0x%08x-0x%08x overlaps %s at 0x%08x-0x%08x\n",
+                obj->name, obj->base, obj->base + obj->len * 4 - 1, objs[last].name,
+                objs[last].base, objs[last].base + objs[last].len * 4 - 1);
+            err = 1;
+        }
+        if (obj->base + (uint64_t) obj->len * 4 > end) {
+            end = obj->base + (uint64_t) obj->len * 4;
+            last = order[i];
+        }
+    }
+
+    *start = num_placed > 0 ? objs[order[0]].base : 0;
+    *len = 0;
+    if (!err && end - *start > MAX_LINKED_BYTES) {
+        write_to_log("Error: the objects span 0x%llx bytes from 0x%08x, more than the "
+            "0x%x that can be linked\n", (unsigned long long) (end - *start), *start,
+            MAX_LINKED_BYTES);
+        err = 1;
+    } else if (!err) {
+        *len = (uint32_t) ((end - *start) / 4);
+    }
+    free(order);
+    return err ? -1 : 0;
+}
+
+/* Appends a slot for one more object to OBJS, of NUM_OBJECTS entries and
+   room for CAP, and returns it.
+ */
+static ObjectFile* add_object(ObjectFile** objs, uint32_t* num_objects, uint32_t* cap) {
+    if (*num_objects == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *objs = (ObjectFile*) realloc(*objs, *cap * sizeof(ObjectFile));
+        if (!*objs) {
+            allocation_failed();
+        }
+    }
+    return &(*objs)[(*num_objects)++];
+}
+
+/* Adds to OBJS each member of the NUM_ARCHIVES archives in ARCHIVES that
+   defines a symbol some object references but none defines, searching the
+   archives in order. Members pulled in are scanned in turn, so their own
+   references are resolved too. The names of the new objects are allocated
+   and must be freed by the caller. Returns 0 on success and -1 if a member
+   could not be read.
+ */
+static int pull_members(ObjectFile** objs, uint32_t* num_objects, uint32_t* cap,
+    Archive** archives, uint32_t num_archives) {
+    SymbolMap* defined = create_symbol_map(1024);
+    uint8_t** pulled = (uint8_t**) calloc(num_archives, sizeof(uint8_t*));
+    if (!pulled) {
+        allocation_failed();
+    }
+    for (uint32_t a = 0; a < num_archives; a++) {
+        pulled[a] = (uint8_t*) calloc(archives[a]->num_members + 1, 1);
+        if (!pulled[a]) {
+            allocation_failed();
+        }
+    }
+
+    int err = 0;
+    uint32_t scanned = 0;
+    for (uint32_t o = 0; o < *num_objects && !err; o++) {
+        /* Define the symbols of every object seen so far before resolving
+           the references of this one. */
+        for (; scanned < *num_objects; scanned++) {
+            SymbolTable* symtbl = (*objs)[scanned].symtbl;
+            for (uint32_t i = 0; i < symtbl->len; i++) {
+                int inserted;
+                insert_symbol(defined, symtbl->tbl[i].name, 0, scanned, &inserted);
+            }
+        }
+        SymbolTable* reltbl = (*objs)[o].reltbl;
+        for (uint32_t i = 0; i < reltbl->len && !err; i++) {
+            const char* symbol = reltbl->tbl[i].name;
+            if (find_symbol(defined, symbol)) {
+                continue;
+            }
+            for (uint32_t a = 0; a < num_archives; a++) {
+                int64_t m = find_member(archives[a], symbol);
+                if (m == -1 || pulled[a][m]) {
+                    continue;
+                }
+                pulled[a][m] = 1;
+                size_t size;
+                char* member_name;
+                char* data = read_member(archives[a], m, &size, &member_name);
+                if (!data) {
+                    write_to_log("Error: unable to read member %ld of %s\n",
+                        (long) m, archives[a]->name);
+                    err = 1;
+                    break;
+                }
+                char* name = (char*) malloc(strlen(archives[a]->name) + strlen(member_name) + 3);
+                if (!name) {
+                    allocation_failed();
+                }
+                sprintf(name, "%s(%s)", archives[a]->name, member_name);
+                ObjectFile* obj = add_object(objs, num_objects, cap);
+                err = parse_object(data, size, name, obj) != 0;
+                free(member_name);
+                free(data);
+                /* The symbols of the new member are defined before the next
+                   reference is looked up. */
+                for (; scanned < *num_objects; scanned++) {
+                    SymbolTable* symtbl = (*objs)[scanned].symtbl;
+                    for (uint32_t j = 0; j < symtbl->len; j++) {
+                        int inserted;
+                        insert_symbol(defined, symtbl->tbl[j].name, 0, scanned, &inserted);
+                    }
+                }
+                break;
+            }
+        }
+    }
+
+    for (uint32_t a = 0; a < num_archives; a++) {
+        free(pulled[a]);
+    }
+    free(pulled);
+    free_symbol_map(defined);
+    return err ? -1 : 0;
+}
+
+/* Links the object files and archives in the NUM_NAMES files in NAMES and
+   writes the result to OUT_NAME. Object files are laid out as by
+   lay_out_objects() in the order given, followed by the archive members
+   needed to define symbols that they reference. Relocations are applied on
+   THREADS threads, and the time that takes is printed if TIMED is set.
+   Every undefined symbol, and every symbol that is defined more than once
+   and referred to from another object, is reported. Returns 0 on success
+   and -1 on any error, in which case nothing is written.
+ */
+int link_objects(char** names, uint32_t num_names, const char* out_name, unsigned threads,
+    int timed) {
+    ObjectFile* objs = NULL;
+    uint32_t num_objects = 0, cap = 0;
+    Archive** archives = (Archive**) calloc(num_names + 1, sizeof(Archive*));
+    if (!archives) {
+        allocation_failed();
+    }
+    uint32_t num_archives = 0;
+    int err = 0;
+    for (uint32_t i = 0; i < num_names; i++) {
+        Archive* archive = open_archive(names[i]);
+        if (archive) {
+            archives[num_archives++] = archive;
+        } else if (read_object(names[i], add_object(&objs, &num_objects, &cap)) != 0) {
+            err = 1;
+        }
+    }
+    uint32_t num_given = num_objects;
+    if (!err && num_archives > 0) {
+        err = pull_members(&objs, &num_objects, &cap, archives, num_archives) != 0;
+    }
+    for (uint32_t a = 0; a < num_archives; a++) {
+        close_archive(archives[a]);
+    }
+    free(archives);
+
+    uint32_t start = 0, len = 0, num_symbols = 0, num_relocs = 0;
+    for (uint32_t o = 0; o < num_objects; o++) {
+        num_symbols += objs[o].symtbl->len;
+        num_relocs += objs[o].reltbl->len;
+    }
+    if (!err) {
+        err = lay_out_objects(objs, num_objects, &start, &len) != 0;
+    }
+
+    /* Gaps between objects placed at their -base addresses are nops. */
+    uint32_t* text = (uint32_t*) calloc(len + 1, sizeof(uint32_t));
+    if (!text) {
+        allocation_failed();
+    }
+    for (uint32_t o = 0; o < num_objects && !err; o++) {
+        if (objs[o].len > 0) {
+            memcpy(&text[(objs[o].base - start) / 4], objs[o].words,
+                objs[o].len * sizeof(uint32_t));
+        }
+    }
+
+    SymbolMap* map = create_symbol_map(num_symbols);
+    SymbolMap* duplicates = create_symbol_map(0);
+    if (!err) {
+        build_symbol_map(objs, num_objects, map, duplicates);
+        struct timespec before, after;
+        if (timed) {
+            clock_gettime(CLOCK_MONOTONIC, &before);
+        }
+        uint32_t errors = patch_objects(objs, num_objects, map, duplicates, text, start,
+            threads);
+        if (timed) {
+            clock_gettime(CLOCK_MONOTONIC, &after);
+            double seconds = (after.tv_sec - before.tv_sec)
+                + (after.tv_nsec - before.tv_nsec) / 1e9;
+            printf("Patched %u relocations on %u threads in %.3f s\n", num_relocs, threads,
+                seconds);
+        }
+        err = errors > 0;
+    }
+
+    if (!err) {
+        FILE* output = fopen(out_name, "w");
+        if (!output) {
+            write_to_log("Error: unable to open output file: %s\n", out_name);
+            err = 1;
+        } else {
+            write_linked(output, objs, num_objects, text, start, len);
+            fclose(output);
+            printf("Linked %u objects (%u from archives) into %u words with %u symbols "
+                "and %u relocations\n", num_objects, num_objects - num_given, len,
+                num_symbols, num_relocs);
+        }
+    }
+
+    free_symbol_map(duplicates);
+    free_symbol_map(map);
+    free(text);
+    for (uint32_t o = 0; o < num_objects; o++) {
+        free_object(&objs[o]);
+        if (o >= num_given) {
+            free((char*) objs[o].name);
+        }
+    }
+    free(objs);
+    return err ? -1 : 0;
+}
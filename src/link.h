@@ -0,0 +1,27 @@
+#ifndef LINK_H
+#define LINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* An object file written by pass two, as read back by read_object(). */
+typedef struct {
+    const char* name;
+    uint32_t* words;        // .text
+    uint32_t len;
+    SymbolTable* symtbl;    // .symbol, byte offsets from the first word
+    SymbolTable* reltbl;    // .relocation
+    uint32_t base;          // address of the first word once linked
+    int has_base;           // assembled with -base, which fixed BASE
+} ObjectFile;
+
+int read_object(const char* name, ObjectFile* obj);
+
+int parse_object(char* data, size_t size, const char* name, ObjectFile* obj);
+
+void free_object(ObjectFile* obj);
+
+int link_objects(char** names, uint32_t num_names, const char* out_name, unsigned threads,
+    int timed);
+
+#endif
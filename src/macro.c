@@ -0,0 +1,263 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "tables.h"
+#include "symmap.h"
+#include "macro.h"
+
+/* Macros defined with .macro NAME PARAM, ... and ended by .endm.
+
+   The body is kept as pass one tokenized it. Each token is split once, when
+   the macro is defined, into slices of literal text and references to its
+   parameters, written \PARAM, so an invocation only copies the slices and
+   its arguments into place and never splits a line again. \@ is the number
+   of macros invoked before this one, for labels that must differ between
+   expansions. A backslash followed by anything else is kept as written, so
+   string escapes such as \n pass through.
+
+   Directives that read the raw rest of the line (.ascii, .asciiz, .equ and
+   .set) have that text kept the same way, as one more token of the line.
+ */
+
+/* Makes room for NEEDED items of SIZE bytes in ITEMS, which holds *CAP, and
+   returns the array.
+ */
+static void* grow(void* items, uint32_t* cap, uint32_t needed, size_t size) {
+    if (needed <= *cap) {
+        return items;
+    }
+    uint32_t new_cap = *cap ? *cap : 8;
+    while (new_cap < needed) {
+        new_cap *= 2;
+    }
+    items = realloc(items, new_cap * size);
+    if (!items) {
+        allocation_failed();
+    }
+    *cap = new_cap;
+    return items;
+}
+
+MacroTable* create_macro_table() {
+    MacroTable* table = (MacroTable*) calloc(1, sizeof(MacroTable));
+    if (!table) {
+        allocation_failed();
+    }
+    table->names = create_symbol_map(16);
+    return table;
+}
+
+void free_macro_table(MacroTable* table) {
+    if (!table) {
+        return;
+    }
+    for (uint32_t i = 0; i < table->len; i++) {
+        Macro* macro = table->macros[i];
+        for (uint32_t p = 0; p < macro->num_params; p++) {
+            free(macro->params[p]);
+        }
+        free(macro->params);
+        free(macro->name);
+        free(macro->text);
+        free(macro->segments);
+        free(macro->tokens);
+        free(macro->lines);
+        free(macro);
+    }
+    free(table->macros);
+    free_symbol_map(table->names);
+    free(table);
+}
+
+/* Adds the macro NAME with the NUM_PARAMS parameter names in PARAMS to
+   TABLE and returns it, empty, for the lines of its body. Returns NULL if
+   NAME is already a macro or a parameter name is repeated.
+ */
+Macro* define_macro(MacroTable* table, const char* name, char** params, int num_params) {
+    if (find_macro(table, name)) {
+        return NULL;
+    }
+    for (int i = 0; i < num_params; i++) {
+        for (int j = 0; j < i; j++) {
+            if (strcmp(params[i], params[j]) == 0) {
+                return NULL;
+            }
+        }
+    }
+
+    Macro* macro = (Macro*) calloc(1, sizeof(Macro));
+    char** copies = (char**) malloc((num_params + 1) * sizeof(char*));
+    if (!macro || !copies || !(macro->name = strdup(name))) {
+        allocation_failed();
+    }
+    for (int i = 0; i < num_params; i++) {
+        if (!(copies[i] = strdup(params[i]))) {
+            allocation_failed();
+        }
+    }
+    macro->params = copies;
+    macro->num_params = num_params;
+
+    table->macros = (Macro**) grow(table->macros, &table->cap, table->len + 1, sizeof(Macro*));
+    table->macros[table->len] = macro;
+    int inserted;
+    insert_symbol(table->names, macro->name, table->len, 0, &inserted);
+    table->len++;
+    return macro;
+}
+
+/* Returns the macro NAME in TABLE, which may be NULL, or NULL if there is
+   none.
+ */
+Macro* find_macro(const MacroTable* table, const char* name) {
+    const MapEntry* entry = table ? find_symbol(table->names, name) : NULL;
+    return entry ? table->macros[entry->addr] : NULL;
+}
+
+/* Appends a segment for PARAM, or for the LEN literal characters at STR, to
+   MACRO. A literal directly after another is merged into it.
+ */
+static void add_segment(Macro* macro, int32_t param, const char* str, uint32_t len) {
+    MacroSegment* last = macro->num_segments ? &macro->segments[macro->num_segments - 1] : NULL;
+    MacroToken* token = &macro->tokens[macro->num_tokens - 1];
+    if (param == MACRO_LITERAL) {
+        if (len == 0) {
+            return;
+        }
+        macro->text = (char*) grow(macro->text, &macro->text_cap, macro->text_len + len, 1);
+        memcpy(macro->text + macro->text_len, str, len);
+        macro->text_len += len;
+        if (token->count && last->param == MACRO_LITERAL) {
+            last->len += len;
+            return;
+        }
+    }
+    macro->segments = (MacroSegment*) grow(macro->segments, &macro->segments_cap,
+        macro->num_segments + 1, sizeof(MacroSegment));
+    MacroSegment* segment = &macro->segments[macro->num_segments++];
+    segment->param = param;
+    segment->start = param == MACRO_LITERAL ? macro->text_len - len : 0;
+    segment->len = param == MACRO_LITERAL ? len : 0;
+    token->count++;
+}
+
+/* Appends STR to MACRO as a token, split at each reference to a parameter,
+   and returns its index.
+ */
+static uint32_t add_token(Macro* macro, const char* str) {
+    macro->tokens = (MacroToken*) grow(macro->tokens, &macro->tokens_cap,
+        macro->num_tokens + 1, sizeof(MacroToken));
+    MacroToken* token = &macro->tokens[macro->num_tokens++];
+    token->first = macro->num_segments;
+    token->count = 0;
+
+    const char* literal = str;
+    const char* c = str;
+    while (*c) {
+        if (c[0] != '\\') {
+            c++;
+            continue;
+        }
+        if (c[1] == '@') {
+            add_segment(macro, MACRO_LITERAL, literal, c - literal);
+            add_segment(macro, MACRO_UNIQUE, NULL, 0);
+            literal = c += 2;
+            continue;
+        }
+        const char* end = c + 1;
+        while (isalnum((unsigned char) *end) || *end == '_') {
+            end++;
+        }
+        for (uint32_t p = 0; p < macro->num_params; p++) {
+            if (strlen(macro->params[p]) == (size_t) (end - c - 1)
+                && strncmp(macro->params[p], c + 1, end - c - 1) == 0) {
+                add_segment(macro, MACRO_LITERAL, literal, c - literal);
+                add_segment(macro, p, NULL, 0);
+                literal = end;
+                break;
+            }
+        }
+        c = end;
+    }
+    add_segment(macro, MACRO_LITERAL, literal, c - literal);
+    return macro->num_tokens - 1;
+}
+
+/* Appends a line of NUM_TOKENS TOKENS to the body of MACRO. REST is the raw
+   text after the instruction or directive name for the directives that read
+   it, or NULL.
+ */
+void add_macro_line(Macro* macro, char** tokens, int num_tokens, const char* rest) {
+    macro->lines = (MacroLine*) grow(macro->lines, &macro->lines_cap, macro->num_lines + 1,
+        sizeof(MacroLine));
+    MacroLine* line = &macro->lines[macro->num_lines++];
+    line->first = macro->num_tokens;
+    line->count = num_tokens;
+    for (int i = 0; i < num_tokens; i++) {
+        add_token(macro, tokens[i]);
+    }
+    line->rest = rest ? (int32_t) add_token(macro, rest) : -1;
+}
+
+/* Writes TOKEN of MACRO with ARGS and UNIQUE substituted at *POS, before
+   END, and moves *POS past it. Returns where it starts, or NULL if it does
+   not fit.
+ */
+static char* expand_token(const Macro* macro, const MacroToken* token, char** args,
+    uint32_t unique, char** pos, char* end) {
+    char* start = *pos;
+    for (uint32_t i = 0; i < token->count; i++) {
+        const MacroSegment* segment = &macro->segments[token->first + i];
+        char number[16];
+        const char* src;
+        size_t len;
+        if (segment->param == MACRO_LITERAL) {
+            src = macro->text + segment->start;
+            len = segment->len;
+        } else if (segment->param == MACRO_UNIQUE) {
+            len = sprintf(number, "%u", unique);
+            src = number;
+        } else {
+            src = args[segment->param];
+            len = strlen(src);
+        }
+        if ((size_t) (end - *pos) <= len) {
+            return NULL;
+        }
+        memcpy(*pos, src, len);
+        *pos += len;
+    }
+    if (*pos >= end) {
+        return NULL;
+    }
+    *(*pos)++ = '\0';
+    return start;
+}
+
+/* Expands line LINE of the body of MACRO for an invocation with ARGS, one
+   per parameter, that is the UNIQUE-th. The tokens are written to BUF,
+   which holds SIZE bytes, and TOKENS is pointed at them; REST is pointed at
+   the raw rest of the line, or set to NULL if the line has none kept.
+   Returns the number of tokens, or -1 if they do not fit in BUF.
+ */
+int expand_macro_line(const Macro* macro, uint32_t line, char** args, uint32_t unique,
+    char* buf, size_t size, char** tokens, char** rest) {
+    const MacroLine* body = &macro->lines[line];
+    char* pos = buf;
+    char* end = buf + size;
+    for (uint32_t i = 0; i < body->count; i++) {
+        tokens[i] = expand_token(macro, &macro->tokens[body->first + i], args, unique, &pos,
+            end);
+        if (!tokens[i]) {
+            return -1;
+        }
+    }
+    *rest = NULL;
+    if (body->rest >= 0
+        && !(*rest = expand_token(macro, &macro->tokens[body->rest], args, unique, &pos, end))) {
+        return -1;
+    }
+    return body->count;
+}
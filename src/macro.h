@@ -0,0 +1,66 @@
+#ifndef MACRO_H
+#define MACRO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MACRO_LITERAL -1    // MacroSegment.param of a slice of the body
+#define MACRO_UNIQUE -2     // MacroSegment.param of \@
+
+/* A piece of one token of a macro body: a slice of the body's text, or the
+   argument given for a parameter.
+ */
+typedef struct {
+    int32_t param;          // index of the parameter, or MACRO_LITERAL or MACRO_UNIQUE
+    uint32_t start;         // for a literal, its slice of Macro.text
+    uint32_t len;
+} MacroSegment;
+
+typedef struct {
+    uint32_t first;         // first segment in Macro.segments
+    uint32_t count;
+} MacroToken;
+
+/* One line of a macro body, as pass one tokenized it. */
+typedef struct {
+    uint32_t first;         // first token in Macro.tokens
+    uint32_t count;
+    int32_t rest;           // Macro.tokens entry for the raw text after the name, or -1
+} MacroLine;
+
+typedef struct {
+    char* name;
+    char** params;
+    uint32_t num_params;
+    char* text;             // the literal slices, one after another
+    uint32_t text_len, text_cap;
+    MacroSegment* segments;
+    uint32_t num_segments, segments_cap;
+    MacroToken* tokens;
+    uint32_t num_tokens, tokens_cap;
+    MacroLine* lines;
+    uint32_t num_lines, lines_cap;
+    int expanding;          // set while an invocation is being expanded
+} Macro;
+
+typedef struct {
+    SymbolMap* names;       // name -> index in macros
+    Macro** macros;
+    uint32_t len, cap;
+    uint32_t expansions;    // invocations so far, the value of \@
+} MacroTable;
+
+MacroTable* create_macro_table();
+
+void free_macro_table(MacroTable* table);
+
+Macro* define_macro(MacroTable* table, const char* name, char** params, int num_params);
+
+void add_macro_line(Macro* macro, char** tokens, int num_tokens, const char* rest);
+
+Macro* find_macro(const MacroTable* table, const char* name);
+
+int expand_macro_line(const Macro* macro, uint32_t line, char** args, uint32_t unique,
+    char* buf, size_t size, char** tokens, char** rest);
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "translate_utils.h"
+#include "program.h"
+#include "peephole.h"
+
+/* The peephole optimizer makes a single pass over the program, appending each
+   instruction to an output program and then matching the pattern table below
+   against the tail of the output. A pattern that matches rewrites the tail in
+   place and only ever shrinks it, so every instruction is appended once and
+   removed at most once, and the pass runs in linear time. Because the tail is
+   re-examined after every rewrite, cascades such as nested push/pop pairs
+   collapse completely.
+ */
+
+typedef struct {
+    Program* in;            // the program being optimized
+    Program* out;           // instructions kept so far; the window is its tail
+    uint32_t* origin;       // index in IN of each instruction in OUT
+    const uint8_t* heads;   // label heads of IN, see find_label_heads()
+    SymbolTable* symtbl;
+    uint32_t next;          // index in IN of the next instruction to be read
+} Window;
+
+typedef struct {
+    const char* name;
+    uint32_t size;
+    /* Returns 1 if the last SIZE instructions of the window match. */
+    int (*match)(Window* win, Instruction* insts, uint32_t first);
+    /* Rewrites the matched instructions in place and returns how many of them
+       (counted from the front) remain. The rest are freed by the caller. */
+    uint32_t (*rewrite)(Instruction* insts);
+} Pattern;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Returns 1 if STR is a number equal to VALUE. */
+static int is_imm(const char* str, long int value) {
+    long int num;
+    return translate_num(&num, str, value, value) == 0;
+}
+
+static int is_stack_adjust(const Instruction* inst, long int amount) {
+    return is_inst(inst, "addiu") && inst->num_args == 3 && same_reg(inst->args[0], "$sp")
+        && same_reg(inst->args[1], "$sp") && is_imm(inst->args[2], amount);
+}
+
+static int is_stack_access(const Instruction* inst, const char* name) {
+    return is_inst(inst, name) && inst->num_args == 3 && is_imm(inst->args[1], 0)
+        && same_reg(inst->args[2], "$sp");
+}
+
+/*******************************
+ * Patterns
+ *******************************/
+
+/* push $x; pop $x */
+static int match_push_pop(Window* win, Instruction* insts, uint32_t first) {
+    return is_stack_adjust(&insts[0], -4) && is_stack_access(&insts[1], "sw")
+        && is_stack_access(&insts[2], "lw") && is_stack_adjust(&insts[3], 4)
+        && same_reg(insts[1].args[0], insts[2].args[0]);
+}
+
+/* jal f; jr $ra -> j f */
+static int match_tail_call(Window* win, Instruction* insts, uint32_t first) {
+    return is_inst(&insts[0], "jal") && insts[0].num_args == 1
+        && is_inst(&insts[1], "jr") && insts[1].num_args == 1
+        && same_reg(insts[1].args[0], "$ra");
+}
+
+static uint32_t rewrite_tail_call(Instruction* insts) {
+    free(insts[0].name);
+    insts[0].name = (char*) malloc(2);
+    if (!insts[0].name) {
+        allocation_failed();
+    }
+    strcpy(insts[0].name, "j");
+    return 1;
+}
+
+/* A beq or bne whose target is the instruction that will follow it. Everything
+   between the branch and the next instruction to be read has already been
+   removed, so the branch is a no-op if its target lies in that range.
+ */
+static int match_branch_to_next(Window* win, Instruction* insts, uint32_t first) {
+    if (!(is_inst(&insts[0], "beq") || is_inst(&insts[0], "bne")) || insts[0].num_args != 3) {
+        return 0;
+    }
+    int64_t target = get_target_index(win->in, win->symtbl, insts[0].args[2]);
+    return target > win->origin[first] && target <= win->next;
+}
+
+/* addiu $x $x 0, addu $x $x $0, or $x $x $0 */
+static int match_self_move(Window* win, Instruction* insts, uint32_t first) {
+    const Instruction* inst = &insts[0];
+    if (inst->num_args != 3 || !same_reg(inst->args[0], inst->args[1])) {
+        return 0;
+    }
+    if (is_inst(inst, "addiu")) {
+        return is_imm(inst->args[2], 0);
+    }
+    return (is_inst(inst, "addu") || is_inst(inst, "or")) && same_reg(inst->args[2], "$0");
+}
+
+static uint32_t rewrite_remove(Instruction* insts) {
+    return 0;
+}
+
+static const Pattern PATTERNS[] = {
+    { "push-pop",       4, match_push_pop,       rewrite_remove },
+    { "tail-call",      2, match_tail_call,      rewrite_tail_call },
+    { "branch-to-next", 1, match_branch_to_next, rewrite_remove },
+    { "self-move",      1, match_self_move,      rewrite_remove },
+};
+
+static const size_t NUM_PATTERNS = sizeof(PATTERNS) / sizeof(PATTERNS[0]);
+
+/*******************************
+ * Optimizer
+ *******************************/
+
+/* Tries each pattern against the tail of the window. Instructions inside the
+   window other than the first must not be label heads, since code elsewhere
+   may jump into the middle of the sequence. Returns 1 if a pattern fired.
+ */
+static int apply_patterns(Window* win) {
+    for (size_t i = 0; i < NUM_PATTERNS; i++) {
+        const Pattern* pat = &PATTERNS[i];
+        if (win->out->len < pat->size) {
+            continue;
+        }
+        uint32_t first = win->out->len - pat->size;
+        int labeled = 0;
+        for (uint32_t j = first + 1; j < win->out->len; j++) {
+            labeled |= win->heads[win->origin[j]];
+        }
+        Instruction* insts = &win->out->insts[first];
+        if (labeled || !pat->match(win, insts, first)) {
+            continue;
+        }
+        uint32_t kept = pat->rewrite(insts);
+        for (uint32_t j = kept; j < pat->size; j++) {
+            free_inst(&insts[j]);
+        }
+        win->out->len = first + kept;
+        return 1;
+    }
+    return 0;
+}
+
+/* Runs the peephole optimizer over PROG, which is rewritten in place, and moves
+   the labels in SYMTBL to match. Returns the number of words removed.
+ */
+uint32_t peephole_optimize(Program* prog, SymbolTable* symtbl) {
+    Window win;
+    win.in = prog;
+    win.out = create_program();
+    win.origin = (uint32_t*) malloc((prog->len + 1) * sizeof(uint32_t));
+    if (!win.origin) {
+        allocation_failed();
+    }
+    win.heads = find_label_heads(prog, symtbl);
+    win.symtbl = symtbl;
+
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        win.origin[win.out->len] = i;
+        append_copy(win.out, inst);
+        win.next = i + 1;
+        while (apply_patterns(&win));
+    }
+
+    uint32_t old_len = prog->len;
+    uint32_t* map = map_from_origins(win.origin, win.out->len, old_len);
+    remap_symbols(symtbl, map, old_len);
+
+    replace_program(prog, win.out);
+    free(map);
+    free((uint8_t*) win.heads);
+    free(win.origin);
+    return old_len - prog->len;
+}
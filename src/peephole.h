@@ -0,0 +1,9 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdint.h>
+
+/* See documentation in peephole.c */
+uint32_t peephole_optimize(Program* prog, SymbolTable* symtbl);
+
+#endif
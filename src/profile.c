@@ -0,0 +1,218 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate.h"
+#include "decode.h"
+#include "vm.h"
+#include "profile.h"
+
+/* A sampling profiler for the VM. The program is stepped through run_vm()
+   one instruction at a time while a shadow call stack follows it: jal pushes
+   the label at its target and jr $ra pops. Every so many instructions the
+   stack is recorded, with the source line of the instruction about to run
+   appended to the innermost frame when it is known, and at the end the
+   samples are written in the folded format read by flamegraph.pl and
+   similar tools:
+
+       main;fact;fact:14 37
+ */
+
+#define MAX_FRAME 256
+
+/* Distinct stacks seen so far and how often, in an open-addressing hash
+   table keyed on the folded stack.
+ */
+typedef struct {
+    char* stack;            // NULL for an empty slot
+    uint64_t count;
+} Sample;
+
+typedef struct {
+    Sample* samples;
+    uint32_t len;
+    uint32_t cap;           // a power of two
+} SampleTable;
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+static char* create_copy_of_str(const char* str) {
+    size_t len = strlen(str) + 1;
+    char* buf = (char*) malloc(len);
+    if (!buf) {
+        allocation_failed();
+    }
+    memcpy(buf, str, len);
+    return buf;
+}
+
+/* Returns an array with, for each of the LEN + 1 word positions of the text,
+   the first label in SYMTBL at that position or NULL.
+ */
+static const char** find_names(SymbolTable* symtbl, uint32_t len) {
+    const char** names = (const char**) calloc(len + 1, sizeof(char*));
+    if (!names) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        uint32_t index = symtbl->tbl[i].addr / 4;
+        if (symtbl->tbl[i].addr % 4 == 0 && index <= len && !names[index]) {
+            names[index] = symtbl->tbl[i].name;
+        }
+    }
+    return names;
+}
+
+/* Writes the name of the function starting at word INDEX to BUF, which has
+   room for MAX_FRAME characters.
+ */
+static void frame_name(char* buf, const char** names, Vm* vm, uint32_t index) {
+    if (index <= vm->len && names[index]) {
+        snprintf(buf, MAX_FRAME, "%s", names[index]);
+    } else {
+        snprintf(buf, MAX_FRAME, "0x%08x", vm->base + index * 4);
+    }
+}
+
+static uint64_t hash_stack(const char* stack) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* c = stack; *c; c++) {
+        hash = (hash ^ (uint8_t) *c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Returns the slot for STACK in SAMPLES, which is either empty or holds it. */
+static Sample* find_slot(Sample* samples, uint32_t cap, const char* stack) {
+    uint32_t i = hash_stack(stack) & (cap - 1);
+    while (samples[i].stack && strcmp(samples[i].stack, stack) != 0) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &samples[i];
+}
+
+/* Counts one more sample of STACK, copying it if it is new. */
+static void add_sample(SampleTable* table, const char* stack) {
+    if ((table->len + 1) * 2 > table->cap) {
+        uint32_t cap = table->cap ? table->cap * 2 : 64;
+        Sample* samples = (Sample*) calloc(cap, sizeof(Sample));
+        if (!samples) {
+            allocation_failed();
+        }
+        for (uint32_t i = 0; i < table->cap; i++) {
+            if (table->samples[i].stack) {
+                *find_slot(samples, cap, table->samples[i].stack) = table->samples[i];
+            }
+        }
+        free(table->samples);
+        table->samples = samples;
+        table->cap = cap;
+    }
+    Sample* slot = find_slot(table->samples, table->cap, stack);
+    if (!slot->stack) {
+        slot->stack = create_copy_of_str(stack);
+        table->len++;
+    }
+    slot->count++;
+}
+
+static int compare_samples(const void* a, const void* b) {
+    const Sample* x = a;
+    const Sample* y = b;
+    if (!x->stack || !y->stack) {
+        return !x->stack - !y->stack;
+    }
+    return strcmp(x->stack, y->stack);
+}
+
+/*******************************
+ * Profiling
+ *******************************/
+
+/* Runs VM like run_vm() with the same BUDGET, taking a sample every EVERY
+   instructions, and writes the folded stacks to OUTPUT. Frames are named
+   after the labels in SYMTBL; LINES, if not NULL, gives the source line of
+   each word, 0 where it is unknown. Returns the same status run_vm() would
+   have.
+ */
+VmStatus profile_vm(Vm* vm, uint64_t budget, uint32_t every, SymbolTable* symtbl,
+    const uint32_t* lines, FILE* output) {
+    const char** names = find_names(symtbl, vm->len);
+    uint32_t depth = 1;
+    uint32_t cap = 64;
+    uint32_t* frames = (uint32_t*) malloc(cap * sizeof(uint32_t));
+    if (!frames) {
+        allocation_failed();
+    }
+    frames[0] = (vm->pc - vm->base) / 4;
+
+    SampleTable table = { NULL, 0, 0 };
+    size_t buf_cap = 2 * MAX_FRAME;
+    char* buf = (char*) malloc(buf_cap);
+    if (!buf) {
+        allocation_failed();
+    }
+    VmStatus status = VM_OUT_OF_BUDGET;
+    uint64_t start = vm->executed;
+    uint64_t until_sample = every;
+    while (budget == 0 || vm->executed - start < budget) {
+        uint32_t index = (vm->pc - vm->base) / 4;
+        uint32_t word = index < vm->len ? vm->words[index] : 0;
+
+        if (--until_sample == 0 && index < vm->len) {
+            until_sample = every;
+            size_t pos = 0;
+            for (uint32_t f = 0; f < depth; f++) {
+                if (pos + MAX_FRAME + 16 > buf_cap) {
+                    buf_cap *= 2;
+                    buf = (char*) realloc(buf, buf_cap);
+                    if (!buf) {
+                        allocation_failed();
+                    }
+                }
+                if (f > 0) {
+                    buf[pos++] = ';';
+                }
+                frame_name(buf + pos, names, vm, frames[f]);
+                pos += strlen(buf + pos);
+            }
+            if (lines && lines[index]) {
+                sprintf(buf + pos, ":%u", lines[index]);
+            }
+            add_sample(&table, buf);
+        }
+
+        status = run_vm(vm, 1);
+        if (status != VM_OUT_OF_BUDGET) {
+            break;
+        }
+        if ((word >> 26) == 0x03) {
+            if (depth == cap) {
+                cap *= 2;
+                frames = (uint32_t*) realloc(frames, cap * sizeof(uint32_t));
+                if (!frames) {
+                    allocation_failed();
+                }
+            }
+            frames[depth++] = (vm->pc - vm->base) / 4;
+        } else if (word == 0x03e00008 && depth > 1) {
+            depth--;                        // jr $ra
+        }
+    }
+
+    qsort(table.samples, table.cap, sizeof(Sample), compare_samples);
+    for (uint32_t i = 0; i < table.len; i++) {
+        fprintf(output, "%s %lu\n", table.samples[i].stack,
+            (unsigned long) table.samples[i].count);
+        free(table.samples[i].stack);
+    }
+    free(table.samples);
+    free(buf);
+    free(frames);
+    free(names);
+    return status;
+}
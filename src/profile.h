@@ -0,0 +1,9 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+VmStatus profile_vm(Vm* vm, uint64_t budget, uint32_t every, SymbolTable* symtbl,
+    const uint32_t* lines, FILE* output);
+
+#endif
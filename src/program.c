@@ -0,0 +1,229 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "translate_utils.h"
+#include "program.h"
+
+#define INITIAL_SIZE 16
+#define SCALING_FACTOR 2
+#define LINE_SIZE 1024
+
+static const char* IGNORE_CHARS = " \f\n\r\t\v,()";
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+static char* create_copy_of_str(const char* str) {
+    size_t len = strlen(str) + 1;
+    char* buf = (char*) malloc(len);
+    if (!buf) {
+        allocation_failed();
+    }
+    memcpy(buf, str, len);
+    return buf;
+}
+
+/*******************************
+ * Program Functions
+ *******************************/
+
+/* Creates a new, empty Program. Calls allocation_failed() if memory cannot be
+   allocated.
+ */
+Program* create_program() {
+    Program* prog = (Program*) malloc(sizeof(Program));
+    if (!prog) {
+        allocation_failed();
+    }
+    prog->insts = (Instruction*) malloc(INITIAL_SIZE * sizeof(Instruction));
+    if (!prog->insts) {
+        allocation_failed();
+    }
+    prog->len = 0;
+    prog->cap = INITIAL_SIZE;
+    return prog;
+}
+
+/* Frees the strings owned by INST. */
+void free_inst(Instruction* inst) {
+    free(inst->name);
+    for (int i = 0; i < inst->num_args; i++) {
+        free(inst->args[i]);
+    }
+    inst->name = NULL;
+    inst->num_args = 0;
+}
+
+/* Frees PROG and every instruction in it. */
+void free_program(Program* prog) {
+    if (!prog) {
+        return;
+    }
+    for (uint32_t i = 0; i < prog->len; i++) {
+        free_inst(&prog->insts[i]);
+    }
+    free(prog->insts);
+    free(prog);
+}
+
+/* Replaces the contents of INST with copies of NAME and ARGS. INST must either
+   be uninitialized or have been released with free_inst().
+ */
+void set_inst(Instruction* inst, const char* name, char** args, int num_args) {
+    inst->name = create_copy_of_str(name);
+    inst->num_args = num_args;
+    for (int i = 0; i < num_args; i++) {
+        inst->args[i] = create_copy_of_str(args[i]);
+    }
+}
+
+/* Appends a copy of the instruction NAME ARGS to the end of PROG. */
+void append_inst(Program* prog, const char* name, char** args, int num_args) {
+    if (prog->len == prog->cap) {
+        prog->cap *= SCALING_FACTOR;
+        prog->insts = realloc(prog->insts, prog->cap * sizeof(Instruction));
+        if (!prog->insts) {
+            allocation_failed();
+        }
+    }
+    set_inst(&prog->insts[prog->len], name, args, num_args);
+    prog->insts[prog->len].line = 0;
+    prog->len++;
+}
+
+/* Appends a copy of INST, including its source line, to the end of PROG. */
+void append_copy(Program* prog, const Instruction* inst) {
+    append_inst(prog, inst->name, (char**) inst->args, inst->num_args);
+    prog->insts[prog->len - 1].line = inst->line;
+}
+
+/* Replaces the instructions of PROG with those of NEW_PROG, which is consumed.
+   Passes that build their output as a separate Program use this to hand the
+   result back to the caller in place.
+ */
+void replace_program(Program* prog, Program* new_prog) {
+    for (uint32_t i = 0; i < prog->len; i++) {
+        free_inst(&prog->insts[i]);
+    }
+    free(prog->insts);
+    *prog = *new_prog;
+    free(new_prog);
+}
+
+/* Reads an intermediate file written by pass one. Like pass_two(), this assumes
+   one instruction per line with at most MAX_INST_ARGS arguments; blank lines
+   are skipped.
+ */
+Program* read_program(FILE* input) {
+    Program* prog = create_program();
+    char buf[LINE_SIZE];
+
+    while (fgets(buf, LINE_SIZE, input)) {
+        char* name = strtok(buf, IGNORE_CHARS);
+        if (!name) {
+            continue;
+        }
+        char* args[MAX_INST_ARGS];
+        int num_args = 0;
+        char* token;
+        while (num_args < MAX_INST_ARGS && (token = strtok(NULL, IGNORE_CHARS))) {
+            args[num_args++] = token;
+        }
+        append_inst(prog, name, args, num_args);
+    }
+    return prog;
+}
+
+/* Writes PROG back out in the intermediate format. */
+void write_program(Program* prog, FILE* output) {
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        write_inst_string(output, inst->name, inst->args, inst->num_args);
+    }
+}
+
+/* Returns 1 if A and B are valid names for the same register. */
+int same_reg(const char* a, const char* b) {
+    int ra = translate_reg(a);
+    return ra != -1 && ra == translate_reg(b);
+}
+
+/* Returns 1 if INST is the instruction NAME. */
+int is_inst(const Instruction* inst, const char* name) {
+    return strcmp(inst->name, name) == 0;
+}
+
+/* Returns an array of PROG->len + 1 flags where entry i is set if some label in
+   SYMTBL refers to instruction i (entry PROG->len is for labels at the end of
+   the program). The caller must free the array.
+ */
+uint8_t* find_label_heads(Program* prog, SymbolTable* symtbl) {
+    uint8_t* heads = (uint8_t*) calloc(prog->len + 1, sizeof(uint8_t));
+    if (!heads) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        uint32_t index = symtbl->tbl[i].addr / 4;
+        if (index <= prog->len) {
+            heads[index] = 1;
+        }
+    }
+    return heads;
+}
+
+/* Returns the index of the instruction that LABEL refers to, or -1 if LABEL is
+   not defined in SYMTBL or does not refer to an instruction in PROG.
+ */
+int64_t get_target_index(Program* prog, SymbolTable* symtbl, const char* label) {
+    int64_t addr = get_addr_for_symbol(symtbl, label);
+    if (addr == -1 || addr / 4 > prog->len) {
+        return -1;
+    }
+    return addr / 4;
+}
+
+/* Builds the old-to-new instruction index map for a pass that dropped or
+   inserted instructions without reordering the ones it kept.
+
+   ORIGIN has NEW_LEN entries: ORIGIN[p] is the old index of the instruction now
+   at index p, or NO_ORIGIN if the pass inserted it. An old instruction that was
+   dropped maps to whatever follows it, so a label on it moves to the next
+   surviving instruction. The returned array has OLD_LEN + 1 entries and must be
+   freed by the caller.
+ */
+uint32_t* map_from_origins(const uint32_t* origin, uint32_t new_len, uint32_t old_len) {
+    uint32_t* map = (uint32_t*) malloc((old_len + 1) * sizeof(uint32_t));
+    if (!map) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < old_len; i++) {
+        map[i] = NO_ORIGIN;
+    }
+    for (uint32_t p = new_len; p-- > 0;) {
+        if (origin[p] != NO_ORIGIN && origin[p] < old_len) {
+            map[origin[p]] = p;
+        }
+    }
+    map[old_len] = new_len;
+    for (uint32_t i = old_len; i-- > 0;) {
+        if (map[i] == NO_ORIGIN) {
+            map[i] = map[i + 1];
+        }
+    }
+    return map;
+}
+
+/* Moves every label in SYMTBL that refers to one of the OLD_LEN + 1 positions
+   of the old program to the position given by MAP.
+ */
+void remap_symbols(SymbolTable* symtbl, const uint32_t* map, uint32_t old_len) {
+    for (uint32_t i = 0; i < symtbl->len; i++) {
+        uint32_t index = symtbl->tbl[i].addr / 4;
+        if (index <= old_len) {
+            symtbl->tbl[i].addr = map[index] * 4;
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stdint.h>
+
+#define MAX_INST_ARGS 3
+
+/* Marks an instruction that was inserted by a pass rather than carried over
+   from the program the pass was given. See map_from_origins().
+ */
+#define NO_ORIGIN UINT32_MAX
+
+/* A single instruction of the intermediate file, with its own copies of the
+   name and argument strings.
+ */
+typedef struct {
+    char* name;
+    char* args[MAX_INST_ARGS];
+    int num_args;
+    uint32_t line;          // source line it was written for, 0 if unknown
+} Instruction;
+
+/* The contents of the intermediate file. Instruction i lives at byte offset
+   4 * i, which is how labels in the symbol table refer to it.
+ */
+typedef struct {
+    Instruction* insts;
+    uint32_t len;
+    uint32_t cap;
+} Program;
+
+Program* create_program();
+
+void free_program(Program* prog);
+
+void free_inst(Instruction* inst);
+
+void append_inst(Program* prog, const char* name, char** args, int num_args);
+
+void append_copy(Program* prog, const Instruction* inst);
+
+void set_inst(Instruction* inst, const char* name, char** args, int num_args);
+
+void replace_program(Program* prog, Program* new_prog);
+
+Program* read_program(FILE* input);
+
+void write_program(Program* prog, FILE* output);
+
+int same_reg(const char* a, const char* b);
+
+int is_inst(const Instruction* inst, const char* name);
+
+uint8_t* find_label_heads(Program* prog, SymbolTable* symtbl);
+
+int64_t get_target_index(Program* prog, SymbolTable* symtbl, const char* label);
+
+uint32_t* map_from_origins(const uint32_t* origin, uint32_t new_len, uint32_t old_len);
+
+void remap_symbols(SymbolTable* symtbl, const uint32_t* map, uint32_t old_len);
+
+#endif
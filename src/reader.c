@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "reader.h"
+
+/* A reader for the object files written by pass two:
+
+       .text            one hexadecimal word per line
+       .data            one hexadecimal word per line, if there is data
+       .symbol          "offset\tname" per line
+       .relocation      "offset\tname" per line
+       .base            the -base address in hexadecimal, if one was given
+
+   The whole file is read into one buffer with a single read() and parsed in
+   one pass. Words are decoded through a table of digit values and offsets
+   digit by digit, without strtoul() or sscanf(), and the end of each name is
+   found with memchr() and terminated in place, so that names are used where
+   they lie instead of being copied. Any other section, such as .line, is
+   skipped.
+ */
+
+/* The value of each hexadecimal digit plus one, and 0 for anything else. */
+static const uint8_t hex_digit[256] = {
+    ['0'] = 1, ['1'] = 2, ['2'] = 3, ['3'] = 4, ['4'] = 5,
+    ['5'] = 6, ['6'] = 7, ['7'] = 8, ['8'] = 9, ['9'] = 10,
+    ['a'] = 11, ['b'] = 12, ['c'] = 13, ['d'] = 14, ['e'] = 15, ['f'] = 16,
+    ['A'] = 11, ['B'] = 12, ['C'] = 13, ['D'] = 14, ['E'] = 15, ['F'] = 16,
+};
+
+typedef enum {
+    BEFORE_TEXT,
+    IN_TEXT,
+    IN_DATA,
+    IN_SYMBOLS,
+    IN_RELOCS,
+    IN_BASE,
+    IN_OTHER
+} Section;
+
+/* Makes room for one more element of SIZE bytes in the array ARR of LEN
+   elements, whose capacity is CAP, and returns it.
+ */
+static void* reserve(void* arr, uint32_t len, uint32_t* cap, size_t size) {
+    if (len < *cap) {
+        return arr;
+    }
+    *cap = *cap ? *cap * 2 : 64;
+    arr = realloc(arr, (size_t) *cap * size);
+    if (!arr) {
+        allocation_failed();
+    }
+    return arr;
+}
+
+/* Reads the lines from P on that are a word of 1 to 8 hexadecimal digits,
+   as pass two writes them, into the LEN words of WORDS, whose capacity is
+   CAP. END is the end of the data and holds a NUL. Returns the first line
+   that is not a word, or END.
+ */
+static char* read_words(char* p, char* end, uint32_t** words, uint32_t* len, uint32_t* cap) {
+    while (p < end) {
+        uint32_t value = 0;
+        char* s = p;
+        uint8_t digit;
+        while ((digit = hex_digit[(uint8_t) *s]) != 0 && s - p < 8) {
+            value = (value << 4) | (digit - 1);
+            s++;
+        }
+        char* eol = *s == '\r' ? s + 1 : s;
+        if (s == p || (*eol != '\n' && eol != end)) {
+            return p;
+        }
+        *words = (uint32_t*) reserve(*words, *len, cap, sizeof(uint32_t));
+        (*words)[(*len)++] = value;
+        p = eol + 1;
+    }
+    return end;
+}
+
+/* Reads the lines from P on that are well-formed entries into the LEN
+   entries of ENTRIES, whose capacity is CAP, terminating each name in
+   place. END is the end of the data and holds a NUL. Returns the first line
+   that is not an entry, or END.
+ */
+static char* read_entries(char* p, char* end, TextEntry** entries, uint32_t* len,
+    uint32_t* cap) {
+    while (p < end) {
+        uint64_t value = 0;
+        char* s = p;
+        while (*s >= '0' && *s <= '9' && s - p < 10) {
+            value = value * 10 + (*s++ - '0');
+        }
+        if (s == p || *s != '\t' || value > UINT32_MAX) {
+            return p;
+        }
+        char* name = s + 1;
+        char* eol = (char*) memchr(name, '\n', end - name);
+        if (!eol) {
+            eol = end;
+        }
+        *eol = '\0';
+        if (eol > name && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        *entries = (TextEntry*) reserve(*entries, *len, cap, sizeof(TextEntry));
+        (*entries)[*len].addr = (uint32_t) value;
+        (*entries)[*len].name = name;
+        (*len)++;
+        p = eol + 1;
+    }
+    return end;
+}
+
+/* Parses the SIZE bytes at DATA, an object file written by pass two, into
+   OBJ, using NAME in messages. DATA must have one writable byte past SIZE;
+   it is modified in place and must outlive OBJ, whose names point into it.
+   Returns 0 on success and -1, after logging an error for each malformed
+   word or entry, if there is no .text section or any line of .text, .data,
+   .symbol or .relocation is malformed. OBJ must
+   be passed to free_text_object() either way.
+ */
+int parse_text_object(char* data, size_t size, const char* name, TextObject* obj) {
+    memset(obj, 0, sizeof(TextObject));
+    uint32_t words_cap = 0, data_cap = 0, symbols_cap = 0, relocs_cap = 0;
+    Section section = BEFORE_TEXT;
+    int err = 0;
+
+    char* end = data + size;
+    *end = '\0';
+    for (char* line = data; line < end; ) {
+        /* Runs of words and entries take the fast paths; the line that ends
+           a run is handled below. */
+        if (section == IN_TEXT || section == IN_DATA) {
+            line = section == IN_TEXT
+                ? read_words(line, end, &obj->words, &obj->num_words, &words_cap)
+                : read_words(line, end, &obj->data_words, &obj->num_data_words, &data_cap);
+        } else if (section == IN_SYMBOLS) {
+            line = read_entries(line, end, &obj->symbols, &obj->num_symbols, &symbols_cap);
+        } else if (section == IN_RELOCS) {
+            line = read_entries(line, end, &obj->relocs, &obj->num_relocs, &relocs_cap);
+        } else if (section == IN_BASE) {
+            uint32_t* base = NULL;
+            uint32_t num_base = 0, base_cap = 0;
+            line = read_words(line, end, &base, &num_base, &base_cap);
+            if (num_base != 1) {
+                write_to_log("Error: invalid .base section in %s\n", name);
+                err = 1;
+            } else {
+                obj->has_base = 1;
+                obj->base = base[0];
+            }
+            free(base);
+            section = IN_OTHER;
+        }
+        if (line >= end) {
+            break;
+        }
+
+        char* eol = (char*) memchr(line, '\n', end - line);
+        if (!eol) {
+            eol = end;
+        }
+        *eol = '\0';
+        size_t len = eol - line;
+        if (len > 0 && line[len - 1] == '\r') {
+            line[--len] = '\0';
+        }
+        char* next = eol + 1;
+
+        if (section == BEFORE_TEXT) {
+            if (strncmp(line, ".text", 5) == 0) {
+                section = IN_TEXT;
+            }
+            line = next;
+            continue;
+        }
+        if (len == 0) {
+            /* Blank lines separate sections. */
+        } else if (line[0] == '.') {
+            section = strcmp(line, ".symbol") == 0 ? IN_SYMBOLS
+                : strcmp(line, ".relocation") == 0 ? IN_RELOCS
+                : strcmp(line, ".data") == 0 ? IN_DATA
+                : strcmp(line, ".base") == 0 ? IN_BASE : IN_OTHER;
+        } else if (section != IN_OTHER) {
+            /* Well-formed words and entries were taken by read_words() and
+               read_entries(). */
+            write_to_log("Error: invalid entry in %s: %s\n", name, line);
+            err = 1;
+        }
+        line = next;
+    }
+
+    if (section == BEFORE_TEXT) {
+        write_to_log("Error: no .text section in %s\n", name);
+        return -1;
+    }
+    if (!obj->words) {
+        obj->words = (uint32_t*) malloc(sizeof(uint32_t));
+        if (!obj->words) {
+            allocation_failed();
+        }
+    }
+    return err ? -1 : 0;
+}
+
+/* Reads the object file NAME with one read() into a buffer owned by OBJ and
+   parses it with parse_text_object(). Returns 0 on success and -1, after
+   logging an error, if it cannot be read or is malformed. OBJ must be
+   passed to free_text_object() either way.
+ */
+int load_text_object(const char* name, TextObject* obj) {
+    memset(obj, 0, sizeof(TextObject));
+    int fd = open(name, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        write_to_log("Error: unable to open object file: %s\n", name);
+        return -1;
+    }
+    size_t size = st.st_size;
+    char* data = (char*) malloc(size + 1);
+    if (!data) {
+        allocation_failed();
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = read(fd, data + done, size - done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    close(fd);
+    if (done < size) {
+        free(data);
+        write_to_log("Error: unable to read object file: %s\n", name);
+        return -1;
+    }
+    int err = parse_text_object(data, size, name, obj);
+    obj->data = data;
+    return err;
+}
+
+void free_text_object(TextObject* obj) {
+    free(obj->data);
+    free(obj->words);
+    free(obj->data_words);
+    free(obj->symbols);
+    free(obj->relocs);
+    memset(obj, 0, sizeof(TextObject));
+}
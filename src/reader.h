@@ -0,0 +1,36 @@
+#ifndef READER_H
+#define READER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* One line of a .symbol or .relocation section. The name points into the
+   buffer that was parsed and lives as long as it does.
+ */
+typedef struct {
+    uint32_t addr;
+    const char* name;
+} TextEntry;
+
+/* An object file written by pass two, as parsed by parse_text_object(). */
+typedef struct {
+    char* data;             // the file, if read by load_text_object()
+    uint32_t* words;        // .text
+    uint32_t num_words;
+    uint32_t* data_words;   // .data, if the program has one
+    uint32_t num_data_words;
+    TextEntry* symbols;     // .symbol
+    uint32_t num_symbols;
+    TextEntry* relocs;      // .relocation
+    uint32_t num_relocs;
+    int has_base;           // .base, written under -base
+    uint32_t base;
+} TextObject;
+
+int parse_text_object(char* data, size_t size, const char* name, TextObject* obj);
+
+int load_text_object(const char* name, TextObject* obj);
+
+void free_text_object(TextObject* obj);
+
+#endif
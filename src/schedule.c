@@ -0,0 +1,321 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate.h"
+#include "program.h"
+#include "cfg.h"
+#include "hazards.h"
+#include "schedule.h"
+
+/*******************************
+ * Helper Functions
+ *******************************/
+
+/* Returns 1 if A and B can be executed in either order: neither writes a
+   register that the other reads or writes.
+ */
+static int independent(const InstEffects* a, const InstEffects* b) {
+    return !(a->def & (b->def | b->use)) && !(a->use & b->def);
+}
+
+/*******************************
+ * Delay Slots
+ *******************************/
+
+/* Gives every beq, bne, j, jal and jr in PROG a branch delay slot. The
+   instruction just before the branch is moved into the slot when that does
+   not change what either of them computes; otherwise a nop is inserted. The
+   instruction is left in place if a label refers to it or to the branch, if
+   it transfers control itself or if it already fills the slot of an earlier
+   branch. Labels in SYMTBL are moved along with the code.
+
+   Stores the number of nops inserted in NOPS and returns the number of slots
+   filled with a useful instruction. Leaves PROG unchanged and returns 0 if
+   the inserted nops would put a branch out of range.
+ */
+uint32_t fill_delay_slots(Program* prog, SymbolTable* symtbl, uint32_t* nops) {
+    uint8_t* is_head = find_label_heads(prog, symtbl);
+    uint32_t cap = prog->len * 2 + 1;
+    uint32_t* origin = (uint32_t*) malloc(cap * sizeof(uint32_t));
+    uint8_t* in_slot = (uint8_t*) calloc(cap, sizeof(uint8_t));
+    if (!origin || !in_slot) {
+        allocation_failed();
+    }
+
+    char* nop_args[] = { "$0", "$0", "0" };
+    uint32_t filled = 0;
+    *nops = 0;
+    Program* out = create_program();
+    for (uint32_t i = 0; i < prog->len; i++) {
+        Instruction* inst = &prog->insts[i];
+        if (!ends_block(inst)) {
+            origin[out->len] = i;
+            append_copy(out, inst);
+            continue;
+        }
+
+        InstEffects branch, prev;
+        int movable = 0;
+        if (i > 0 && out->len > 0 && !is_head[i] && !is_head[i - 1]
+            && origin[out->len - 1] == i - 1 && !in_slot[out->len - 1]) {
+            Instruction* cand = &prog->insts[i - 1];
+            movable = !ends_block(cand)
+                && get_inst_effects(inst->name, inst->args, inst->num_args, &branch) == 0
+                && get_inst_effects(cand->name, cand->args, cand->num_args, &prev) == 0
+                && independent(&prev, &branch);
+        }
+
+        if (movable) {
+            Instruction* cand = &prog->insts[i - 1];
+            out->len--;
+            free_inst(&out->insts[out->len]);
+            origin[out->len] = i;
+            append_copy(out, inst);
+            origin[out->len] = i - 1;
+            append_copy(out, cand);
+            filled++;
+        } else {
+            origin[out->len] = i;
+            append_copy(out, inst);
+            origin[out->len] = NO_ORIGIN;
+            append_inst(out, "sll", nop_args, 3);
+            (*nops)++;
+        }
+        in_slot[out->len - 1] = 1;
+    }
+
+    uint32_t old_len = prog->len;
+    uint32_t* map = map_from_origins(origin, out->len, old_len);
+    if (branches_in_range(prog, symtbl, map)) {
+        remap_symbols(symtbl, map, old_len);
+        replace_program(prog, out);
+    } else {
+        write_to_log("Warning: filling delay slots would put a branch out of range; "
+            "leaving branches unchanged\n");
+        free_program(out);
+        filled = 0;
+        *nops = 0;
+    }
+    free(map);
+    free(in_slot);
+    free(origin);
+    free(is_head);
+    return filled;
+}
+
+/*******************************
+ * List Scheduling
+ *******************************/
+
+/* Scheduling is quadratic in the block length or worse, so long blocks are
+   cut into windows of this many instructions.
+ */
+#define SCHEDULE_WINDOW 128
+
+/* One instruction of the block being scheduled. */
+typedef struct {
+    InstEffects effects;
+    int known;              // get_inst_effects() understood the instruction
+    int is_load;
+    uint32_t latency;       // cycles until HI and LO are ready, for mult and div
+    int is_branch;          // beq or bne, which reads its operands a stage early
+} SchedNode;
+
+/* Returns the number of cycles that must separate the issue of node B from
+   that of an earlier node A, or 0 if B does not depend on A and the two may
+   be issued in either order. Register dependences of every kind are
+   respected, including those on $at left by pseudo-instruction expansions,
+   and so are stores against any other memory access. Instructions that
+   get_inst_effects() does not understand are ordered against everything.
+ */
+static uint32_t dependence(const SchedNode* a, const SchedNode* b) {
+    if (!a->known || !b->known) {
+        return 1;
+    }
+    uint64_t raw = a->effects.def & b->effects.use;
+    if (raw) {
+        if (raw & (((uint64_t) 1 << REG_HI) | ((uint64_t) 1 << REG_LO))) {
+            return a->latency;
+        }
+        return (a->is_load ? 2 : 1) + (b->is_branch ? 1 : 0);
+    }
+    if ((a->effects.use & b->effects.def) || (a->effects.def & b->effects.def)) {
+        return 1;
+    }
+    if ((a->effects.writes_mem && (b->effects.reads_mem || b->effects.writes_mem))
+        || (a->effects.reads_mem && b->effects.writes_mem)) {
+        return 1;
+    }
+    return 0;
+}
+
+/* Returns the cycles needed to issue the N nodes in the order given by
+   ORDER on a single-issue pipeline that stalls until operands are ready.
+   DEP[i * N + j] is the dependence of node j on node i.
+ */
+static uint64_t count_cycles(const uint32_t* dep, const uint32_t* order, uint32_t n,
+    uint64_t* issued) {
+    uint64_t cycle = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        uint32_t j = order[k];
+        uint64_t issue = cycle;
+        for (uint32_t m = 0; m < k; m++) {
+            uint32_t i = order[m];
+            if (dep[i * n + j] && issued[i] + dep[i * n + j] > issue) {
+                issue = issued[i] + dep[i * n + j];
+            }
+        }
+        issued[j] = issue;
+        cycle = issue + 1;
+    }
+    return cycle;
+}
+
+/* Reorders the N instructions of PROG starting at index START. A beq, bne,
+   j, jal or jr at the end of the range stays last. Returns the number of
+   cycles saved, which is 0 if the range was left as it was.
+ */
+static uint64_t schedule_block(Program* prog, uint32_t start, uint32_t n) {
+    SchedNode* nodes = (SchedNode*) malloc(n * sizeof(SchedNode));
+    uint32_t* dep = (uint32_t*) calloc((size_t) n * n, sizeof(uint32_t));
+    uint64_t* height = (uint64_t*) calloc(n, sizeof(uint64_t));
+    uint64_t* issued = (uint64_t*) malloc(n * sizeof(uint64_t));
+    uint32_t* order = (uint32_t*) malloc(n * sizeof(uint32_t));
+    uint8_t* done = (uint8_t*) calloc(n, sizeof(uint8_t));
+    if (!nodes || !dep || !height || !issued || !order || !done) {
+        allocation_failed();
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        Instruction* inst = &prog->insts[start + i];
+        SchedNode* node = &nodes[i];
+        node->known = get_inst_effects(inst->name, inst->args, inst->num_args,
+            &node->effects) == 0;
+        node->is_load = node->effects.reads_mem;
+        node->latency = is_inst(inst, "div") ? DIV_LATENCY : MULT_LATENCY;
+        node->is_branch = is_cond_branch(inst);
+    }
+    int has_exit = ends_block(&prog->insts[start + n - 1]);
+    for (uint32_t j = 0; j < n; j++) {
+        for (uint32_t i = 0; i < j; i++) {
+            dep[i * n + j] = dependence(&nodes[i], &nodes[j]);
+            if (has_exit && j == n - 1 && !dep[i * n + j]) {
+                dep[i * n + j] = 1;
+            }
+        }
+    }
+    for (uint32_t i = n; i-- > 0;) {
+        for (uint32_t j = i + 1; j < n; j++) {
+            if (dep[i * n + j] && height[j] + dep[i * n + j] > height[i]) {
+                height[i] = height[j] + dep[i * n + j];
+            }
+        }
+    }
+
+    /* Issue the highest node whose operands are ready, or if none are, the
+       one that becomes ready first. */
+    uint64_t cycle = 0;
+    for (uint32_t k = 0; k < n; k++) {
+        int64_t best = -1;
+        uint64_t best_ready = 0;
+        for (uint32_t j = 0; j < n; j++) {
+            if (done[j]) {
+                continue;
+            }
+            int ok = 1;
+            uint64_t ready = cycle;
+            for (uint32_t i = 0; i < j && ok; i++) {
+                if (dep[i * n + j]) {
+                    if (!done[i]) {
+                        ok = 0;
+                    } else if (issued[i] + dep[i * n + j] > ready) {
+                        ready = issued[i] + dep[i * n + j];
+                    }
+                }
+            }
+            if (!ok) {
+                continue;
+            }
+            if (best == -1 || ready < best_ready
+                || (ready == best_ready && height[j] > height[best])) {
+                best = j;
+                best_ready = ready;
+            }
+        }
+        order[k] = best;
+        done[best] = 1;
+        issued[best] = best_ready;
+        cycle = best_ready + 1;
+    }
+    uint64_t scheduled = cycle;
+
+    uint64_t saved = 0;
+    uint32_t* identity = (uint32_t*) malloc(n * sizeof(uint32_t));
+    if (!identity) {
+        allocation_failed();
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        identity[i] = i;
+    }
+    uint64_t original = count_cycles(dep, identity, n, issued);
+    if (scheduled < original) {
+        Instruction* insts = (Instruction*) malloc(n * sizeof(Instruction));
+        if (!insts) {
+            allocation_failed();
+        }
+        for (uint32_t k = 0; k < n; k++) {
+            insts[k] = prog->insts[start + order[k]];
+        }
+        memcpy(&prog->insts[start], insts, n * sizeof(Instruction));
+        free(insts);
+        saved = original - scheduled;
+    }
+
+    free(identity);
+    free(done);
+    free(order);
+    free(issued);
+    free(height);
+    free(dep);
+    free(nodes);
+    return saved;
+}
+
+/* Reorders the instructions within each basic block of PROG so that loads
+   are separated from the first use of their result and mult and div from
+   the mfhi or mflo that reads it, using the latencies of the pipeline model
+   in hazards.c. Register and memory dependences are preserved (see
+   dependence()) and the branch or jump that ends a block stays last. Labels
+   in SYMTBL only refer to the start of a block, so none of them move. Long
+   blocks are scheduled in windows of SCHEDULE_WINDOW instructions, and each
+   window is only rewritten if its estimated cycle count goes down.
+
+   Stores the number of blocks rewritten in BLOCKS and returns the estimated
+   number of cycles saved over one pass through every block.
+ */
+uint64_t schedule_blocks(Program* prog, SymbolTable* symtbl, uint32_t* blocks) {
+    ControlFlowGraph* cfg = build_cfg(prog, symtbl);
+    uint64_t saved = 0;
+    *blocks = 0;
+    for (uint32_t b = 0; b < cfg->len; b++) {
+        BasicBlock* block = &cfg->blocks[b];
+        int changed = 0;
+        for (uint32_t start = block->start; start < block->end; start += SCHEDULE_WINDOW) {
+            uint32_t n = block->end - start;
+            if (n > SCHEDULE_WINDOW) {
+                n = SCHEDULE_WINDOW;
+            }
+            uint64_t s = n > 1 ? schedule_block(prog, start, n) : 0;
+            if (s > 0) {
+                saved += s;
+                changed = 1;
+            }
+        }
+        *blocks += changed;
+    }
+    free_cfg(cfg);
+    return saved;
+}
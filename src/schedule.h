@@ -0,0 +1,10 @@
+#ifndef SCHEDULE_H
+#define SCHEDULE_H
+
+#include <stdint.h>
+
+uint64_t schedule_blocks(Program* prog, SymbolTable* symtbl, uint32_t* blocks);
+
+uint32_t fill_delay_slots(Program* prog, SymbolTable* symtbl, uint32_t* nops);
+
+#endif
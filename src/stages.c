@@ -0,0 +1,324 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate_utils.h"
+#include "translate.h"
+#include "program.h"
+#include "peephole.h"
+#include "cfg.h"
+#include "layout.h"
+#include "icf.h"
+#include "schedule.h"
+#include "decode.h"
+#include "hazards.h"
+#include "vm.h"
+#include "jit.h"
+#include "trace.h"
+#include "profile.h"
+#include "data.h"
+#include "binary.h"
+#include "reader.h"
+#include "disasm.h"
+#include "stages.h"
+
+/* The optional stages that assemble() runs around the two passes, as selected
+   by the options on the command line: rewriting the intermediate file after
+   pass one, and writing, checking and running the object after pass two.
+ */
+
+/*******************************
+ * After Pass One
+ *******************************/
+
+/* Appends COUNT entries of LINE to TABLE. */
+void record_lines(LineTable* table, uint32_t line, unsigned count) {
+    if (table->len + count > table->cap) {
+        table->cap = (table->len + count) * 2;
+        table->lines = (uint32_t*) realloc(table->lines, table->cap * sizeof(uint32_t));
+        if (!table->lines) {
+            allocation_failed();
+        }
+    }
+    for (unsigned i = 0; i < count; i++) {
+        table->lines[table->len++] = line;
+    }
+}
+
+/* Returns 1 if any of the stages run by optimize_intermediate() are enabled. */
+int rewrites_intermediate(const AssemblerOptions* options) {
+    return options->optimize || options->fold_functions || options->reorder_functions
+        || options->schedule || options->fill_delay_slots || options->align_loops;
+}
+
+/* Runs the stages enabled in OPTIONS that rewrite the intermediate file
+   TMP_NAME in place after pass one. Labels in SYMTBL and the source lines in
+   LINES are moved along with the code.
+   Returns 0 on success and -1 if the file could not be rewritten.
+ */
+int optimize_intermediate(const char* tmp_name, SymbolTable* symtbl,
+    const AssemblerOptions* options, LineTable* lines) {
+    FILE* f = fopen(tmp_name, "r");
+    if (!f) {
+        write_to_log("Error: unable to open intermediate file: %s\n", tmp_name);
+        return -1;
+    }
+    Program* prog = read_program(f);
+    fclose(f);
+    for (uint32_t i = 0; i < prog->len; i++) {
+        prog->insts[i].line = i < lines->len ? lines->lines[i] : 0;
+    }
+
+    if (options->optimize) {
+        uint32_t removed = peephole_optimize(prog, symtbl);
+        printf("Peephole optimizer removed %u words\n", removed);
+        uint32_t threaded = thread_jumps(prog, symtbl, &removed);
+        printf("Jump threading retargeted %u jumps and removed %u words\n",
+            threaded, removed);
+    }
+    if (options->fold_functions) {
+        uint32_t folded;
+        uint32_t saved = fold_identical_functions(prog, symtbl, &folded);
+        printf("Identical code folding merged %u functions and saved %u bytes\n",
+            folded, saved);
+    }
+    if (options->reorder_functions) {
+        LayoutStats stats;
+        if (reorder_functions(prog, symtbl, options->call_profile, &stats) != 0) {
+            free_program(prog);
+            return -1;
+        }
+        printf("Function reordering moved %u functions, call distance %lu -> %lu words\n",
+            stats.moved, (unsigned long) stats.distance_before,
+            (unsigned long) stats.distance_after);
+    }
+    if (options->schedule) {
+        uint32_t blocks;
+        uint64_t saved = schedule_blocks(prog, symtbl, &blocks);
+        printf("Scheduling reordered %u blocks, saving an estimated %lu cycles\n",
+            blocks, (unsigned long) saved);
+    }
+    if (options->fill_delay_slots) {
+        uint32_t nops;
+        uint32_t filled = fill_delay_slots(prog, symtbl, &nops);
+        printf("Delay slot filling moved %u instructions and inserted %u nops\n",
+            filled, nops);
+    }
+    if (options->align_loops) {
+        uint32_t loops;
+        uint32_t padding = align_loops(prog, symtbl, options->align_loops, &loops);
+        printf("Loop alignment found %u loops and spent %u bytes of padding\n",
+            loops, padding);
+    }
+
+    f = fopen(tmp_name, "w");
+    if (!f) {
+        write_to_log("Error: unable to open intermediate file: %s\n", tmp_name);
+        free_program(prog);
+        return -1;
+    }
+    write_program(prog, f);
+    fclose(f);
+    lines->len = 0;
+    for (uint32_t i = 0; i < prog->len; i++) {
+        record_lines(lines, prog->insts[i].line, 1);
+    }
+    free_program(prog);
+    return 0;
+}
+
+/*******************************
+ * After Pass Two
+ *******************************/
+
+/* Returns 1 if OPTIONS execute the program after pass two. */
+int executes_program(const AssemblerOptions* options) {
+    return options->run || options->jit || options->trace || options->profile;
+}
+
+/* Writes the source line table LINES to OUTPUT as "offset<TAB>line" entries, one
+   for each word whose line differs from the word before it, so that a word's
+   line is that of the nearest entry at or before its byte offset. Nothing is
+   written unless the table covers exactly the LEN words of the text.
+ */
+void write_line_table(FILE* output, const LineTable* lines, uint32_t len) {
+    if (lines->len != len) {
+        return;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        if (i == 0 || lines->lines[i] != lines->lines[i - 1]) {
+            fprintf(output, "%u\t%u\n", i * 4, lines->lines[i]);
+        }
+    }
+}
+
+/* Writes the text in TEXT and the tables SYMTBL and RELTBL to the file NAME
+   in the binary object format of binary.c, with the -base address in
+   OPTIONS. The format has no place for DATA, which must be empty.
+   Returns 0 on success and -1 otherwise.
+ */
+int write_binary_file(const char* name, WordBuffer* text, SymbolTable* symtbl,
+    SymbolTable* reltbl, const DataImage* data, const AssemblerOptions* options) {
+    if (data->len > 0) {
+        write_to_log("Error: binary objects cannot hold a .data section: %s\n", name);
+        return -1;
+    }
+    FILE* f = fopen(name, "wb");
+    if (!f) {
+        write_to_log("Error: unable to open binary object file: %s\n", name);
+        return -1;
+    }
+    int err = write_binary_object(f, text->words, text->len, symtbl, reltbl,
+        options->has_base, options->base);
+    if (fclose(f) != 0 || err) {
+        write_to_log("Error: unable to write binary object file: %s\n", name);
+        return -1;
+    }
+    return 0;
+}
+
+/* Disassembles the words of TEXT written by pass two, timing it, and then
+   checks that each line assembles back to the same word, with jumps to the
+   labels in EXPORTED relocated as under the -base in OPTIONS. Returns 0 if
+   every word does and -1 otherwise.
+ */
+int verify_text(WordBuffer* text, SymbolTable* symtbl, SymbolTable* reltbl,
+    SymbolTable* exported, const AssemblerOptions* options) {
+    Disassembler* dis = create_disassembler(text->len, symtbl, reltbl, options->base);
+    char line[1024];
+    uint32_t decoded = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (uint32_t i = 0; i < text->len; i++) {
+        decoded += disassemble_word(dis, text->words[i], i * 4, line, sizeof(line)) >= 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Disassembled %u of %u words in %.3f s (%.1f M words/s)\n", decoded, text->len,
+        seconds, seconds > 0 ? text->len / seconds / 1e6 : 0.0);
+
+    if (options->has_base) {
+        resolve_local_jumps(1, options->base, exported);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    uint32_t mismatches = verify_words(dis, text->words, text->len, symtbl);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    resolve_local_jumps(0, 0, NULL);
+    seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("Verified %u words by reassembly in %.3f s: %u mismatched\n", text->len,
+        seconds, mismatches);
+    free_disassembler(dis);
+    return mismatches ? -1 : 0;
+}
+
+/* Reads back the .text section of the object file OUT_NAME and prints the
+   estimated pipeline stalls for each label in SYMTBL. Returns 0 on success
+   and -1 if the file could not be read.
+ */
+int report_hazards(const char* out_name, SymbolTable* symtbl) {
+    TextObject text;
+    if (load_text_object(out_name, &text) != 0) {
+        free_text_object(&text);
+        return -1;
+    }
+
+    uint32_t num_stats;
+    HazardStats* stats = analyze_hazards(text.words, text.num_words, symtbl, &num_stats);
+    print_hazard_report(stats, num_stats, stdout);
+    free(stats);
+    free_text_object(&text);
+    return 0;
+}
+
+/* Executes the LEN words in WORDS written by pass two, resolving the jumps in
+   RELTBL against SYMTBL, and prints how it ended, its speed in millions of
+   instructions per second and every register that is not zero. Uses the
+   translator in jit.c if -jit was given and it is supported here, and the
+   models in trace.c if -trace was, in which case their report is printed
+   too. With -profile, samples the call stack through profile.c instead and
+   writes the folded stacks to the file given, attributed to the source
+   lines in LINES. DATA is loaded as the .data section. Returns 0 if the
+   program halted within the budget in OPTIONS and -1 otherwise.
+ */
+int run_program(const uint32_t* words, uint32_t len, SymbolTable* symtbl,
+    SymbolTable* reltbl, const DataImage* data, const LineTable* lines,
+    const AssemblerOptions* options) {
+    Vm* vm = create_vm(words, len, symtbl, reltbl, options->base);
+    if (!vm) {
+        return -1;
+    }
+    if (data->len > 0 && load_vm_data(vm, data->bytes, data->len) != 0) {
+        free_vm(vm);
+        return -1;
+    }
+
+    Jit* jit = NULL;
+    if (options->jit) {
+        jit = create_jit(vm);
+        if (!jit) {
+            write_to_log("Warning: -jit is not supported here; interpreting instead\n");
+        }
+    }
+
+    TraceCounts* counts = NULL;
+    if (options->trace) {
+        counts = (TraceCounts*) calloc(len + 1, sizeof(TraceCounts));
+        if (!counts) {
+            allocation_failed();
+        }
+    }
+
+    FILE* profile = NULL;
+    if (options->profile) {
+        profile = fopen(options->profile, "w");
+        if (!profile) {
+            write_to_log("Error: unable to open %s\n", options->profile);
+            free(counts);
+            free_jit(jit);
+            free_vm(vm);
+            return -1;
+        }
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    VmStatus status;
+    if (profile) {
+        const uint32_t* line_of = lines->len == len ? lines->lines : NULL;
+        status = profile_vm(vm, options->budget, options->sample_every, symtbl, line_of, profile);
+        fclose(profile);
+    } else if (counts) {
+        status = trace_vm(vm, options->budget, &options->trace_config, counts);
+    } else {
+        status = jit ? run_jit(jit, options->budget) : run_vm(vm, options->budget);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    if (status == VM_HALTED) {
+        printf("Program halted after %lu instructions\n", (unsigned long) vm->executed);
+    } else if (status == VM_OUT_OF_BUDGET) {
+        write_to_log("Error: program did not halt within %lu instructions, at 0x%08x\n",
+            (unsigned long) options->budget, vm->pc);
+    } else {
+        write_to_log("Error: program faulted at 0x%08x: %s\n", vm->pc, vm->fault);
+    }
+    printf("Executed %lu instructions in %.3f s (%.1f MIPS)\n",
+        (unsigned long) vm->executed, seconds,
+        seconds > 0 ? vm->executed / seconds / 1e6 : 0.0);
+    for (int i = 1; i < 32; i++) {
+        if (vm->regs[i] != 0) {
+            printf("  %-5s = 0x%08x (%d)\n", reg_name(i), vm->regs[i], (int32_t) vm->regs[i]);
+        }
+    }
+    if (counts) {
+        print_trace_report(vm, symtbl, &options->trace_config, counts, stdout);
+        free(counts);
+    }
+    free_jit(jit);
+    free_vm(vm);
+    return status == VM_HALTED ? 0 : -1;
+}
@@ -0,0 +1,68 @@
+#ifndef STAGES_H
+#define STAGES_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+/* Optional stages selected on the command line. */
+typedef struct {
+    int optimize;           // -O: run the peephole optimizer and jump threading
+    int fold_functions;     // -icf: merge functions with identical bodies
+    int reorder_functions;  // -reorder-functions: lay out callers next to callees
+    char* call_profile;     // -call-profile: call counts for -reorder-functions
+    int schedule;           // -schedule: reorder blocks around load and mult latency
+    int fill_delay_slots;   // -fill-delay-slots: give branches a delay slot
+    uint32_t align_loops;   // -align-loops=N: pad loop heads to N bytes, 0 if off
+    int analyze_hazards;    // -analyze-hazards: report pipeline stalls after pass two
+    int verify;             // -verify: disassemble and reassemble every word after pass two
+    int run;                // -run: execute the program after pass two
+    int jit;                // -jit: execute it with translated x86-64 code instead
+    int trace;              // -trace: execute it through the cache and predictor models
+    TraceConfig trace_config;   // -icache, -dcache, -predictor
+    int lines;              // -lines: add a .line section to the output
+    char* profile;          // -profile: write sampled folded stacks to this file
+    uint32_t sample_every;  // -sample-every=N: instructions between samples
+    unsigned jobs;          // -jobs N: worker processes for -batch, 0 for one per core
+    unsigned threads;       // -threads N: patching threads for -link, 0 for one per core
+    int time_link;          // -time: print how long -link took to patch relocations
+    uint64_t budget;        // -budget N: instructions -batch and -run programs may execute
+    char* binary;           // -binary: also write the object in binary form to this file
+    int has_base;           // -base ADDR: resolve local jumps for text loaded at ADDR
+    uint32_t base;
+} AssemblerOptions;
+
+/* The source line of each instruction written to the intermediate file.
+   pass_one() fills it in and optimize_intermediate() keeps it in step with
+   the instructions, so that entry i is the line word i of the output was
+   assembled from. Empty when pass one did not run in this process.
+ */
+typedef struct {
+    uint32_t* lines;
+    uint32_t len;
+    uint32_t cap;
+} LineTable;
+
+void record_lines(LineTable* table, uint32_t line, unsigned count);
+
+int rewrites_intermediate(const AssemblerOptions* options);
+
+int optimize_intermediate(const char* tmp_name, SymbolTable* symtbl,
+    const AssemblerOptions* options, LineTable* lines);
+
+int executes_program(const AssemblerOptions* options);
+
+void write_line_table(FILE* output, const LineTable* lines, uint32_t len);
+
+int write_binary_file(const char* name, WordBuffer* text, SymbolTable* symtbl,
+    SymbolTable* reltbl, const DataImage* data, const AssemblerOptions* options);
+
+int verify_text(WordBuffer* text, SymbolTable* symtbl, SymbolTable* reltbl,
+    SymbolTable* exported, const AssemblerOptions* options);
+
+int report_hazards(const char* out_name, SymbolTable* symtbl);
+
+int run_program(const uint32_t* words, uint32_t len, SymbolTable* symtbl,
+    SymbolTable* reltbl, const DataImage* data, const LineTable* lines,
+    const AssemblerOptions* options);
+
+#endif
@@ -0,0 +1,100 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tables.h"
+#include "symmap.h"
+
+/* A hash map from symbol names to addresses, for tables too large for the
+   linear search in tables.c. Open addressing with linear probing, keyed on
+   FNV-1a, and kept at most half full.
+ */
+
+/* FNV-1a over the bytes of NAME. */
+uint64_t hash_name(const char* name) {
+    uint64_t hash = 14695981039346656037ULL;
+    for (const char* c = name; *c; c++) {
+        hash ^= (uint8_t) *c;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/* Returns the slot holding NAME, whose hash is HASH, in SLOTS, or the empty
+   slot where it would go.
+ */
+static MapEntry* probe(MapEntry* slots, uint32_t cap, const char* name, uint32_t hash) {
+    uint32_t i = hash & (cap - 1);
+    while (slots[i].name && (slots[i].hash != hash || strcmp(slots[i].name, name) != 0)) {
+        i = (i + 1) & (cap - 1);
+    }
+    return &slots[i];
+}
+
+/* Creates an empty map with room for EXPECTED names before it has to grow. */
+SymbolMap* create_symbol_map(uint32_t expected) {
+    SymbolMap* map = (SymbolMap*) malloc(sizeof(SymbolMap));
+    if (!map) {
+        allocation_failed();
+    }
+    map->len = 0;
+    map->cap = 16;
+    while (map->cap < expected * 2) {
+        map->cap *= 2;
+    }
+    map->slots = (MapEntry*) calloc(map->cap, sizeof(MapEntry));
+    if (!map->slots) {
+        allocation_failed();
+    }
+    return map;
+}
+
+void free_symbol_map(SymbolMap* map) {
+    if (!map) {
+        return;
+    }
+    free(map->slots);
+    free(map);
+}
+
+/* Adds NAME, defined at ADDR by OWNER, to MAP unless it is already there.
+   Sets INSERTED to 1 if it was added and 0 if not, and returns the entry for
+   NAME either way, so that a duplicate definition can be reported against
+   the first.
+ */
+MapEntry* insert_symbol(SymbolMap* map, const char* name, uint32_t addr, uint32_t owner,
+    int* inserted) {
+    if ((map->len + 1) * 2 > map->cap) {
+        uint32_t cap = map->cap * 2;
+        MapEntry* slots = (MapEntry*) calloc(cap, sizeof(MapEntry));
+        if (!slots) {
+            allocation_failed();
+        }
+        for (uint32_t i = 0; i < map->cap; i++) {
+            if (map->slots[i].name) {
+                *probe(slots, cap, map->slots[i].name, map->slots[i].hash) = map->slots[i];
+            }
+        }
+        free(map->slots);
+        map->slots = slots;
+        map->cap = cap;
+    }
+
+    uint32_t hash = (uint32_t) hash_name(name);
+    MapEntry* entry = probe(map->slots, map->cap, name, hash);
+    *inserted = entry->name == NULL;
+    if (*inserted) {
+        entry->name = name;
+        entry->hash = hash;
+        entry->addr = addr;
+        entry->owner = owner;
+        map->len++;
+    }
+    return entry;
+}
+
+/* Returns the entry for NAME in MAP, or NULL if it is not defined. */
+const MapEntry* find_symbol(const SymbolMap* map, const char* name) {
+    const MapEntry* entry = probe(map->slots, map->cap, name, (uint32_t) hash_name(name));
+    return entry->name ? entry : NULL;
+}
@@ -0,0 +1,33 @@
+#ifndef SYMMAP_H
+#define SYMMAP_H
+
+#include <stdint.h>
+
+/* One definition in a SymbolMap. The name is not copied and must outlive
+   the map.
+ */
+typedef struct {
+    const char* name;       // NULL for an empty slot
+    uint32_t addr;
+    uint32_t owner;         // caller-defined, e.g. the defining object
+    uint32_t hash;          // low bits of hash_name(name), checked before strcmp()
+} MapEntry;
+
+typedef struct {
+    MapEntry* slots;
+    uint32_t len;
+    uint32_t cap;           // a power of two
+} SymbolMap;
+
+uint64_t hash_name(const char* name);
+
+SymbolMap* create_symbol_map(uint32_t expected);
+
+void free_symbol_map(SymbolMap* map);
+
+MapEntry* insert_symbol(SymbolMap* map, const char* name, uint32_t addr, uint32_t owner,
+    int* inserted);
+
+const MapEntry* find_symbol(const SymbolMap* map, const char* name);
+
+#endif
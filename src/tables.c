@@ -85,6 +85,34 @@ static char* create_copy_of_str(const char* str) {
     return buf;
 }
 
+/* Stores NAME and ADDR at the end of TABLE, after checking for a duplicate
+   name if the table's mode requires it. Returns 0 on success and -1 if NAME
+   is already taken.
+ */
+static int append_symbol(SymbolTable* table, const char* name, uint32_t addr) {
+    if (table->mode == SYMTBL_UNIQUE_NAME) {
+        for(int i = 0; i<table->len; i++) {
+            if (strcmp(table->tbl[i].name, name) == 0) {
+                name_already_exists(name);
+                return -1;
+            }
+        }
+    }
+    if (table->len == table->cap) {
+        table->tbl = realloc(table->tbl, table->len*SCALING_FACTOR*sizeof(Symbol)); 
+        if (!table->tbl) {
+            allocation_failed();
+        }
+        table->cap *= SCALING_FACTOR;
+    }
+    Symbol * mapping = &(table->tbl[table->len]);
+    mapping->name = create_copy_of_str(name);
+    mapping->addr = addr;
+    table->tbl[table->len] = *mapping;
+    table->len += 1;
+    return 0;
+}
+
 /* Adds a new symbol and its address to the SymbolTable pointed to by TABLE. 
    ADDR is given as the byte offset from the first instruction. The SymbolTable
    must be able to resize itself as more elements are added. 
@@ -107,27 +135,18 @@ int add_to_table(SymbolTable* table, const char* name, uint32_t addr) {
         addr_alignment_incorrect();
         return -1;
     }
-    if (table->mode == SYMTBL_UNIQUE_NAME) {
-        for(int i = 0; i<table->len; i++) {
-            if (strcmp(table->tbl[i].name, name) == 0) {
-                name_already_exists(name);
-                return -1;
-            }
-        }
-    }
-    if (table->len == table->cap) {
-        table->tbl = realloc(table->tbl, table->len*SCALING_FACTOR*sizeof(Symbol)); 
-        if (!table->tbl) {
-            allocation_failed();
-        }
-        table->cap *= SCALING_FACTOR;
+    return append_symbol(table, name, addr);
+}
+
+/* Adds the data label NAME at ADDR to TABLE like add_to_table(), except that
+   ADDR may be any byte address, since a label may name a byte or a string in
+   the data section.
+ */
+int add_data_to_table(SymbolTable* table, const char* name, uint32_t addr) {
+    if (!table || !name || !table->tbl) {
+        return -1;
     }
-    Symbol * mapping = &(table->tbl[table->len]);
-    mapping->name = create_copy_of_str(name);
-    mapping->addr = addr;
-    table->tbl[table->len] = *mapping;
-    table->len += 1;
-    return 0;
+    return append_symbol(table, name, addr);
 }
 
 /* Returns the address (byte offset) of the given symbol. If a symbol with name
@@ -42,6 +42,8 @@ void free_table(SymbolTable* table);
 /* IMPLEMENT ME - see documentation in tables.c */
 int add_to_table(SymbolTable* table, const char* name, uint32_t addr);
 
+int add_data_to_table(SymbolTable* table, const char* name, uint32_t addr);
+
 int64_t get_addr_for_symbol(SymbolTable* table, const char* name);
 
 void write_table(SymbolTable* table, FILE* output);
@@ -0,0 +1,250 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate_utils.h"
+#include "translate.h"
+#include "decode.h"
+#include "vm.h"
+#include "trace.h"
+
+/* Execution tracing for the VM. The program is stepped through run_vm() one
+   instruction at a time, so it behaves exactly as it would untraced, and
+   before each step the instruction fetch, any load or store and any beq or
+   bne are fed to simple models of an instruction cache, a data cache and a
+   table of 2-bit saturating branch counters. The counts are kept per
+   instruction and summed per label for the report.
+ */
+
+typedef struct {
+    CacheConfig config;
+    uint32_t sets;
+    uint32_t* tags;         // sets * ways line addresses, most recent first
+    uint8_t* valid;
+} Cache;
+
+/*******************************
+ * Models
+ *******************************/
+
+static int is_power_of_two(uint32_t n) {
+    return n && !(n & (n - 1));
+}
+
+/* Parses STR, of the form SIZE:WAYS:LINE, into CONFIG. SIZE and LINE are in
+   bytes; all three must be powers of two, LINE at least 4 and SIZE at least
+   WAYS * LINE. Returns 0 on success and -1 otherwise.
+ */
+int parse_cache_config(const char* str, CacheConfig* config) {
+    char buf[64];
+    long int values[3];
+    if (strlen(str) >= sizeof(buf)) {
+        return -1;
+    }
+    strcpy(buf, str);
+    char* part = buf;
+    for (int i = 0; i < 3; i++) {
+        char* end = strchr(part, ':');
+        if ((i < 2) != (end != NULL)) {
+            return -1;
+        }
+        if (end) {
+            *end = '\0';
+        }
+        if (translate_num(&values[i], part, 1, 1 << 30) == -1
+            || !is_power_of_two(values[i])) {
+            return -1;
+        }
+        part = end + 1;
+    }
+    if (values[2] < 4 || values[0] < values[1] * values[2]) {
+        return -1;
+    }
+    config->size = values[0];
+    config->ways = values[1];
+    config->line = values[2];
+    return 0;
+}
+
+static Cache* create_cache(const CacheConfig* config) {
+    Cache* cache = (Cache*) malloc(sizeof(Cache));
+    if (!cache) {
+        allocation_failed();
+    }
+    cache->config = *config;
+    cache->sets = config->size / (config->ways * config->line);
+    cache->tags = (uint32_t*) calloc(config->size / config->line, sizeof(uint32_t));
+    cache->valid = (uint8_t*) calloc(config->size / config->line, sizeof(uint8_t));
+    if (!cache->tags || !cache->valid) {
+        allocation_failed();
+    }
+    return cache;
+}
+
+static void free_cache(Cache* cache) {
+    free(cache->tags);
+    free(cache->valid);
+    free(cache);
+}
+
+/* Looks up the line holding ADDR in CACHE and makes it the most recently
+   used in its set, filling it on a miss. Returns 1 on a hit and 0 on a miss.
+ */
+static int access_cache(Cache* cache, uint32_t addr) {
+    uint32_t line = addr / cache->config.line;
+    uint32_t ways = cache->config.ways;
+    uint32_t* tags = &cache->tags[(line % cache->sets) * ways];
+    uint8_t* valid = &cache->valid[(line % cache->sets) * ways];
+    uint32_t way = ways - 1;
+    int hit = 0;
+    for (uint32_t w = 0; w < ways; w++) {
+        if (valid[w] && tags[w] == line) {
+            way = w;
+            hit = 1;
+            break;
+        }
+    }
+    memmove(&tags[1], &tags[0], way * sizeof(uint32_t));
+    memmove(&valid[1], &valid[0], way * sizeof(uint8_t));
+    tags[0] = line;
+    valid[0] = 1;
+    return hit;
+}
+
+/*******************************
+ * Tracing
+ *******************************/
+
+/* Runs VM like run_vm() with the same BUDGET, while counting cache and
+   branch predictor events for each instruction in COUNTS, which has an entry
+   per word of the text and must be zeroed by the caller. Returns the same
+   status run_vm() would have.
+ */
+VmStatus trace_vm(Vm* vm, uint64_t budget, const TraceConfig* config, TraceCounts* counts) {
+    Cache* icache = create_cache(&config->icache);
+    Cache* dcache = create_cache(&config->dcache);
+    uint32_t entries = config->predictor_entries;
+    uint8_t* counters = (uint8_t*) malloc(entries);
+    if (!counters) {
+        allocation_failed();
+    }
+    memset(counters, 1, entries);       // weakly not taken
+
+    VmStatus status = VM_OUT_OF_BUDGET;
+    uint64_t start = vm->executed;
+    while (budget == 0 || vm->executed - start < budget) {
+        uint32_t pc = vm->pc;
+        uint32_t index = (pc - vm->base) / 4;
+        if (pc % 4 != 0 || index >= vm->len) {
+            status = run_vm(vm, 1);
+            break;
+        }
+
+        uint32_t word = vm->words[index];
+        TraceCounts* c = &counts[index];
+        c->fetches++;
+        c->fetch_misses += !access_cache(icache, pc);
+        if (is_load_word(word) || (word >> 26) == 0x28 || (word >> 26) == 0x2b) {
+            DecodedInst d;
+            decode_inst(word, &d);
+            c->accesses++;
+            c->access_misses += !access_cache(dcache, vm->regs[d.rs] + d.imm);
+        }
+
+        status = run_vm(vm, 1);
+        if (is_branch_word(word) && status == VM_OUT_OF_BUDGET) {
+            uint8_t* counter = &counters[index % entries];
+            int taken = vm->pc != pc + 4;
+            c->branches++;
+            c->mispredicts += taken != (*counter >= 2);
+            if (taken && *counter < 3) {
+                (*counter)++;
+            } else if (!taken && *counter > 0) {
+                (*counter)--;
+            }
+        }
+        if (status != VM_OUT_OF_BUDGET) {
+            break;
+        }
+    }
+
+    free(counters);
+    free_cache(icache);
+    free_cache(dcache);
+    return status;
+}
+
+static int compare_symbols(const void* a, const void* b) {
+    const Symbol* x = a;
+    const Symbol* y = b;
+    return x->addr < y->addr ? -1 : x->addr > y->addr;
+}
+
+static double percent(uint64_t part, uint64_t whole) {
+    return whole ? 100.0 * part / whole : 0.0;
+}
+
+static void print_counts(FILE* output, const char* label, const TraceCounts* c) {
+    fprintf(output, "  %-20s %10lu %7.2f%% %10lu %7.2f%% %10lu %7.2f%%\n", label,
+        (unsigned long) c->fetches, percent(c->fetch_misses, c->fetches),
+        (unsigned long) c->accesses, percent(c->access_misses, c->accesses),
+        (unsigned long) c->branches, percent(c->mispredicts, c->branches));
+}
+
+static void add_counts(TraceCounts* sum, const TraceCounts* c) {
+    sum->fetches += c->fetches;
+    sum->fetch_misses += c->fetch_misses;
+    sum->accesses += c->accesses;
+    sum->access_misses += c->access_misses;
+    sum->branches += c->branches;
+    sum->mispredicts += c->mispredicts;
+}
+
+/* Prints COUNTS summed over the code between each label in SYMTBL and the
+   next, skipping labels whose code never ran, and a total line. Labels that
+   share an address are reported under the first of them.
+ */
+void print_trace_report(Vm* vm, SymbolTable* symtbl, const TraceConfig* config,
+    const TraceCounts* counts, FILE* output) {
+    Symbol* syms = (Symbol*) malloc((symtbl->len + 1) * sizeof(Symbol));
+    if (!syms) {
+        allocation_failed();
+    }
+    memcpy(syms, symtbl->tbl, symtbl->len * sizeof(Symbol));
+    qsort(syms, symtbl->len, sizeof(Symbol), compare_symbols);
+
+    fprintf(output, "Trace (I-cache %u B %u-way %u B lines, D-cache %u B %u-way %u B lines, "
+        "%u 2-bit counters):\n", config->icache.size, config->icache.ways,
+        config->icache.line, config->dcache.size, config->dcache.ways, config->dcache.line,
+        config->predictor_entries);
+    fprintf(output, "  %-20s %10s %8s %10s %8s %10s %8s\n", "label", "fetches", "miss",
+        "accesses", "miss", "branches", "mispred");
+
+    TraceCounts total, region;
+    memset(&total, 0, sizeof(total));
+    memset(&region, 0, sizeof(region));
+    const char* label = "(start)";
+    uint32_t s = 0;
+    for (uint32_t i = 0; i <= vm->len; i++) {
+        while (s < symtbl->len && syms[s].addr / 4 < i) {
+            s++;
+        }
+        if (i == vm->len || (s < symtbl->len && syms[s].addr / 4 == i)) {
+            if (region.fetches > 0) {
+                print_counts(output, label, &region);
+            }
+            memset(&region, 0, sizeof(region));
+            if (i < vm->len) {
+                label = syms[s].name;
+            }
+        }
+        if (i < vm->len) {
+            add_counts(&region, &counts[i]);
+            add_counts(&total, &counts[i]);
+        }
+    }
+    print_counts(output, "total", &total);
+    free(syms);
+}
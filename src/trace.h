@@ -0,0 +1,36 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+/* Geometry of a set-associative cache with LRU replacement. */
+typedef struct {
+    uint32_t size;          // bytes
+    uint32_t ways;
+    uint32_t line;          // bytes per line
+} CacheConfig;
+
+typedef struct {
+    CacheConfig icache;
+    CacheConfig dcache;
+    uint32_t predictor_entries;     // 2-bit counters, indexed by word address
+} TraceConfig;
+
+/* Events counted for one instruction, or summed over a label. */
+typedef struct {
+    uint64_t fetches;
+    uint64_t fetch_misses;
+    uint64_t accesses;      // loads and stores
+    uint64_t access_misses;
+    uint64_t branches;      // beq and bne executed
+    uint64_t mispredicts;
+} TraceCounts;
+
+int parse_cache_config(const char* str, CacheConfig* config);
+
+VmStatus trace_vm(Vm* vm, uint64_t budget, const TraceConfig* config, TraceCounts* counts);
+
+void print_trace_report(Vm* vm, SymbolTable* symtbl, const TraceConfig* config,
+    const TraceCounts* counts, FILE* output);
+
+#endif
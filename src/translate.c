@@ -6,6 +6,7 @@
 #include "tables.h"
 #include "translate_utils.h"
 #include "translate.h"
+#include "data.h"
 
 /* SOLUTION CODE BELOW */
 const int TWO_POW_SEVENTEEN = 131072;    // 2^17
@@ -26,9 +27,20 @@ const int TWO_POW_SEVENTEEN = 131072;    // 2^17
    Also for li:
     - make sure that the number is representable by 32 bits. (Hint: the number 
         can be both signed or unsigned).
-    - if the immediate can fit in the imm field of an addiu instruction, then
-        expand li into a single addiu instruction. Otherwise, expand it into 
-        a lui-ori pair.
+    - expand li into the shortest correct sequence, writing the target
+        register directly rather than going through $at:
+        1. a single addiu if the number fits in a signed 16-bit immediate.
+        2. a single ori if the number fits in an unsigned 16-bit immediate.
+        3. a single lui if the lower 16 bits of the number are zero.
+        4. otherwise a lui-ori pair.
+
+   la always expands into a lui-ori pair, since the address of its label, a
+   data label at DATA_BASE or above, is only known in pass two. The halves
+   are written as LABEL@hi and LABEL@lo for translate_inst() to fill in,
+   which rejects a text label: its offset would be loaded as if it were an
+   address, and no relocation moves it to where the text is loaded. An
+   address given as a number, as an expression like LABEL+4 becomes in pass
+   one, is split into its halves right away.
 
    If you are going to use the $zero or $0, use $0, not $zero.
 
@@ -55,14 +67,24 @@ unsigned write_pass_one(FILE* output, const char* name, char** args, int num_arg
             return 0;
         }
         long int imm;
-        translate_num(&imm, args[1], LONG_MIN, LONG_MAX);
-        if (imm < 65536) {      
-            fprintf(output, "addiu %s $0 %s\n", args[0], args[1]);
-            return 1;
+        if (translate_num(&imm, args[1], INT32_MIN, UINT32_MAX) == -1) {
+            return 0;
         }
-        else {
-            fprintf(output, "lui $at %ld\n", imm>>16);
-            fprintf(output, "ori %s $at %ld\n", args[0], imm & 0xFFFF);
+        imm = (int32_t) imm;    // unsigned spellings share bits with signed ones
+        uint32_t upper = ((uint32_t) imm >> 16) & 0xFFFF;
+        uint32_t lower = (uint32_t) imm & 0xFFFF;
+        if (imm >= INT16_MIN && imm <= INT16_MAX) {
+            fprintf(output, "addiu %s $0 %ld\n", args[0], imm);
+            return 1;
+        } else if (imm >= 0 && imm <= UINT16_MAX) {
+            fprintf(output, "ori %s $0 %ld\n", args[0], imm);
+            return 1;
+        } else if (lower == 0) {
+            fprintf(output, "lui %s %u\n", args[0], upper);
+            return 1;
+        } else {
+            fprintf(output, "lui %s %u\n", args[0], upper);
+            fprintf(output, "ori %s %s %u\n", args[0], args[0], lower);
             return 2;
         }
     } else if (strcmp(name, "push") == 0) {
@@ -79,6 +101,22 @@ unsigned write_pass_one(FILE* output, const char* name, char** args, int num_arg
         fprintf(output, "lw %s 0($sp)\n", args[0]);
         fprintf(output, "addiu $sp $sp 4\n");
         return 2;  
+    } else if (strcmp(name, "la") == 0) {
+        /* The address of a label is only known in pass two, so the halves
+           are left for translate_inst() to fill in. An expression has been
+           evaluated to a number already. */
+        long int address;
+        if (num_args == 2 && translate_num(&address, args[1], 0, UINT32_MAX) == 0) {
+          fprintf(output, "lui %s %lu\n", args[0], (unsigned long) address >> 16);
+          fprintf(output, "ori %s %s %lu\n", args[0], args[0], (unsigned long) address & 0xffff);
+          return 2;
+        }
+        if (num_args != 2 || !is_valid_label(args[1])) {
+          return 0;
+        }
+        fprintf(output, "lui %s %s@hi\n", args[0], args[1]);
+        fprintf(output, "ori %s %s %s@lo\n", args[0], args[0], args[1]);
+        return 2;
     } else if (strcmp(name, "mod") == 0) {
         if (num_args != 3) {
           return 0;
@@ -86,21 +124,37 @@ unsigned write_pass_one(FILE* output, const char* name, char** args, int num_arg
         fprintf(output, "div %s %s\n", args[1], args[2]);
         fprintf(output, "mfhi %s\n", args[0]);
         return 2;  
-    } else if (strcmp(name, "subu") == 0) {
-        if (num_args != 3) {
-          return 0;
-        }
-        fprintf(output, "addiu $at $0 -1\n");
-        fprintf(output, "xor $at $at %s\n", args[2]);
-        fprintf(output, "addiu $at $at 1\n");
-        fprintf(output, "addu %s %s $at\n", args[0], args[1]);
-        return 4;
     }
     write_inst_string(output, name, args, num_args);
     return 1;
 
 }
 
+/* Writes to BUF, in decimal, the half of a label's address that ARG, of the
+   form LABEL@hi or LABEL@lo as written for la, names. Returns 0 on success
+   and -1 if ARG is not of that form or LABEL is not a data label in SYMTBL.
+ */
+static int resolve_address_half(const char* arg, SymbolTable* symtbl, char* buf) {
+    const char* at = strchr(arg, '@');
+    if (!symtbl || (strcmp(at, "@hi") != 0 && strcmp(at, "@lo") != 0)) {
+        return -1;
+    }
+    char* label = (char*) malloc(at - arg + 1);
+    if (!label) {
+        allocation_failed();
+    }
+    memcpy(label, arg, at - arg);
+    label[at - arg] = '\0';
+    int64_t label_addr = get_addr_for_symbol(symtbl, label);
+    free(label);
+    if (label_addr < DATA_BASE) {
+        return -1;
+    }
+    uint32_t half = strcmp(at, "@hi") == 0 ? (uint32_t) label_addr >> 16 : label_addr & 0xffff;
+    sprintf(buf, "%u", half);
+    return 0;
+}
+
 /* Writes the instruction in hexadecimal format to OUTPUT during pass #2.
    
    NAME is the name of the instruction, ARGS is an array of the arguments, and
@@ -127,6 +181,18 @@ int translate_inst(FILE* output, const char* name, char** args, size_t num_args,
     if (!output || !name || !args || !num_args) {
       return -1;
     }
+    /* The halves of an address written by la. */
+    if ((strcmp(name, "lui") == 0 || strcmp(name, "ori") == 0) && num_args <= 3
+        && args[num_args - 1] && strchr(args[num_args - 1], '@')) {
+      char half[16];
+      char* resolved[3];
+      memcpy(resolved, args, num_args * sizeof(char*));
+      if (resolve_address_half(args[num_args - 1], symtbl, half) != 0) {
+        return -1;
+      }
+      resolved[num_args - 1] = half;
+      return translate_inst(output, name, resolved, num_args, addr, symtbl, reltbl);
+    }
     if (strcmp(name, "beq") == 0 || strcmp(name, "bne") == 0) {
       if (!symtbl) {
         return -1;
@@ -139,13 +205,22 @@ int translate_inst(FILE* output, const char* name, char** args, size_t num_args,
 
     }
     if (strcmp(name, "addu") == 0)       return write_rtype (0x21, output, args, num_args);
+    else if (strcmp(name, "sub") == 0)   return write_rtype (0x22, output, args, num_args);
+    else if (strcmp(name, "subu") == 0)  return write_rtype (0x23, output, args, num_args);
+    else if (strcmp(name, "and") == 0)   return write_rtype (0x24, output, args, num_args);
     else if (strcmp(name, "or") == 0)    return write_rtype (0x25, output, args, num_args);
+    else if (strcmp(name, "nor") == 0)   return write_rtype (0x27, output, args, num_args);
     else if (strcmp(name, "slt") == 0)   return write_rtype (0x2a, output, args, num_args);
     else if (strcmp(name, "sltu") == 0)  return write_rtype (0x2b, output, args, num_args);
     else if (strcmp(name, "sll") == 0)   return write_shift (0x00, output, args, num_args);
+    else if (strcmp(name, "srl") == 0)   return write_shift (0x02, output, args, num_args);
+    else if (strcmp(name, "sra") == 0)   return write_shift (0x03, output, args, num_args);
     else if (strcmp(name, "xor") == 0)   return write_rtype(0x26, output, args, num_args);
     else if (strcmp(name, "jr") == 0)    return write_jr (0x08, output, args, num_args);
     else if (strcmp(name, "addiu") == 0) return write_addiu (0x09, output, args, num_args);
+    else if (strcmp(name, "slti") == 0)  return write_addiu (0x0a, output, args, num_args);
+    else if (strcmp(name, "sltiu") == 0) return write_addiu (0x0b, output, args, num_args);
+    else if (strcmp(name, "andi") == 0)  return write_ori (0x0c, output, args, num_args);
     else if (strcmp(name, "ori") == 0)   return write_ori (0x0d, output, args, num_args);
     else if (strcmp(name, "lui") == 0)   return write_lui (0x0f, output, args, num_args);
     else if (strcmp(name, "lb") == 0)    return write_mem (0x20, output, args, num_args);
@@ -155,8 +230,8 @@ int translate_inst(FILE* output, const char* name, char** args, size_t num_args,
     else if (strcmp(name, "sw") == 0)    return write_mem (0x2b, output, args, num_args);
     else if (strcmp(name, "beq") == 0)   return write_branch (0x04, output, args, num_args, addr, symtbl);
     else if (strcmp(name, "bne") == 0)   return write_branch (0x05, output, args, num_args, addr, symtbl);
-    else if (strcmp(name, "j") == 0)     return write_jump (0x02, output, args, num_args, addr, reltbl);
-    else if (strcmp(name, "jal") == 0)   return write_jump (0x03, output, args, num_args, addr, reltbl);
+    else if (strcmp(name, "j") == 0)     return write_jump (0x02, output, args, num_args, addr, symtbl, reltbl);
+    else if (strcmp(name, "jal") == 0)   return write_jump (0x03, output, args, num_args, addr, symtbl, reltbl);
     else if (strcmp(name, "mult") == 0)  return write_mult_div (0x18, output, args, num_args);
     else if (strcmp(name, "div") == 0)   return write_mult_div (0x1a, output, args, num_args);
     else if (strcmp(name, "mfhi") == 0)  return write_mfhi_mflo (0x10, output, args, num_args);
@@ -164,6 +239,91 @@ int translate_inst(FILE* output, const char* name, char** args, size_t num_args,
     else                                 return -1;
 }
 
+/* Returns the bit for register name ARG in a def/use set, or 0 for $0, which
+   never carries a dependence.
+ */
+static uint64_t reg_bit(const char* arg) {
+    int reg = translate_reg(arg);
+    return reg > 0 ? (uint64_t) 1 << reg : 0;
+}
+
+/* Fills EFFECTS with the registers instruction NAME reads and writes, and
+   whether it accesses memory. The operands are taken from ARGS in the same
+   positions that the write_*() function for NAME reads them from. HI and LO
+   are written by mult and div and read by mfhi and mflo; jal writes $ra.
+
+   Returns 0 on success and -1 if NAME is not an instruction that
+   translate_inst() accepts with NUM_ARGS arguments.
+ */
+int get_inst_effects(const char* name, char** args, size_t num_args, InstEffects* effects) {
+    effects->def = 0;
+    effects->use = 0;
+    effects->reads_mem = 0;
+    effects->writes_mem = 0;
+    if (!name || (num_args && !args)) {
+        return -1;
+    }
+    for (size_t i = 0; i < num_args; i++) {
+        if (!args[i]) {
+            return -1;
+        }
+    }
+
+    static const char* RTYPES[] = { "addu", "sub", "subu", "and", "or", "nor", "slt",
+        "sltu", "xor" };
+    static const char* ITYPES[] = { "addiu", "slti", "sltiu", "andi", "ori" };
+    for (size_t i = 0; i < sizeof(RTYPES) / sizeof(RTYPES[0]); i++) {
+        if (strcmp(name, RTYPES[i]) == 0 && num_args == 3) {
+            effects->def = reg_bit(args[0]);
+            effects->use = reg_bit(args[1]) | reg_bit(args[2]);
+            return 0;
+        }
+    }
+    for (size_t i = 0; i < sizeof(ITYPES) / sizeof(ITYPES[0]); i++) {
+        if (strcmp(name, ITYPES[i]) == 0 && num_args == 3) {
+            effects->def = reg_bit(args[0]);
+            effects->use = reg_bit(args[1]);
+            return 0;
+        }
+    }
+
+    if ((strcmp(name, "sll") == 0 || strcmp(name, "srl") == 0 || strcmp(name, "sra") == 0)
+        && num_args == 3) {
+        effects->def = reg_bit(args[0]);
+        effects->use = reg_bit(args[1]);
+    } else if (strcmp(name, "lui") == 0 && num_args == 2) {
+        effects->def = reg_bit(args[0]);
+    } else if ((strcmp(name, "lb") == 0 || strcmp(name, "lbu") == 0
+        || strcmp(name, "lw") == 0) && num_args == 3) {
+        effects->def = reg_bit(args[0]);
+        effects->use = reg_bit(args[2]);
+        effects->reads_mem = 1;
+    } else if ((strcmp(name, "sb") == 0 || strcmp(name, "sw") == 0) && num_args == 3) {
+        effects->use = reg_bit(args[0]) | reg_bit(args[2]);
+        effects->writes_mem = 1;
+    } else if ((strcmp(name, "beq") == 0 || strcmp(name, "bne") == 0) && num_args == 3) {
+        effects->use = reg_bit(args[0]) | reg_bit(args[1]);
+    } else if (strcmp(name, "j") == 0 && num_args == 1) {
+        /* No registers. */
+    } else if (strcmp(name, "jal") == 0 && num_args == 1) {
+        effects->def = (uint64_t) 1 << 31;
+    } else if (strcmp(name, "jr") == 0 && num_args == 1) {
+        effects->use = reg_bit(args[0]);
+    } else if ((strcmp(name, "mult") == 0 || strcmp(name, "div") == 0) && num_args == 2) {
+        effects->def = ((uint64_t) 1 << REG_HI) | ((uint64_t) 1 << REG_LO);
+        effects->use = reg_bit(args[0]) | reg_bit(args[1]);
+    } else if (strcmp(name, "mfhi") == 0 && num_args == 1) {
+        effects->def = reg_bit(args[0]);
+        effects->use = (uint64_t) 1 << REG_HI;
+    } else if (strcmp(name, "mflo") == 0 && num_args == 1) {
+        effects->def = reg_bit(args[0]);
+        effects->use = (uint64_t) 1 << REG_LO;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
 /* A helper function for writing most R-type instructions. You should use
    translate_reg() to parse registers and write_inst_hex() to write to 
    OUTPUT. Both are defined in translate_utils.h.
@@ -240,6 +400,7 @@ int write_jr(uint8_t funct, FILE* output, char** args, size_t num_args) {
     return 0;
 }
 
+/* Also used by slti and sltiu, which share the sign-extended immediate. */
 int write_addiu(uint8_t opcode, FILE* output, char** args, size_t num_args) {
     // Perhaps perform some error checking?
     if (num_args != 3) {
@@ -264,6 +425,7 @@ int write_addiu(uint8_t opcode, FILE* output, char** args, size_t num_args) {
     return 0;
 }
 
+/* Also used by andi, which shares the zero-extended immediate. */
 int write_ori(uint8_t opcode, FILE* output, char** args, size_t num_args) {
     // Perhaps perform some error checking?
     if (num_args != 3) {
@@ -377,7 +539,7 @@ int write_mem(uint8_t opcode, FILE* output, char** args, size_t num_args) {
 /*  A helper function to determine if a destination address
     can be branched to
 */
-static int can_branch_to(uint32_t src_addr, uint32_t dest_addr) {
+int can_branch_to(uint32_t src_addr, uint32_t dest_addr) {
     int32_t diff = dest_addr - src_addr;
     return (diff >= 0 && diff <= TWO_POW_SEVENTEEN) || (diff < 0 && diff >= -(TWO_POW_SEVENTEEN - 4));
 }
@@ -407,12 +569,45 @@ int write_branch(uint8_t opcode, FILE* output, char** args, size_t num_args, uin
     return 0;
 }
 
-int write_jump(uint8_t opcode, FILE* output, char** args, size_t num_args, uint32_t addr, SymbolTable* reltbl) {
+/* Set by resolve_local_jumps(). */
+static int jumps_resolved = 0;
+static uint32_t text_base = 0;
+static SymbolTable* exported_labels = NULL;
+
+/* Makes write_jump() encode the target of a j or jal directly when it is a
+   label in the symbol table that is not in EXPORTED, for text loaded at
+   address BASE, instead of leaving a relocation for the linker. Labels in
+   EXPORTED, which may be NULL, and undefined labels still get one. Turned
+   off again by passing 0 for ENABLE.
+ */
+void resolve_local_jumps(int enable, uint32_t base, SymbolTable* exported) {
+    jumps_resolved = enable;
+    text_base = base;
+    exported_labels = exported;
+}
+
+/* Writes a j or jal. Its target is encoded now if resolve_local_jumps() is
+   in effect and the label is local, and is otherwise left as zero with an
+   entry in RELTBL. Returns -1 if a local target lies outside the 256 MB
+   region of the instruction after the jump, which the 26-bit field cannot
+   reach.
+ */
+int write_jump(uint8_t opcode, FILE* output, char** args, size_t num_args, uint32_t addr,
+    SymbolTable* symtbl, SymbolTable* reltbl) {
     if (num_args != 1) {
         return -1;
     }
-    add_to_table(reltbl, args[0], addr);
     uint32_t instruction = (opcode << 26);
+    int64_t label_addr = jumps_resolved ? get_addr_for_symbol(symtbl, args[0]) : -1;
+    if (label_addr != -1 && get_addr_for_symbol(exported_labels, args[0]) == -1) {
+        uint32_t target = text_base + (uint32_t) label_addr;
+        if (((text_base + addr + 4) ^ target) & 0xf0000000) {
+            return -1;
+        }
+        instruction |= (target >> 2) & 0x3ffffff;
+    } else {
+        add_to_table(reltbl, args[0], addr);
+    }
     write_inst_hex(output, instruction);
     return 0; 
 }
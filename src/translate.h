@@ -10,6 +10,21 @@ unsigned write_pass_one(FILE* output, const char* name, char** args, int num_arg
 int translate_inst(FILE* output, const char* name, char** args, size_t num_args, 
     uint32_t addr, SymbolTable* symtbl, SymbolTable* reltbl);
 
+/* Registers read and written by one instruction. Bit N of DEF and USE stands
+   for register $N; HI and LO get the two bits above the general registers.
+ */
+#define REG_HI 32
+#define REG_LO 33
+
+typedef struct {
+    uint64_t def;           // registers written
+    uint64_t use;           // registers read
+    int reads_mem;          // lb, lbu or lw
+    int writes_mem;         // sb or sw
+} InstEffects;
+
+int get_inst_effects(const char* name, char** args, size_t num_args, InstEffects* effects);
+
 /* Declaring helper functions: */
 
 int write_rtype(uint8_t funct, FILE* output, char** args, size_t num_args);
@@ -32,10 +47,14 @@ int write_lui(uint8_t opcode, FILE* output, char** args, size_t num_args);
 
 int write_mem(uint8_t opcode, FILE* output, char** args, size_t num_args);
 
+int can_branch_to(uint32_t src_addr, uint32_t dest_addr);
+
 int write_branch(uint8_t opcode, FILE* output, char** args, size_t num_args, 
     uint32_t addr, SymbolTable* symtbl);
 
+void resolve_local_jumps(int enable, uint32_t base, SymbolTable* exported);
+
 int write_jump(uint8_t opcode, FILE* output, char** args, size_t num_args, 
-    uint32_t addr, SymbolTable* reltbl);
+    uint32_t addr, SymbolTable* symtbl, SymbolTable* reltbl);
 
 #endif
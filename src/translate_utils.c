@@ -3,6 +3,7 @@
 #include <string.h>
 #include <ctype.h>
 
+#include "tables.h"
 #include "translate_utils.h"
 
 /* A helper function used in translate.c */
@@ -14,9 +15,26 @@ void write_inst_string(FILE* output, const char* name, char** args, int num_args
     fprintf(output, "\n");
 }
 
+static WordBuffer* captured = NULL;
+
+void capture_inst_hex(WordBuffer* words) {
+    captured = words;
+}
+
 /* A helper function used in translate.c */
 void write_inst_hex(FILE *output, uint32_t instruction) {
     fprintf(output, "%08x\n", instruction);
+    if (captured) {
+        if (captured->len == captured->cap) {
+            captured->cap = captured->cap ? captured->cap * 2 : 64;
+            captured->words = (uint32_t*) realloc(captured->words,
+                captured->cap * sizeof(uint32_t));
+            if (!captured->words) {
+                allocation_failed();
+            }
+        }
+        captured->words[captured->len++] = instruction;
+    }
 }
 
 /* A helper function used in assembler.c */
@@ -81,6 +99,7 @@ int translate_reg(const char* str) {
     else if (strcmp(str, "$0") == 0)    return 0;
     else if (strcmp(str, "$at") == 0)   return 1;
     else if (strcmp(str, "$v0") == 0)   return 2;
+    else if (strcmp(str, "$v1") == 0)   return 3;
     else if (strcmp(str, "$a0") == 0)   return 4;
     else if (strcmp(str, "$a1") == 0)   return 5;
     else if (strcmp(str, "$a2") == 0)   return 6;
@@ -89,10 +108,23 @@ int translate_reg(const char* str) {
     else if (strcmp(str, "$t1") == 0)   return 9;
     else if (strcmp(str, "$t2") == 0)   return 10;
     else if (strcmp(str, "$t3") == 0)   return 11;
+    else if (strcmp(str, "$t4") == 0)   return 12;
+    else if (strcmp(str, "$t5") == 0)   return 13;
+    else if (strcmp(str, "$t6") == 0)   return 14;
+    else if (strcmp(str, "$t7") == 0)   return 15;
     else if (strcmp(str, "$s0") == 0)   return 16;
     else if (strcmp(str, "$s1") == 0)   return 17;
     else if (strcmp(str, "$s2") == 0)   return 18;
     else if (strcmp(str, "$s3") == 0)   return 19;
+    else if (strcmp(str, "$s4") == 0)   return 20;
+    else if (strcmp(str, "$s5") == 0)   return 21;
+    else if (strcmp(str, "$s6") == 0)   return 22;
+    else if (strcmp(str, "$s7") == 0)   return 23;
+    else if (strcmp(str, "$t8") == 0)   return 24;
+    else if (strcmp(str, "$t9") == 0)   return 25;
+    else if (strcmp(str, "$k0") == 0)   return 26;
+    else if (strcmp(str, "$k1") == 0)   return 27;
+    else if (strcmp(str, "$gp") == 0)   return 28;
     else if (strcmp(str, "$sp") == 0)   return 29;
     else if (strcmp(str, "$fp") == 0)   return 30;
     else if (strcmp(str, "$ra") == 0)   return 31;
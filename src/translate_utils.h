@@ -9,9 +9,21 @@
  */
 void write_inst_string(FILE* output, const char* name, char** args, int num_args);
 
+/* A growable array of encoded instructions. */
+typedef struct {
+    uint32_t* words;
+    uint32_t len;
+    uint32_t cap;
+} WordBuffer;
+
 /* Writes the instruction to OUTPUT in hexadecimal format. */
 void write_inst_hex(FILE* output, uint32_t instruction);
 
+/* Makes write_inst_hex() also append every instruction it writes to WORDS,
+   until called again with NULL.
+ */
+void capture_inst_hex(WordBuffer* words);
+
 /* Returns 1 if the label is valid and 0 if it is invalid. A valid label is one
    where the first character is a character or underscore and the remaining 
    characters are either characters, digits, or underscores.
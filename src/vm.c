@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "utils.h"
+#include "tables.h"
+#include "translate.h"
+#include "decode.h"
+#include "vm.h"
+
+/* A threaded-code interpreter for the words written in pass two. The text is
+   decoded once into an array of VmOp, one per word, that holds the fields
+   each instruction needs already extracted and sign- or zero-extended, and
+   branch and jump targets already turned into op indices. run_vm() replaces
+   the kind of each op with the address of its handler the first time it
+   runs, and every handler ends by jumping straight to the handler of the
+   next op (direct threading with the GNU C labels-as-values extension).
+
+   Memory is little-endian, as in MARS. sub does not trap on overflow and a
+   div by zero leaves HI and LO unchanged.
+ */
+
+typedef enum {
+    OP_NOP, OP_ADDU, OP_SUBU, OP_AND, OP_OR, OP_XOR, OP_NOR, OP_SLT, OP_SLTU,
+    OP_SLL, OP_SRL, OP_SRA, OP_JR, OP_MULT, OP_DIV, OP_MFHI, OP_MFLO,
+    OP_ADDIU, OP_SLTI, OP_SLTIU, OP_ANDI, OP_ORI, OP_LUI,
+    OP_LB, OP_LBU, OP_LW, OP_SB, OP_SW, OP_BEQ, OP_BNE, OP_J, OP_JAL,
+    OP_INVALID,             // a word that translate_inst() never writes
+    OP_END,                 // one past the last word, where execution halts
+    OP_BAD_TARGET,          // where branches and jumps outside the text go
+    NUM_OP_KINDS
+} OpKind;
+
+struct VmOp {
+    const void* handler;    // set by run_vm()
+    uint8_t kind;
+    uint8_t rd;             // destination register, or rt for I-type
+    uint8_t rs;
+    uint8_t rt;
+    uint32_t imm;           // extended immediate, shift amount or op index
+    uint32_t link;          // return address written by jal
+};
+
+/*******************************
+ * Loading
+ *******************************/
+
+/* Returns the op index of the instruction at byte address ADDR, or LEN + 1
+   (OP_BAD_TARGET) if ADDR is not the address of a word in the text or the
+   end of it.
+ */
+static uint32_t op_index(Vm* vm, uint32_t addr) {
+    uint32_t offset = addr - vm->base;
+    if (offset % 4 != 0 || offset / 4 > vm->len) {
+        return vm->len + 1;
+    }
+    return offset / 4;
+}
+
+static void decode_op(Vm* vm, uint32_t i, VmOp* op) {
+    DecodedInst d;
+    decode_inst(vm->words[i], &d);
+    uint32_t addr = vm->base + i * 4;
+    op->handler = NULL;
+    op->kind = OP_INVALID;
+    op->rs = d.rs;
+    op->rt = d.rt;
+    op->rd = d.rd;
+    op->imm = (uint32_t) d.imm;
+    op->link = addr + 4;
+
+    if (d.opcode == 0) {
+        op->imm = d.shamt;
+        switch (d.funct) {
+            case 0x21: op->kind = OP_ADDU; break;
+            case 0x22: case 0x23: op->kind = OP_SUBU; break;
+            case 0x24: op->kind = OP_AND; break;
+            case 0x25: op->kind = OP_OR; break;
+            case 0x26: op->kind = OP_XOR; break;
+            case 0x27: op->kind = OP_NOR; break;
+            case 0x2a: op->kind = OP_SLT; break;
+            case 0x2b: op->kind = OP_SLTU; break;
+            case 0x00: op->kind = OP_SLL; break;
+            case 0x02: op->kind = OP_SRL; break;
+            case 0x03: op->kind = OP_SRA; break;
+            case 0x08: op->kind = OP_JR; break;
+            case 0x18: op->kind = OP_MULT; break;
+            case 0x1a: op->kind = OP_DIV; break;
+            case 0x10: op->kind = OP_MFHI; break;
+            case 0x12: op->kind = OP_MFLO; break;
+        }
+        if (op->rd == 0 && op->kind != OP_JR && op->kind != OP_MULT && op->kind != OP_DIV
+            && op->kind != OP_INVALID) {
+            op->kind = OP_NOP;
+        }
+        return;
+    }
+
+    op->rd = d.rt;
+    switch (d.opcode) {
+        case 0x09: op->kind = OP_ADDIU; break;
+        case 0x0a: op->kind = OP_SLTI; break;
+        case 0x0b: op->kind = OP_SLTIU; break;
+        case 0x0c: op->kind = OP_ANDI; op->imm &= 0xffff; break;
+        case 0x0d: op->kind = OP_ORI; op->imm &= 0xffff; break;
+        case 0x0f: op->kind = OP_LUI; op->imm <<= 16; break;
+        case 0x20: op->kind = OP_LB; break;
+        case 0x24: op->kind = OP_LBU; break;
+        case 0x23: op->kind = OP_LW; break;
+        case 0x28: op->kind = OP_SB; break;
+        case 0x2b: op->kind = OP_SW; break;
+        case 0x04: case 0x05:
+            op->kind = d.opcode == 0x04 ? OP_BEQ : OP_BNE;
+            op->imm = op_index(vm, addr + 4 + (d.imm << 2));
+            return;
+        case 0x02: case 0x03:
+            op->kind = d.opcode == 0x02 ? OP_J : OP_JAL;
+            op->imm = op_index(vm, ((addr + 4) & 0xf0000000) | (d.target << 2));
+            return;
+    }
+    if (op->rd == 0 && op->kind >= OP_ADDIU && op->kind <= OP_LUI) {
+        op->kind = OP_NOP;
+    }
+}
+
+/* Clears the registers of VM and points it at the first instruction. $sp
+   starts at the top of memory and $ra at VM_HALT_ADDR.
+ */
+static void start_vm(Vm* vm) {
+    memset(vm->regs, 0, sizeof(vm->regs));
+    vm->regs[29] = VM_MEM_BASE + VM_MEM_SIZE;
+    vm->regs[31] = VM_HALT_ADDR;
+    vm->hi = 0;
+    vm->lo = 0;
+    vm->pc = vm->base;
+    vm->executed = 0;
+    vm->fault = NULL;
+}
+
+/* Loads the LEN words in WORDS, written in pass two for a program starting at
+   address BASE, into a new VM. Every entry of RELTBL is resolved against
+   SYMTBL and the jump it names is patched, so the words must not have been
+   linked yet. Returns NULL and logs an error if a relocation names a symbol
+   that SYMTBL does not define.
+ */
+Vm* create_vm(const uint32_t* words, uint32_t len, SymbolTable* symtbl,
+    SymbolTable* reltbl, uint32_t base) {
+    Vm* vm = (Vm*) calloc(1, sizeof(Vm));
+    if (!vm) {
+        allocation_failed();
+    }
+    vm->base = base;
+    vm->len = len;
+    vm->words = (uint32_t*) malloc((len + 1) * sizeof(uint32_t));
+    vm->ops = (VmOp*) malloc((len + 2) * sizeof(VmOp));
+    /* Mapped rather than calloc()ed: once a block this size has been freed,
+       malloc serves the next one from the heap and calloc() has to clear all
+       of it, which dominates the cost of running many short programs. */
+    vm->mem = (uint8_t*) mmap(NULL, VM_MEM_SIZE, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (vm->mem == MAP_FAILED) {
+        vm->mem = NULL;
+    }
+    if (!vm->words || !vm->ops || !vm->mem) {
+        allocation_failed();
+    }
+    memcpy(vm->words, words, len * sizeof(uint32_t));
+
+    for (uint32_t i = 0; i < reltbl->len; i++) {
+        Symbol* rel = &reltbl->tbl[i];
+        int64_t target = get_addr_for_symbol(symtbl, rel->name);
+        if (target == -1) {
+            write_to_log("Error: undefined symbol in run mode: %s\n", rel->name);
+            free_vm(vm);
+            return NULL;
+        }
+        if (rel->addr / 4 < len) {
+            uint32_t* word = &vm->words[rel->addr / 4];
+            *word = (*word & 0xfc000000) | (((base + (uint32_t) target) >> 2) & 0x3ffffff);
+        }
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        decode_op(vm, i, &vm->ops[i]);
+    }
+    memset(&vm->ops[len], 0, 2 * sizeof(VmOp));
+    vm->ops[len].kind = OP_END;
+    vm->ops[len + 1].kind = OP_BAD_TARGET;
+    start_vm(vm);
+    return vm;
+}
+
+/* Loads the LEN bytes in BYTES, a .data section, at the start of VM's
+   memory, where the data labels of pass two point. They are loaded again by
+   every reset_vm(). Returns 0 on success and -1, after logging an error, if
+   they do not fit.
+ */
+int load_vm_data(Vm* vm, const uint8_t* bytes, uint32_t len) {
+    if (len > VM_MEM_SIZE) {
+        write_to_log("Error: %u bytes of data do not fit in the VM's memory\n", len);
+        return -1;
+    }
+    free(vm->data);
+    vm->data = (uint8_t*) malloc(len + 1);
+    if (!vm->data) {
+        allocation_failed();
+    }
+    memcpy(vm->data, bytes, len);
+    vm->data_len = len;
+    memcpy(vm->mem, bytes, len);
+    return 0;
+}
+
+/* Returns VM to the state create_vm() left it in, with memory cleared and
+   any data loaded again.
+ */
+void reset_vm(Vm* vm) {
+    memset(vm->mem, 0, VM_MEM_SIZE);
+    if (vm->data) {
+        memcpy(vm->mem, vm->data, vm->data_len);
+    }
+    start_vm(vm);
+}
+
+void free_vm(Vm* vm) {
+    if (!vm) {
+        return;
+    }
+    free(vm->words);
+    free(vm->ops);
+    free(vm->data);
+    if (vm->mem) {
+        munmap(vm->mem, VM_MEM_SIZE);
+    }
+    free(vm);
+}
+
+/*******************************
+ * Execution
+ *******************************/
+
+/* Runs VM from its current pc until it halts, faults or has executed BUDGET
+   more instructions. A BUDGET of 0 means no limit. Returns why it stopped;
+   the registers, pc and executed count are left as they were at that point,
+   and for VM_FAULT the pc is that of the faulting instruction and fault
+   describes the problem.
+ */
+VmStatus run_vm(Vm* vm, uint64_t budget) {
+    static const void* const HANDLERS[NUM_OP_KINDS] = {
+        [OP_NOP] = &&op_nop, [OP_ADDU] = &&op_addu, [OP_SUBU] = &&op_subu,
+        [OP_AND] = &&op_and, [OP_OR] = &&op_or, [OP_XOR] = &&op_xor,
+        [OP_NOR] = &&op_nor, [OP_SLT] = &&op_slt, [OP_SLTU] = &&op_sltu,
+        [OP_SLL] = &&op_sll, [OP_SRL] = &&op_srl, [OP_SRA] = &&op_sra,
+        [OP_JR] = &&op_jr, [OP_MULT] = &&op_mult, [OP_DIV] = &&op_div,
+        [OP_MFHI] = &&op_mfhi, [OP_MFLO] = &&op_mflo, [OP_ADDIU] = &&op_addiu,
+        [OP_SLTI] = &&op_slti, [OP_SLTIU] = &&op_sltiu, [OP_ANDI] = &&op_andi,
+        [OP_ORI] = &&op_ori, [OP_LUI] = &&op_lui, [OP_LB] = &&op_lb,
+        [OP_LBU] = &&op_lbu, [OP_LW] = &&op_lw, [OP_SB] = &&op_sb, [OP_SW] = &&op_sw,
+        [OP_BEQ] = &&op_beq, [OP_BNE] = &&op_bne, [OP_J] = &&op_j, [OP_JAL] = &&op_jal,
+        [OP_INVALID] = &&op_invalid, [OP_END] = &&op_end, [OP_BAD_TARGET] = &&op_bad_target
+    };
+    if (!vm->threaded) {
+        for (uint32_t i = 0; i < vm->len + 2; i++) {
+            vm->ops[i].handler = HANDLERS[vm->ops[i].kind];
+        }
+        vm->threaded = 1;
+    }
+
+    VmOp* const ops = vm->ops;
+    uint32_t* const r = vm->regs;
+    uint8_t* const mem = vm->mem - VM_MEM_BASE;
+    uint64_t remaining = budget ? budget : UINT64_MAX;
+    const uint64_t start = remaining;
+    VmStatus status;
+    VmOp* op = &ops[op_index(vm, vm->pc)];
+    VmOp* from = NULL;      // the last branch or jump taken
+    uint32_t addr;
+
+    /* Every handler counts itself against the budget before moving on. */
+    #define DISPATCH() goto *op->handler
+    #define NEXT() do { op++; if (--remaining == 0) goto out_of_budget; DISPATCH(); } while (0)
+    #define GOTO(index) do { from = op; op = &ops[index]; if (--remaining == 0) goto out_of_budget; \
+        DISPATCH(); } while (0)
+    #define CHECK_ADDR(size) do { addr = r[op->rs] + op->imm; \
+        if (addr - VM_MEM_BASE > VM_MEM_SIZE - (size) || (addr & ((size) - 1))) \
+            goto bad_address; } while (0)
+
+    DISPATCH();
+
+op_nop:     NEXT();
+op_addu:    r[op->rd] = r[op->rs] + r[op->rt]; NEXT();
+op_subu:    r[op->rd] = r[op->rs] - r[op->rt]; NEXT();
+op_and:     r[op->rd] = r[op->rs] & r[op->rt]; NEXT();
+op_or:      r[op->rd] = r[op->rs] | r[op->rt]; NEXT();
+op_xor:     r[op->rd] = r[op->rs] ^ r[op->rt]; NEXT();
+op_nor:     r[op->rd] = ~(r[op->rs] | r[op->rt]); NEXT();
+op_slt:     r[op->rd] = (int32_t) r[op->rs] < (int32_t) r[op->rt]; NEXT();
+op_sltu:    r[op->rd] = r[op->rs] < r[op->rt]; NEXT();
+op_sll:     r[op->rd] = r[op->rt] << op->imm; NEXT();
+op_srl:     r[op->rd] = r[op->rt] >> op->imm; NEXT();
+op_sra:     r[op->rd] = (uint32_t) ((int32_t) r[op->rt] >> op->imm); NEXT();
+op_mult: {
+    int64_t product = (int64_t) (int32_t) r[op->rs] * (int32_t) r[op->rt];
+    vm->lo = (uint32_t) product;
+    vm->hi = (uint32_t) ((uint64_t) product >> 32);
+    NEXT();
+}
+op_div: {
+    int32_t n = (int32_t) r[op->rs];
+    int32_t d = (int32_t) r[op->rt];
+    if (d != 0 && !(n == INT32_MIN && d == -1)) {
+        vm->lo = (uint32_t) (n / d);
+        vm->hi = (uint32_t) (n % d);
+    } else if (d == -1) {
+        vm->lo = (uint32_t) n;
+        vm->hi = 0;
+    }
+    NEXT();
+}
+op_mfhi:    r[op->rd] = vm->hi; NEXT();
+op_mflo:    r[op->rd] = vm->lo; NEXT();
+op_addiu:   r[op->rd] = r[op->rs] + op->imm; NEXT();
+op_slti:    r[op->rd] = (int32_t) r[op->rs] < (int32_t) op->imm; NEXT();
+op_sltiu:   r[op->rd] = r[op->rs] < op->imm; NEXT();
+op_andi:    r[op->rd] = r[op->rs] & op->imm; NEXT();
+op_ori:     r[op->rd] = r[op->rs] | op->imm; NEXT();
+op_lui:     r[op->rd] = op->imm; NEXT();
+op_lb:      CHECK_ADDR(1); r[op->rd] = (uint32_t) (int8_t) mem[addr]; r[0] = 0; NEXT();
+op_lbu:     CHECK_ADDR(1); r[op->rd] = mem[addr]; r[0] = 0; NEXT();
+op_lw:      CHECK_ADDR(4); memcpy(&r[op->rd], &mem[addr], 4); r[0] = 0; NEXT();
+op_sb:      CHECK_ADDR(1); mem[addr] = (uint8_t) r[op->rt]; NEXT();
+op_sw:      CHECK_ADDR(4); memcpy(&mem[addr], &r[op->rt], 4); NEXT();
+op_beq:
+    if (r[op->rs] == r[op->rt]) {
+        GOTO(op->imm);
+    }
+    NEXT();
+op_bne:
+    if (r[op->rs] != r[op->rt]) {
+        GOTO(op->imm);
+    }
+    NEXT();
+op_j:       GOTO(op->imm);
+op_jal:     r[31] = op->link; GOTO(op->imm);
+op_jr:
+    if (r[op->rs] == VM_HALT_ADDR) {
+        remaining--;
+        op = &ops[vm->len];
+        goto op_end;
+    }
+    GOTO(op_index(vm, r[op->rs]));
+
+op_end:
+    status = VM_HALTED;
+    goto done;
+op_invalid:
+    vm->fault = "invalid instruction";
+    status = VM_FAULT;
+    goto done;
+op_bad_target:
+    op = from;
+    vm->fault = "branch or jump outside the text";
+    status = VM_FAULT;
+    goto done;
+bad_address:
+    vm->fault = "memory access out of range or misaligned";
+    status = VM_FAULT;
+    goto done;
+out_of_budget:
+    /* Stopping right before the end or a bad target is the same as running
+       into it. */
+    if (op->kind == OP_BAD_TARGET) {
+        goto op_bad_target;
+    }
+    status = op->kind == OP_END ? VM_HALTED : VM_OUT_OF_BUDGET;
+    goto done;
+
+    #undef DISPATCH
+    #undef NEXT
+    #undef GOTO
+    #undef CHECK_ADDR
+
+done:
+    if (op) {
+        vm->pc = vm->base + (uint32_t) (op - ops) * 4;
+    }
+    vm->executed += start - remaining;
+    return status;
+}
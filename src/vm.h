@@ -0,0 +1,51 @@
+#ifndef VM_H
+#define VM_H
+
+#include <stdint.h>
+
+/* Memory layout seen by programs run in the VM. Text starts at the base
+   address, data and stack share one zero-filled region, and $ra starts out
+   holding VM_HALT_ADDR so that returning from the entry point halts.
+ */
+#define VM_MEM_BASE 0x10000000
+#define VM_MEM_SIZE (16 << 20)
+#define VM_HALT_ADDR 0xfffffffc
+
+typedef enum {
+    VM_HALTED,              // returned to VM_HALT_ADDR or ran off the end of text
+    VM_FAULT,               // bad memory access, jump or instruction
+    VM_OUT_OF_BUDGET        // executed the number of instructions it was allowed
+} VmStatus;
+
+typedef struct VmOp VmOp;
+
+typedef struct {
+    uint32_t regs[32];
+    uint32_t hi;
+    uint32_t lo;
+    uint32_t pc;            // address of the next instruction to execute
+    uint32_t base;          // address of the first instruction
+    uint8_t* mem;           // VM_MEM_SIZE bytes starting at VM_MEM_BASE
+    uint64_t executed;      // instructions executed so far
+    const char* fault;      // what went wrong, if the last run faulted
+
+    uint32_t* words;        // text, with relocations applied
+    uint32_t len;
+    uint8_t* data;          // copied to VM_MEM_BASE on every start, if not NULL
+    uint32_t data_len;
+    VmOp* ops;              // pre-decoded text, plus one op past the end
+    int threaded;           // ops hold handler addresses
+} Vm;
+
+Vm* create_vm(const uint32_t* words, uint32_t len, SymbolTable* symtbl,
+    SymbolTable* reltbl, uint32_t base);
+
+int load_vm_data(Vm* vm, const uint8_t* bytes, uint32_t len);
+
+void reset_vm(Vm* vm);
+
+void free_vm(Vm* vm);
+
+VmStatus run_vm(Vm* vm, uint64_t budget);
+
+#endif
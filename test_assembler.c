@@ -62,6 +62,11 @@ void test_translate_reg() {
     CU_ASSERT_EQUAL(translate_reg("$t3"), 11);
     CU_ASSERT_EQUAL(translate_reg("$s0"), 16);
     CU_ASSERT_EQUAL(translate_reg("$s1"), 17);
+    CU_ASSERT_EQUAL(translate_reg("$v1"), 3);
+    CU_ASSERT_EQUAL(translate_reg("$t7"), 15);
+    CU_ASSERT_EQUAL(translate_reg("$s7"), 23);
+    CU_ASSERT_EQUAL(translate_reg("$t9"), 25);
+    CU_ASSERT_EQUAL(translate_reg("$gp"), 28);
     CU_ASSERT_EQUAL(translate_reg("$3"), -1);
     CU_ASSERT_EQUAL(translate_reg("asdf"), -1);
     CU_ASSERT_EQUAL(translate_reg("hey there"), -1);